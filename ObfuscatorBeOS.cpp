@@ -0,0 +1,381 @@
+/******************************************************************************
+ * ObfuscatorBeOS.cpp
+ *
+ * Source and sink implementations using the BeOS storage kit, see
+ * ObfuscatorBeOS.h.
+ */
+
+/* Standard C Library. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* BeOS (Be Operating System) headers. */
+
+#include <fs_attr.h>
+#include <Node.h>
+#include <Directory.h>
+#include <Entry.h>
+#include <File.h>
+#include <Path.h>
+
+/* This library's headers. */
+
+#include "ObfuscatorBeOS.h"
+#include "ObfuscatorTrace.h"
+
+
+/******************************************************************************
+ * Source files and directories, wrapping a BNode subclass.
+ */
+
+template <class InterfaceClass, class NodeClass>
+class BeOSSourceNode : public InterfaceClass
+{
+public:
+  BeOSSourceNode (const IOPolicyRecord &Policy)
+    : mPolicy (Policy)
+  {
+  };
+
+  NodeClass & Node () { return mNode; };
+  BPath & Path () { return mPath; };
+
+  virtual const char * GetPath ()
+  {
+    return mPath.Path ();
+  };
+
+  virtual status_t RewindAttrs ()
+  {
+    TRACE_SPAN ("RewindAttrs");
+    return mNode.RewindAttrs ();
+  };
+
+  virtual status_t GetNextAttrName (char *pAttributeName)
+  {
+    return mNode.GetNextAttrName (pAttributeName);
+  };
+
+  virtual status_t GetAttrInfo (const char *pAttributeName,
+    attr_info *pAttributeInfo)
+  {
+    TRACE_SPAN ("GetAttrInfo");
+    return mNode.GetAttrInfo (pAttributeName, pAttributeInfo);
+  };
+
+  virtual ssize_t ReadAttr (const char *pAttributeName, uint32 Type,
+    off_t Offset, void *pBuffer, size_t BufferSize)
+  {
+    TRACE_SPAN ("ReadAttr");
+    return mNode.ReadAttr (pAttributeName, Type, Offset, pBuffer, BufferSize);
+  };
+
+protected:
+  NodeClass mNode;
+  BPath mPath;
+  const IOPolicyRecord &mPolicy;
+};
+
+
+class BeOSSourceFile : public BeOSSourceNode<ObfuscateSourceFile, BFile>
+{
+public:
+  BeOSSourceFile (const IOPolicyRecord &Policy)
+    : BeOSSourceNode<ObfuscateSourceFile, BFile> (Policy)
+  {
+  };
+
+  virtual status_t GetSize (off_t *pSize)
+  {
+    return mNode.GetSize (pSize);
+  };
+
+  virtual ssize_t ReadData (char *pBuffer, off_t BufferSize)
+  {
+    int FileDescriptor = open (mPath.Path (), O_RDONLY);
+    if (FileDescriptor < 0)
+      return ERRNO_TO_STATUS (errno);
+    ssize_t AmountRead = ReadFileData (mPolicy, FileDescriptor, pBuffer,
+      BufferSize);
+    close (FileDescriptor);
+    return AmountRead;
+  };
+};
+
+
+class BeOSSourceDirectory :
+  public BeOSSourceNode<ObfuscateSourceDirectory, BDirectory>
+{
+public:
+  BeOSSourceDirectory (const IOPolicyRecord &Policy)
+    : BeOSSourceNode<ObfuscateSourceDirectory, BDirectory> (Policy)
+  {
+  };
+
+  virtual status_t Rewind ()
+  {
+    return mNode.Rewind ();
+  };
+
+  virtual status_t GetNextEntry (char *pName, struct stat *pStat)
+  {
+    TRACE_SPAN ("GetNextEntry");
+    BEntry Entry;
+    status_t ErrorNumber = mNode.GetNextEntry (&Entry);
+    if (ErrorNumber != B_OK)
+      return ErrorNumber;
+    ErrorNumber = Entry.GetName (pName);
+    if (ErrorNumber != B_OK)
+      return ErrorNumber;
+    return Entry.GetStat (pStat);
+  };
+
+  virtual status_t OpenFile (const char *pName, ObfuscateSourceFile **ppFile)
+  {
+    BEntry Entry (&mNode, pName);
+    BeOSSourceFile *pNewFile = new (std::nothrow) BeOSSourceFile (mPolicy);
+    if (pNewFile == NULL)
+      return B_NO_MEMORY;
+    status_t ErrorNumber = pNewFile->Node().SetTo (&Entry, B_READ_ONLY);
+    if (ErrorNumber == B_OK)
+      ErrorNumber = Entry.GetPath (&pNewFile->Path());
+    if (ErrorNumber != B_OK)
+    {
+      delete pNewFile;
+      return ErrorNumber;
+    }
+    *ppFile = pNewFile;
+    return B_OK;
+  };
+
+  virtual status_t OpenDirectory (const char *pName,
+    ObfuscateSourceDirectory **ppDirectory)
+  {
+    BEntry Entry (&mNode, pName);
+    BeOSSourceDirectory *pNewDir =
+      new (std::nothrow) BeOSSourceDirectory (mPolicy);
+    if (pNewDir == NULL)
+      return B_NO_MEMORY;
+    status_t ErrorNumber = pNewDir->Node().SetTo (&Entry);
+    if (ErrorNumber == B_OK)
+      ErrorNumber = Entry.GetPath (&pNewDir->Path());
+    if (ErrorNumber != B_OK)
+    {
+      delete pNewDir;
+      return ErrorNumber;
+    }
+    *ppDirectory = pNewDir;
+    return B_OK;
+  };
+};
+
+
+/******************************************************************************
+ * Sink files and directories, wrapping a BNode subclass.
+ */
+
+template <class InterfaceClass, class NodeClass>
+class BeOSSinkNode : public InterfaceClass
+{
+public:
+  BeOSSinkNode (const IOPolicyRecord &Policy)
+    : mPolicy (Policy)
+  {
+  };
+
+  NodeClass & Node () { return mNode; };
+  BPath & Path () { return mPath; };
+
+  virtual const char * GetPath ()
+  {
+    return mPath.Path ();
+  };
+
+  virtual ssize_t WriteAttr (const char *pAttributeName, uint32 Type,
+    off_t Offset, const void *pBuffer, size_t BufferSize)
+  {
+    TRACE_SPAN ("WriteAttr");
+    return mNode.WriteAttr (pAttributeName, Type, Offset, pBuffer,
+      BufferSize);
+  };
+
+protected:
+  NodeClass mNode;
+  BPath mPath;
+  const IOPolicyRecord &mPolicy;
+};
+
+
+class BeOSSinkFile : public BeOSSinkNode<ObfuscateSinkFile, BFile>
+{
+public:
+  BeOSSinkFile (const IOPolicyRecord &Policy)
+    : BeOSSinkNode<ObfuscateSinkFile, BFile> (Policy)
+  {
+  };
+
+  virtual char * AllocateDataBuffer (off_t DataSize)
+  {
+    return AllocateAlignedDataBuffer (mPolicy, DataSize);
+  };
+
+  virtual void FreeDataBuffer (char *pBuffer, off_t DataSize)
+  {
+    FreeAlignedDataBuffer (mPolicy, pBuffer, DataSize);
+  };
+
+  // The file contents go through a POSIX file descriptor rather than the
+  // BFile object, so that the I/O policy can be applied to them.
+
+  virtual ssize_t WriteData (const char *pBuffer, off_t DataSize)
+  {
+    int FileDescriptor = open (mPath.Path (), O_WRONLY);
+    if (FileDescriptor < 0)
+      return ERRNO_TO_STATUS (errno);
+    ssize_t AmountWritten = WriteFileData (mPolicy, FileDescriptor, pBuffer,
+      DataSize);
+    close (FileDescriptor);
+    return AmountWritten;
+  };
+};
+
+
+class BeOSSinkDirectory :
+  public BeOSSinkNode<ObfuscateSinkDirectory, BDirectory>
+{
+public:
+  BeOSSinkDirectory (const IOPolicyRecord &Policy)
+    : BeOSSinkNode<ObfuscateSinkDirectory, BDirectory> (Policy)
+  {
+  };
+
+  virtual bool Contains (const char *pName)
+  {
+    TRACE_SPAN ("Contains");
+    return mNode.Contains (pName);
+  };
+
+  virtual status_t GetEntryNames (std::set<std::string> &Names)
+  {
+    TRACE_SPAN ("GetEntryNames");
+    BEntry Entry;
+    char Name[B_FILE_NAME_LENGTH];
+    status_t ErrorNumber = mNode.Rewind ();
+    while (ErrorNumber == B_OK &&
+    (ErrorNumber = mNode.GetNextEntry (&Entry)) == B_OK)
+    {
+      ErrorNumber = Entry.GetName (Name);
+      if (ErrorNumber == B_OK)
+        Names.insert (Name);
+    }
+    if (ErrorNumber == B_ENTRY_NOT_FOUND)
+      ErrorNumber = B_OK; // Reaching end of list isn't an error.
+    return ErrorNumber;
+  };
+
+  virtual status_t CreateFile (const char *pName, ObfuscateSinkFile **ppFile)
+  {
+    TRACE_SPAN ("CreateFile");
+    BeOSSinkFile *pNewFile = new (std::nothrow) BeOSSinkFile (mPolicy);
+    if (pNewFile == NULL)
+      return B_NO_MEMORY;
+    status_t ErrorNumber = mNode.CreateFile (pName, &pNewFile->Node(),
+      true /* fail if exists */);
+    if (ErrorNumber == B_OK)
+      ErrorNumber = pNewFile->Path().SetTo (&mNode, pName);
+    if (ErrorNumber != B_OK)
+    {
+      delete pNewFile;
+      return ErrorNumber;
+    }
+    *ppFile = pNewFile;
+    return B_OK;
+  };
+
+  virtual status_t CreateDirectory (const char *pName,
+    ObfuscateSinkDirectory **ppDirectory)
+  {
+    TRACE_SPAN ("CreateDirectory");
+    BeOSSinkDirectory *pNewDir =
+      new (std::nothrow) BeOSSinkDirectory (mPolicy);
+    if (pNewDir == NULL)
+      return B_NO_MEMORY;
+    status_t ErrorNumber = mNode.CreateDirectory (pName, &pNewDir->Node());
+    if (ErrorNumber == B_OK)
+      ErrorNumber = pNewDir->Path().SetTo (&mNode, pName);
+    if (ErrorNumber != B_OK)
+    {
+      delete pNewDir;
+      return ErrorNumber;
+    }
+    *ppDirectory = pNewDir;
+    return B_OK;
+  };
+
+  virtual status_t Finish ()
+  {
+    if (!mPolicy.mSyncAtEnd)
+      return B_OK;
+    return SyncFileSystem (mPath.Path ());
+  };
+};
+
+
+/******************************************************************************
+ * Factory functions for the top level directories.
+ */
+
+status_t BeOSOpenSourceDirectory (const char *pPath,
+  const IOPolicyRecord &Policy, ObfuscateSourceDirectory **ppDirectory)
+{
+  BeOSSourceDirectory *pNewDir = new (std::nothrow) BeOSSourceDirectory (Policy);
+  if (pNewDir == NULL)
+    return B_NO_MEMORY;
+  status_t ErrorNumber = pNewDir->Node().SetTo (pPath);
+  if (ErrorNumber == B_OK)
+    ErrorNumber = pNewDir->Path().SetTo (&pNewDir->Node(), ".");
+  if (ErrorNumber != B_OK)
+  {
+    delete pNewDir;
+    return ErrorNumber;
+  }
+  *ppDirectory = pNewDir;
+  return B_OK;
+}
+
+
+status_t BeOSOpenSinkDirectory (const char *pPath,
+  const IOPolicyRecord &Policy, bool CreateIfMissing,
+  ObfuscateSinkDirectory **ppDirectory, bool *pCreated)
+{
+  if (pCreated != NULL)
+    *pCreated = false;
+
+  BeOSSinkDirectory *pNewDir = new (std::nothrow) BeOSSinkDirectory (Policy);
+  if (pNewDir == NULL)
+    return B_NO_MEMORY;
+
+  status_t ErrorNumber = pNewDir->Node().SetTo (pPath);
+  if (ErrorNumber == B_ENTRY_NOT_FOUND && CreateIfMissing)
+  {
+    ErrorNumber = create_directory (pPath, 0777);
+    if (ErrorNumber == B_OK)
+    {
+      if (pCreated != NULL)
+        *pCreated = true;
+      ErrorNumber = pNewDir->Node().SetTo (pPath);
+    }
+  }
+  if (ErrorNumber == B_OK)
+    ErrorNumber = pNewDir->Path().SetTo (&pNewDir->Node(), ".");
+  if (ErrorNumber != B_OK)
+  {
+    delete pNewDir;
+    return ErrorNumber;
+  }
+  *ppDirectory = pNewDir;
+  return B_OK;
+}
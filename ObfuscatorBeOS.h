@@ -0,0 +1,26 @@
+/******************************************************************************
+ * ObfuscatorBeOS.h
+ *
+ * Source and sink implementations for BeOS and Haiku, using the BNode, BFile
+ * and BDirectory classes, so attributes keep their types.  File contents go
+ * through POSIX file descriptors so that the I/O policy can be applied.
+ */
+
+#ifndef OBFUSCATOR_BEOS_H
+#define OBFUSCATOR_BEOS_H
+
+#include "ObfuscatorInterfaces.h"
+#include "ObfuscatorIOPolicy.h"
+
+// Opens an existing directory for reading.  The policy needs to stay around
+// while the directory and things opened from it are in use.
+status_t BeOSOpenSourceDirectory (const char *pPath,
+  const IOPolicyRecord &Policy, ObfuscateSourceDirectory **ppDirectory);
+
+// Opens a directory for writing, creating it first if it doesn't exist and
+// CreateIfMissing is true, in which case *pCreated gets set to true.
+status_t BeOSOpenSinkDirectory (const char *pPath,
+  const IOPolicyRecord &Policy, bool CreateIfMissing,
+  ObfuscateSinkDirectory **ppDirectory, bool *pCreated = NULL);
+
+#endif /* OBFUSCATOR_BEOS_H */
@@ -0,0 +1,200 @@
+/******************************************************************************
+ * ObfuscatorBenchmark.cpp
+ *
+ * Measures the per-entry cost of the verbosity and tracing checks which the
+ * compile time policies (ObfuscatePolicy in ObfuscatorCore.h) take out of the
+ * quiet case.  A synthetic tree, from a saved profile or a built in one of
+ * mostly empty files, is obfuscated into the in-memory sink with KeepData off,
+ * so nearly all the time goes on per-entry work rather than copying data.
+ *
+ * Each round does several passes with all the checks compiled in but turned
+ * off at run time, the way a quiet run worked before the policies, and as many
+ * with the quiet policy, alternating between the two.  The median of the
+ * rounds is reported, along with whether the difference stands out from the
+ * round to round variation.
+ */
+
+/* Standard C Library. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Standard C++ library. */
+
+#include <algorithm>
+#include <vector>
+
+/* This program's library headers. */
+
+#include "ObfuscatorCore.h"
+#include "ObfuscatorMemory.h"
+#include "ObfuscatorProfile.h"
+
+using namespace std;
+
+
+/******************************************************************************
+ * The built in tree: 50 directories of 2000 files each.  Nine files in ten are
+ * empty and the rest have a few dozen bytes, and each has one short attribute,
+ * so the per-entry costs aren't lost in the data copying.
+ */
+
+static void MakeEmptyFilesProfile (TreeProfile &Profile)
+{
+  const int DirectoryCount = 50;
+  const int FilesPerDirectory = 2000;
+
+  Profile.AddEntry (true, 0, 0);
+  Profile.mFanOut.Add (DirectoryCount);
+  for (int iDir = 0; iDir < DirectoryCount; iDir++)
+  {
+    Profile.AddEntry (true, 1, 8 + iDir % 8);
+    Profile.AddAttribute (true, "BEOS:TYPE", B_MIME_STRING_TYPE, 22);
+    Profile.mFanOut.Add (FilesPerDirectory);
+    for (int iFile = 0; iFile < FilesPerDirectory; iFile++)
+    {
+      Profile.AddEntry (false, 2, 20 + iFile % 40);
+      Profile.mFileSizes.Add ((iFile % 10 == 0) ? 16 + iFile % 48 : 0);
+      Profile.AddAttribute (false, "BEOS:TYPE", B_MIME_STRING_TYPE, 22);
+    }
+  }
+}
+
+
+/******************************************************************************
+ * Obfuscate the synthetic tree once with the given policy, adding the time
+ * taken to *pTime and returning the number of files and directories done.
+ */
+
+template <class Policy>
+static status_t TimeOnePass (const TreeProfile &Profile, int64 *pTime,
+  long long int *pEntryCount)
+{
+  status_t ErrorNumber;
+  MemoryTree Dest (false /* KeepData */);
+  AutoDelete<ObfuscateSinkDirectory> DestDir;
+  AutoDelete<ObfuscateSourceDirectory> SourceDir;
+  Obfuscator TheObfuscator (VERBOSE_NONE);
+
+  ErrorNumber = SyntheticOpenSourceDirectory (Profile, 1 /* Seed */,
+    SourceDir.Address ());
+  if (ErrorNumber != B_OK)
+    return ErrorNumber;
+  ErrorNumber = Dest.OpenSinkDirectory (DestDir.Address ());
+  if (ErrorNumber != B_OK)
+    return ErrorNumber;
+
+  // CPU time rather than elapsed time, so other programs running matter less.
+  clock_t StartTime = clock ();
+  ErrorNumber = TheObfuscator.ObfuscateDirectory<Policy> (*SourceDir,
+    *DestDir);
+  *pTime += (clock () - StartTime) * ((int64) 1000000000 / CLOCKS_PER_SEC);
+
+  const MemoryTreeStatistics &Stats = Dest.Statistics ();
+  *pEntryCount = Stats.mDirectoryCount + Stats.mFileCount;
+  return ErrorNumber;
+}
+
+
+// Value a given fraction of the way through the sorted values.
+
+static double Percentile (vector<double> Values, double Fraction)
+{
+  sort (Values.begin (), Values.end ());
+  return Values[(size_t) (Fraction * (Values.size () - 1) + 0.5)];
+}
+
+
+int main (int argc, char** argv)
+{
+  TreeProfile Profile;
+  int RoundCount = 15;
+  int PassCount = 5;
+  status_t ErrorNumber = B_OK;
+
+  for (int iArg = 1; iArg < argc; iArg++)
+  {
+    if (strncmp (argv[iArg], "-profile=", 9) == 0)
+    {
+      ErrorNumber = Profile.Load (argv[iArg] + 9);
+      if (ErrorNumber != B_OK)
+      {
+        DisplayErrorMessage (argv[iArg] + 9, ErrorNumber,
+          "Unable to load profile");
+        return ErrorNumber;
+      }
+    }
+    else if (strncmp (argv[iArg], "-rounds=", 8) == 0)
+      RoundCount = atoi (argv[iArg] + 8);
+    else if (strncmp (argv[iArg], "-passes=", 8) == 0)
+      PassCount = atoi (argv[iArg] + 8);
+    else
+    {
+      printf ("Usage: %s [-profile=FILE] [-rounds=N] [-passes=N]\n"
+        "Times obfuscating a synthetic tree into memory with run time "
+        "verbosity checks\nand with the quiet compile time policy.\n",
+        argv[0]);
+      return -1;
+    }
+  }
+  if (Profile.mDirectoryCount == 0)
+    MakeEmptyFilesProfile (Profile);
+  if (RoundCount < 1)
+    RoundCount = 1;
+  if (PassCount < 1)
+    PassCount = 1;
+
+  // Tracing stays off, so the checking version tests the flag and skips the
+  // spans like a quiet run used to.
+
+  vector<double> CheckedPerEntry;
+  vector<double> QuietPerEntry;
+  vector<double> SavedPerEntry;
+  long long int EntryCount = 0;
+  for (int iRound = 0; iRound < RoundCount && ErrorNumber == B_OK; iRound++)
+  {
+    int64 CheckedTime = 0;
+    int64 QuietTime = 0;
+    for (int iRun = 0; iRun < 2 * PassCount && ErrorNumber == B_OK; iRun++)
+    {
+      if ((iRun + iRound) % 2 == 0)
+        ErrorNumber = TimeOnePass<VerboseTracedObfuscatePolicy> (Profile,
+          &CheckedTime, &EntryCount);
+      else
+        ErrorNumber = TimeOnePass<QuietObfuscatePolicy> (Profile,
+          &QuietTime, &EntryCount);
+    }
+    if (ErrorNumber != B_OK || EntryCount == 0)
+      break;
+
+    double EntriesDone = EntryCount * (double) PassCount;
+    CheckedPerEntry.push_back (CheckedTime / EntriesDone);
+    QuietPerEntry.push_back (QuietTime / EntriesDone);
+    SavedPerEntry.push_back ((CheckedTime - QuietTime) / EntriesDone);
+    printf ("Round %d: %d passes of %lld entries, per entry run time checks "
+      "%.1f ns,\nquiet policy %.1f ns.\n", iRound + 1, PassCount, EntryCount,
+      CheckedPerEntry.back (), QuietPerEntry.back ());
+  }
+
+  if (ErrorNumber != B_OK || EntryCount == 0)
+  {
+    DisplayErrorMessage ("Benchmark run failed", ErrorNumber, "Main");
+    return ErrorNumber != B_OK ? ErrorNumber : -1;
+  }
+
+  double MedianChecked = Percentile (CheckedPerEntry, 0.5);
+  double MedianSaved = Percentile (SavedPerEntry, 0.5);
+  double LowSaved = Percentile (SavedPerEntry, 0.25);
+  double HighSaved = Percentile (SavedPerEntry, 0.75);
+  printf ("Median of %d rounds: run time checks %.1f ns per entry, quiet "
+    "policy %.1f ns\nper entry, %.1f ns per entry (%.1f%%) removed, middle "
+    "half of the rounds %.1f to\n%.1f ns.\n", RoundCount, MedianChecked,
+    Percentile (QuietPerEntry, 0.5), MedianSaved,
+    100.0 * MedianSaved / MedianChecked, LowSaved, HighSaved);
+  if (LowSaved <= 0 && HighSaved >= 0)
+    printf ("That is within the round to round variation, no difference was "
+      "measured.\n");
+  return 0;
+}
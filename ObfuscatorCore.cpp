@@ -0,0 +1,781 @@
+/******************************************************************************
+ * ObfuscatorCore.cpp
+ *
+ * The platform independent part of the obfuscator, see ObfuscatorCore.h.
+ */
+
+/* Standard C Library. */
+
+#include <stdio.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/* Standard C++ library. */
+
+#include <iostream>
+
+/* This library's headers. */
+
+#include "ObfuscatorCore.h"
+#include "ObfuscatorTrace.h"
+
+using namespace std;
+
+
+/******************************************************************************
+ * Utility class to increment the indent level in its constructor and decrement
+ * in the destructor.
+ */
+
+class AutoIndentIncrement
+{
+public:
+  AutoIndentIncrement (int &IndentLevel, int IncrementAmount = 1)
+    : mIndentLevel (IndentLevel)
+  {
+    mIncrementAmount = IncrementAmount;
+    mIndentLevel += mIncrementAmount;
+  };
+
+  ~AutoIndentIncrement ()
+  {
+    mIndentLevel -= mIncrementAmount;
+  };
+
+private:
+  int &mIndentLevel;
+  int mIncrementAmount;
+};
+
+
+// Only indents for policies which print things.
+
+template <bool Enabled>
+class AutoIndentIncrementIf : public AutoIndentIncrement
+{
+public:
+  AutoIndentIncrementIf (int &IndentLevel) : AutoIndentIncrement (IndentLevel)
+  {
+  };
+};
+
+template <>
+class AutoIndentIncrementIf<false>
+{
+public:
+  AutoIndentIncrementIf (int & /* IndentLevel */)
+  {
+  };
+};
+
+
+/******************************************************************************
+ * Global utility function to display an error message and return.  The message
+ * part describes the error, and if ErrorNumber is non-zero, gets the string ",
+ * error code $X (standard description)." appended to it.  If the message is
+ * NULL then it gets defaulted to "Something went wrong".  The title part is
+ * printed before the whole thing.  The text gets printed to stderr.
+ */
+
+void DisplayErrorMessage (
+  const char *MessageString,
+  int ErrorNumber,
+  const char *TitleString)
+{
+  char ErrorBuffer [PATH_MAX + 1500];
+
+  if (TitleString == NULL)
+    TitleString = PROGRAM_NAME " Error Message";
+
+  if (MessageString == NULL)
+  {
+    if (ErrorNumber == 0)
+      MessageString = "No error, no message, why bother?";
+    else
+      MessageString = "Something went wrong";
+  }
+
+  if (ErrorNumber != 0)
+  {
+    snprintf (ErrorBuffer, sizeof (ErrorBuffer),
+      "%s, error code $%X/%d (%s) has occured.",
+      MessageString, ErrorNumber, ErrorNumber,
+      strerror (STATUS_TO_ERRNO (ErrorNumber)));
+    MessageString = ErrorBuffer;
+  }
+
+  cerr << TitleString << ": " << MessageString << endl;
+}
+
+
+Obfuscator::Obfuscator (eVerboseLevels VerboseLevel)
+  : mIndentLevel (0),
+    mSequenceNumber (0),
+    mVerboseLevel (VerboseLevel),
+    mpEntryListener (NULL)
+{
+}
+
+
+/******************************************************************************
+ * Print out a readable version of the given data buffer.  Hex dump plus
+ * strings.  Optionally cuts off after a few hundred bytes.  Indents too.
+ */
+
+void Obfuscator::DumpBuffer (const char *pBuffer, int BufferSize)
+{
+  AutoIndentIncrement AutoIndenter (mIndentLevel);
+  const char *pBufferEnd;
+  const int BytesPerLine = 16;
+  const int MaxPrintByteCount = 320;
+
+  if (pBuffer == NULL || BufferSize <= 0)
+    return;
+
+  if (mVerboseLevel < VERBOSE_EXTREME_DATA &&
+  BufferSize > MaxPrintByteCount)
+    pBufferEnd = pBuffer + MaxPrintByteCount;
+  else
+    pBufferEnd = pBuffer + BufferSize;
+
+  // Each byte printed uses 4 bytes of output: 2 for the hex digits, 1 for the
+  // string value, and one space.  Format is:
+  // 00 11 22 33 44 55 66 77 88 99 00 aa bb cc dd ee ff "0123456789abcdef"
+  char OutputLine[BytesPerLine * 4 + 3];
+
+  int LineBytes = 0;
+  memset (OutputLine, ' ', sizeof (OutputLine) - 1);
+  OutputLine[BytesPerLine * 3] = '"';
+  OutputLine[BytesPerLine * 4 + 1] = '"';
+  OutputLine[sizeof (OutputLine) - 1] = 0;
+  while (true)
+  {
+    char TempBuf[4];
+    unsigned char ByteValue = *pBuffer;
+    sprintf (TempBuf, "%02X", ByteValue);
+    OutputLine[LineBytes * 3] = TempBuf[0];
+    OutputLine[LineBytes * 3 + 1] = TempBuf[1];
+    if (ByteValue < 32)
+      ByteValue = '_'; // Can't print control characters, use underscore.
+    OutputLine[BytesPerLine * 3 + LineBytes + 1] = ByteValue;
+
+    pBuffer++;
+    LineBytes++;
+
+    if (LineBytes >= BytesPerLine || pBuffer >= pBufferEnd)
+    {
+      printf ("%*s%s\n", mIndentLevel, "", OutputLine);
+      LineBytes = 0;
+      memset (OutputLine, ' ', sizeof (OutputLine) - 1);
+      OutputLine[BytesPerLine * 3] = '"';
+      OutputLine[BytesPerLine * 4 + 1] = '"';
+      OutputLine[sizeof (OutputLine) - 1] = 0;
+    }
+
+    if (pBuffer >= pBufferEnd)
+      break;
+  }
+
+  if (mVerboseLevel < VERBOSE_EXTREME_DATA && BufferSize > MaxPrintByteCount)
+    printf ("%*s... and %d more bytes.\n", mIndentLevel, "",
+      BufferSize - MaxPrintByteCount);
+}
+
+
+/******************************************************************************
+ * Obfuscate the given buffer by filling it with the sequence number in ASCII
+ * text form.  Adds as many leading zeros as needed to fill the whole buffer.
+ * Result is not NUL terminated.
+ *
+ * Since this was originally running in 32 bit BeOS, the buffer can be at most
+ * about 1.8GB in size, thus BufferSize is fine as an int.
+ */
+
+void Obfuscator::ObfuscateBuffer (char *pBuffer, int BufferSize)
+{
+  const int NumberLength = OBFUSCATE_NUMBER_LENGTH;
+  char NumberString[NumberLength + 1];
+
+  if (pBuffer == NULL || BufferSize <= 0)
+  {
+    DisplayErrorMessage ("NULL or not postive size buffer inputs",
+      B_BAD_VALUE, "ObfuscateBuffer");
+    return;
+  }
+
+  memset (pBuffer, '0', BufferSize);
+  sprintf (NumberString, "%0*lld", NumberLength, mSequenceNumber++);
+
+  // Copy as much of the number as will fit to the end of the buffer.
+
+  int CopyLength = NumberLength;
+  int StartPosition = BufferSize - NumberLength;
+  if (StartPosition < 0)
+  {
+    CopyLength += StartPosition; // Reduces amount copied.
+    StartPosition = 0;
+  }
+  memcpy (pBuffer + StartPosition, NumberString + (NumberLength - CopyLength),
+    CopyLength);
+}
+
+
+/******************************************************************************
+ * Copy the attributes from a source (file or directory) to a similar type of
+ * destination.
+ */
+
+template <class Policy>
+status_t Obfuscator::ObfuscateAttributes (ObfuscateSourceNode &SourceNode,
+  ObfuscateSinkNode &DestNode)
+{
+  TRACE_SPAN_IF (Policy::TRACED, "ObfuscateAttributes");
+  char AttributeName[B_ATTR_NAME_LENGTH+1];
+  AutoIndentIncrementIf<Policy::VERBOSE> AutoIndenter (mIndentLevel);
+  char ErrorMessage[B_ATTR_NAME_LENGTH+100];
+  status_t ErrorNumber;
+
+  ErrorNumber = SourceNode.RewindAttrs();
+  if (ErrorNumber != B_OK)
+  {
+    DisplayErrorMessage ("Unable to rewind to first attribute", ErrorNumber,
+      "ObfuscateAttributes");
+    return ErrorNumber;
+  }
+
+  while (B_OK == (ErrorNumber = SourceNode.GetNextAttrName(AttributeName)))
+  {
+    TRACE_SPAN_IF (Policy::TRACED, "Attribute", AttributeName);
+    struct attr_info AttributeInfo;
+    ErrorNumber = SourceNode.GetAttrInfo(AttributeName, &AttributeInfo);
+    if (ErrorNumber != B_OK)
+    {
+      sprintf (ErrorMessage, "Can't get info about \"%s\" attribute",
+        AttributeName);
+      DisplayErrorMessage (ErrorMessage, ErrorNumber, "ObfuscateAttributes");
+      return ErrorNumber;
+    }
+
+    if (Policy::VERBOSE && mVerboseLevel >= VERBOSE_ATTR)
+    {
+      char TypeString[5];
+      uint32 TypeCode = B_BENDIAN_TO_HOST_INT32(AttributeInfo.type);
+      memcpy (TypeString, &TypeCode, 4);
+      TypeString[4] = 0;
+
+      printf ("%*sAttribute \"%s\" of type '%s', length %d.\n",
+        mIndentLevel, "", AttributeName, TypeString, (int) AttributeInfo.size);
+    }
+
+    if (AttributeInfo.size < 0)
+    {
+      ErrorNumber = B_BAD_VALUE;
+      sprintf (ErrorMessage, "Attribute \"%s\" has negative size %lld",
+        AttributeName, (long long int) AttributeInfo.size);
+      DisplayErrorMessage (ErrorMessage, ErrorNumber, "ObfuscateAttributes");
+      return ErrorNumber;
+    }
+
+    if (AttributeInfo.size > MAX_OBFUSCATE_BUFFER_SIZE)
+    {
+      if (Policy::VERBOSE && mVerboseLevel >= VERBOSE_ATTR)
+      {
+        AutoIndentIncrementIf<Policy::VERBOSE> AutoIndentMore (mIndentLevel);
+        printf ("%*sTruncating attribute \"%s\" size from %lld down to %d.\n",
+          mIndentLevel, "", AttributeName, (long long int) AttributeInfo.size,
+          MAX_OBFUSCATE_BUFFER_SIZE);
+      }
+      AttributeInfo.size = MAX_OBFUSCATE_BUFFER_SIZE;
+    }
+
+    char *pData = new (std::nothrow) char [AttributeInfo.size];
+    if (pData == NULL)
+    {
+      ErrorNumber = B_NO_MEMORY;
+      sprintf (ErrorMessage,
+        "Unable to allocate memory for attribute \"%s\" size %lld",
+        AttributeName, (long long int) AttributeInfo.size);
+      DisplayErrorMessage (ErrorMessage, ErrorNumber, "ObfuscateAttributes");
+      return ErrorNumber;
+    }
+
+    if (Policy::VERBOSE && mVerboseLevel >= VERBOSE_DATA)
+    {
+      ssize_t AmountRead = SourceNode.ReadAttr (AttributeName,
+        AttributeInfo.type, 0 /* offset */, pData, AttributeInfo.size);
+      if (AmountRead == AttributeInfo.size)
+      {
+        DumpBuffer (pData, AttributeInfo.size);
+      }
+      else
+      {
+        DisplayErrorMessage (AttributeName, AmountRead,
+          "Unable to read attribute value (nonfatal - don't need data)");
+      }
+    }
+
+    // For string type attributes, put the NUL back at the end of the
+    // obfuscated string, otherwise it looks weird in the attribute viewer.
+
+    if (AttributeInfo.size >= 1 && (AttributeInfo.type == B_MIME_STRING_TYPE ||
+    AttributeInfo.type == B_STRING_TYPE))
+    {
+      ObfuscateBuffer (pData, AttributeInfo.size - 1);
+      pData[AttributeInfo.size - 1] = 0;
+    }
+    else
+      ObfuscateBuffer (pData, AttributeInfo.size);
+
+    ssize_t AmountWritten = DestNode.WriteAttr (AttributeName,
+      AttributeInfo.type, 0 /* offset */, pData, AttributeInfo.size);
+    delete [] pData; // Get rid of buffer now, makes error handling easier.
+    if (AmountWritten != AttributeInfo.size)
+    {
+      ErrorNumber = AmountWritten;
+      if (ErrorNumber >= 0)
+        ErrorNumber = B_IO_ERROR;
+      sprintf (ErrorMessage, "Only wrote %d bytes of %d for \"%s\" attribute",
+        (int) AmountWritten, (int) AttributeInfo.size, AttributeName);
+      DisplayErrorMessage (ErrorMessage, ErrorNumber, "ObfuscateAttributes");
+      return ErrorNumber;
+    }
+
+  } // end while GetNextAttrName
+
+  if (ErrorNumber == B_ENTRY_NOT_FOUND)
+    ErrorNumber = B_OK; // Reaching end of list isn't an error.
+  else
+    DisplayErrorMessage ("Problems reading attribute name list", ErrorNumber,
+      "ObfuscateAttributes");
+
+  return ErrorNumber;
+}
+
+
+/******************************************************************************
+ * File contents are all '0' filler except for the sequence number at the end.
+ * If the sink can clone blocks from a template full of '0's, do that for the
+ * filler, leaving at least the number's worth of bytes at the end, and then
+ * write the remaining tail with the number.  The result is identical to
+ * writing the whole buffer, since ObfuscateBuffer pads with the same '0's.
+ */
+
+template <class Policy>
+status_t Obfuscator::CloneFileData (ObfuscateSinkFile &DestFile,
+  const char *DestName, off_t FileDataSize)
+{
+  TRACE_SPAN_IF (Policy::TRACED, "CloneFileData");
+  char ErrorMessage[B_FILE_NAME_LENGTH+100];
+  status_t ErrorNumber;
+
+  if (FileDataSize < CLONE_MIN_FILE_SIZE)
+    return B_NOT_SUPPORTED;
+
+  off_t BlockSize = DestFile.GetCloneBlockSize ();
+  if (BlockSize <= 0)
+    return B_NOT_SUPPORTED;
+
+  off_t CloneLength = FileDataSize - OBFUSCATE_NUMBER_LENGTH;
+  CloneLength -= CloneLength % BlockSize;
+  if (CloneLength <= 0)
+    return B_NOT_SUPPORTED;
+
+  ErrorNumber = DestFile.CloneZeroFill (CloneLength);
+  if (ErrorNumber == B_NOT_SUPPORTED)
+    return ErrorNumber;
+  if (ErrorNumber != B_OK)
+  {
+    DisplayErrorMessage (DestName, ErrorNumber,
+      "CloneFileData: Unable to clone file contents");
+    return ErrorNumber;
+  }
+
+  int TailSize = FileDataSize - CloneLength;
+  char *pTailData = new (std::nothrow) char [TailSize];
+  if (pTailData == NULL)
+  {
+    ErrorNumber = B_NO_MEMORY;
+    DisplayErrorMessage (DestName, ErrorNumber,
+      "CloneFileData: Unable to allocate memory for end of file");
+    return ErrorNumber;
+  }
+
+  ObfuscateBuffer (pTailData, TailSize);
+
+  ssize_t AmountWritten = DestFile.WriteDataAt (CloneLength, pTailData,
+    TailSize);
+  delete [] pTailData;
+  if (AmountWritten != TailSize)
+  {
+    ErrorNumber = AmountWritten;
+    if (ErrorNumber >= 0)
+      ErrorNumber = B_IO_ERROR;
+    sprintf (ErrorMessage, "Only wrote %d bytes of %d at the end of file "
+      "\"%s\"", (int) AmountWritten, TailSize, DestName);
+    DisplayErrorMessage (ErrorMessage, ErrorNumber, "CloneFileData");
+    return ErrorNumber;
+  }
+  return B_OK;
+}
+
+
+/******************************************************************************
+ * Given an already existing source file, create a destination one with
+ * obfuscated contents.
+ */
+
+template <class Policy>
+status_t Obfuscator::ObfuscateFile (ObfuscateSourceFile &SourceFile,
+  const char *SourceName, ObfuscateSinkDirectory &DestDir,
+  const char *DestName)
+{
+  TRACE_SPAN_IF (Policy::TRACED, "ObfuscateFile", SourceName);
+  AutoIndentIncrementIf<Policy::VERBOSE> AutoIndenter (mIndentLevel);
+  char ErrorMessage[B_FILE_NAME_LENGTH+100];
+  status_t ErrorNumber;
+
+  AutoDelete<ObfuscateSinkFile> DestFile;
+  ErrorNumber = DestDir.CreateFile (DestName, DestFile.Address ());
+  if (ErrorNumber != B_OK)
+  {
+    DisplayErrorMessage (DestName, ErrorNumber,
+      "ObfuscateFile: Unable to open file for writing");
+    return ErrorNumber;
+  }
+
+  if (Policy::VERBOSE && mVerboseLevel >= VERBOSE_FILE)
+  {
+    printf ("%*sFile \"%s\" is being obfuscated into \"%s\".\n",
+      mIndentLevel, "", SourceName, DestName);
+  }
+
+  ErrorNumber = ObfuscateAttributes<Policy> (SourceFile, *DestFile);
+  if (ErrorNumber != B_OK)
+  {
+    cerr << "Failed while obfuscating attributes of file \"" <<
+      SourceName << "\".\n";
+    return ErrorNumber;
+  }
+
+  off_t FileDataSize = 0;
+  ErrorNumber = SourceFile.GetSize (&FileDataSize);
+  if (ErrorNumber != B_OK)
+  {
+    DisplayErrorMessage (SourceName, ErrorNumber,
+      "ObfuscateFile: Unable to get size of file");
+    return ErrorNumber;
+  }
+
+  AutoIndentIncrementIf<Policy::VERBOSE> AutoIndentOneMore (mIndentLevel);
+
+  if (Policy::VERBOSE && mVerboseLevel >= VERBOSE_DATA)
+  {
+    printf ("%*sFile contents of length %d.\n", mIndentLevel, "",
+      (int) FileDataSize);
+  }
+
+  if (FileDataSize > 0)
+  {
+    if (FileDataSize > MAX_OBFUSCATE_BUFFER_SIZE)
+    {
+      if (Policy::VERBOSE && mVerboseLevel >= VERBOSE_FILE)
+      {
+        printf ("%*sTruncating file \"%s\" size from %lld down to %d.\n",
+          mIndentLevel, "", SourceName, (long long int) FileDataSize,
+          MAX_OBFUSCATE_BUFFER_SIZE);
+      }
+      FileDataSize = MAX_OBFUSCATE_BUFFER_SIZE;
+    }
+
+    // When dumping data, the source has to be read into a full size buffer
+    // anyway, so don't bother cloning.
+
+    if (!Policy::VERBOSE || mVerboseLevel < VERBOSE_DATA)
+    {
+      ErrorNumber = CloneFileData<Policy> (*DestFile, DestName, FileDataSize);
+      if (ErrorNumber != B_NOT_SUPPORTED)
+        return ErrorNumber;
+    }
+
+    char *pFileData = DestFile->AllocateDataBuffer (FileDataSize);
+    if (pFileData == NULL)
+    {
+      ErrorNumber = B_NO_MEMORY;
+      sprintf (ErrorMessage,
+        "Unable to allocate memory for file \"%s\" data size %lld",
+        SourceName, (long long int) FileDataSize);
+      DisplayErrorMessage (ErrorMessage, ErrorNumber, "ObfuscateFile");
+      return ErrorNumber;
+    }
+
+    if (Policy::VERBOSE && mVerboseLevel >= VERBOSE_DATA)
+    {
+      ssize_t AmountRead = SourceFile.ReadData (pFileData, FileDataSize);
+      if (AmountRead == FileDataSize)
+      {
+        DumpBuffer (pFileData, FileDataSize);
+      }
+      else
+      {
+        DisplayErrorMessage (SourceName, AmountRead,
+          "Unable to read file contents (nonfatal - don't need data)");
+      }
+    }
+
+    ObfuscateBuffer(pFileData, FileDataSize);
+
+    ssize_t AmountWritten = DestFile->WriteData (pFileData, FileDataSize);
+    // Get rid of buffer now, makes error handling easier.
+    DestFile->FreeDataBuffer (pFileData, FileDataSize);
+    if (AmountWritten != FileDataSize)
+    {
+      ErrorNumber = AmountWritten;
+      if (ErrorNumber >= 0)
+        ErrorNumber = B_IO_ERROR;
+      sprintf (ErrorMessage, "Only wrote %d bytes of %d for file \"%s\" data",
+        (int) AmountWritten, (int) FileDataSize, DestName);
+      DisplayErrorMessage (ErrorMessage, ErrorNumber, "ObfuscateFile");
+      return ErrorNumber;
+    }
+  }
+  return B_OK;
+}
+
+
+/******************************************************************************
+ * Pick a new obfuscated name for a source entry, one not already used in the
+ * destination directory.
+ */
+
+template <class Policy>
+void Obfuscator::MakeDestName (const char *pSourceName,
+  ObfuscateSinkDirectory &DestDir, char *pDestName)
+{
+  // Generate a new obfuscated name.  If it collides with existing obfuscated
+  // names, try a few other names.  Can happen with short names, indeed there
+  // are only 10 possible one letter names.  If there are too many
+  // collisions, try a longer name, though that breaks the obfuscation rules.
+
+  int GenerateNameRetryCount;
+  for (GenerateNameRetryCount = 0; GenerateNameRetryCount < 48;
+  GenerateNameRetryCount++)
+  {
+    int NewLength = strlen (pSourceName) + (GenerateNameRetryCount >> 3);
+    if (NewLength >= B_FILE_NAME_LENGTH)
+      NewLength = B_FILE_NAME_LENGTH - 1;
+
+    ObfuscateBuffer (pDestName, NewLength);
+    pDestName[NewLength] = 0;
+
+    if (!DestDir.Contains(pDestName))
+      break; // Doesn't contain the new name, safe to use it.
+
+    if (Policy::VERBOSE && mVerboseLevel > VERBOSE_NONE)
+    {
+      AutoIndentIncrementIf<Policy::VERBOSE> AutoIndentMore (mIndentLevel);
+
+      printf ("%*sName \"%s\" already exists in directory \"%s\", "
+        "will try another possibly longer name.\n", mIndentLevel, "",
+        pDestName, DestDir.GetPath ());
+    }
+  }
+}
+
+
+/******************************************************************************
+ * Given an already existing source and destination directory, copy/obfuscate
+ * all the files and directories within it.
+ */
+
+template <class Policy>
+status_t Obfuscator::ObfuscateDirectory (ObfuscateSourceDirectory &SourceDir,
+  ObfuscateSinkDirectory &DestDir)
+{
+  TRACE_SPAN_IF (Policy::TRACED, "ObfuscateDirectory", SourceDir.GetPath ());
+  status_t ErrorNumber = 0;
+
+  const char *DestPath = DestDir.GetPath ();
+  const char *SourcePath = SourceDir.GetPath ();
+
+  if (Policy::VERBOSE && mVerboseLevel >= VERBOSE_DIR)
+  {
+    printf ("%*sDirectory \"%s\" is being obfuscated into \"%s\".\n",
+      mIndentLevel, "", SourcePath, DestPath);
+  }
+
+  ErrorNumber = ObfuscateAttributes<Policy> (SourceDir, DestDir);
+  if (ErrorNumber != B_OK)
+  {
+    cerr << "Failed while obfuscating attributes of directory \"" <<
+      SourcePath << "\".\n";
+    return ErrorNumber;
+  }
+
+  SourceDir.Rewind();
+
+  char CurDestName[B_FILE_NAME_LENGTH];
+  char CurSourceName[B_FILE_NAME_LENGTH];
+  struct stat CurSourceStat;
+
+  while (B_OK == (ErrorNumber =
+  SourceDir.GetNextEntry(CurSourceName, &CurSourceStat)))
+  {
+    MakeDestName<Policy> (CurSourceName, DestDir, CurDestName);
+
+    if (S_ISREG(CurSourceStat.st_mode))
+    {
+      AutoDelete<ObfuscateSourceFile> SourceFile;
+      ErrorNumber = SourceDir.OpenFile (CurSourceName, SourceFile.Address ());
+      if (ErrorNumber != B_OK)
+      {
+        DisplayErrorMessage (CurSourceName, ErrorNumber,
+          "ObfuscateDirectory: Unable to open file for reading");
+      }
+      else
+      {
+        ErrorNumber = ObfuscateFile<Policy> (*SourceFile, CurSourceName,
+          DestDir, CurDestName);
+        if (ErrorNumber == B_OK && mpEntryListener != NULL)
+          mpEntryListener->EntryObfuscated (SourceDir, CurSourceName,
+            CurSourceStat, DestDir, CurDestName);
+      }
+    }
+    else if (S_ISDIR(CurSourceStat.st_mode))
+    {
+      AutoDelete<ObfuscateSinkDirectory> SubDestDir;
+      ErrorNumber = DestDir.CreateDirectory (CurDestName,
+        SubDestDir.Address ());
+      if (ErrorNumber != B_OK)
+      {
+        DisplayErrorMessage (CurDestName, ErrorNumber,
+          "ObfuscateDirectory: Failed to create destination directory");
+        // Fall through for directory level error message.
+      }
+      else
+      {
+        if (mpEntryListener != NULL)
+          mpEntryListener->EntryObfuscated (SourceDir, CurSourceName,
+            CurSourceStat, DestDir, CurDestName);
+
+        AutoIndentIncrementIf<Policy::VERBOSE> AutoIndenter (mIndentLevel);
+        AutoDelete<ObfuscateSourceDirectory> SubSourceDir;
+        ErrorNumber = SourceDir.OpenDirectory (CurSourceName,
+          SubSourceDir.Address ());
+        if (ErrorNumber != B_OK)
+          DisplayErrorMessage (CurSourceName, ErrorNumber,
+            "ObfuscateDirectory: Unable to open directory for reading");
+        else
+          ErrorNumber = ObfuscateDirectory<Policy> (*SubSourceDir,
+            *SubDestDir);
+      }
+    }
+    else if (S_ISLNK(CurSourceStat.st_mode))
+    {
+      if (Policy::VERBOSE && mVerboseLevel >= VERBOSE_FILE)
+        printf ("%*sSymbolic link \"%s\" will be ignored.\n",
+          mIndentLevel, "", CurSourceName);
+    }
+    else
+    {
+      if (Policy::VERBOSE && mVerboseLevel >= VERBOSE_FILE)
+        printf ("%*sHard link or other unknown file system entity "
+          "\"%s\" will be ignored.\n", mIndentLevel, "", CurSourceName);
+    }
+
+    if (ErrorNumber != B_OK)
+    {
+      cerr << "ObfuscateDirectory failed while converting item \"" <<
+        CurSourceName << "\" in directory \"" << SourcePath <<
+        "\" into item \"" << CurDestName << "\" in directory \"" <<
+        DestPath << "\".\n";
+      return ErrorNumber;
+    }
+  }
+
+  if (ErrorNumber == B_ENTRY_NOT_FOUND)
+    ErrorNumber = B_OK; // Reaching end of list isn't an error.
+  else
+  {
+    DisplayErrorMessage (SourcePath, ErrorNumber,
+      "ObfuscateDirectory: Problems reading directory entries");
+  }
+  return B_OK;
+}
+
+
+/******************************************************************************
+ * The non-template versions pick the policy to match the verbosity level and
+ * tracing, once per call.  Everything they call then uses the same policy.
+ */
+
+#define OBFUSCATOR_DISPATCH_POLICY(FunctionName, Arguments) \
+  if (mVerboseLevel > VERBOSE_NONE) \
+  { \
+    if (TraceIsEnabled ()) \
+      return FunctionName<VerboseTracedObfuscatePolicy> Arguments; \
+    return FunctionName<VerboseObfuscatePolicy> Arguments; \
+  } \
+  if (TraceIsEnabled ()) \
+    return FunctionName<TracedObfuscatePolicy> Arguments; \
+  return FunctionName<QuietObfuscatePolicy> Arguments;
+
+status_t Obfuscator::ObfuscateDirectory (ObfuscateSourceDirectory &SourceDir,
+  ObfuscateSinkDirectory &DestDir)
+{
+  OBFUSCATOR_DISPATCH_POLICY (ObfuscateDirectory, (SourceDir, DestDir));
+}
+
+
+void Obfuscator::MakeDestName (const char *pSourceName,
+  ObfuscateSinkDirectory &DestDir, char *pDestName)
+{
+  OBFUSCATOR_DISPATCH_POLICY (MakeDestName, (pSourceName, DestDir,
+    pDestName));
+}
+
+
+status_t Obfuscator::ObfuscateFile (ObfuscateSourceFile &SourceFile,
+  const char *SourceName, ObfuscateSinkDirectory &DestDir,
+  const char *DestName)
+{
+  OBFUSCATOR_DISPATCH_POLICY (ObfuscateFile, (SourceFile, SourceName,
+    DestDir, DestName));
+}
+
+
+status_t Obfuscator::ObfuscateAttributes (ObfuscateSourceNode &SourceNode,
+  ObfuscateSinkNode &DestNode)
+{
+  OBFUSCATOR_DISPATCH_POLICY (ObfuscateAttributes, (SourceNode, DestNode));
+}
+
+
+status_t Obfuscator::CloneFileData (ObfuscateSinkFile &DestFile,
+  const char *DestName, off_t FileDataSize)
+{
+  OBFUSCATOR_DISPATCH_POLICY (CloneFileData, (DestFile, DestName,
+    FileDataSize));
+}
+
+
+// Compile all the policies here, for programs which pick one themselves.
+
+#define OBFUSCATOR_INSTANTIATE_POLICY(PolicyName) \
+  template status_t Obfuscator::ObfuscateDirectory<PolicyName> ( \
+    ObfuscateSourceDirectory &SourceDir, ObfuscateSinkDirectory &DestDir); \
+  template void Obfuscator::MakeDestName<PolicyName> ( \
+    const char *pSourceName, ObfuscateSinkDirectory &DestDir, \
+    char *pDestName); \
+  template status_t Obfuscator::ObfuscateFile<PolicyName> ( \
+    ObfuscateSourceFile &SourceFile, const char *SourceName, \
+    ObfuscateSinkDirectory &DestDir, const char *DestName); \
+  template status_t Obfuscator::ObfuscateAttributes<PolicyName> ( \
+    ObfuscateSourceNode &SourceNode, ObfuscateSinkNode &DestNode); \
+  template status_t Obfuscator::CloneFileData<PolicyName> ( \
+    ObfuscateSinkFile &DestFile, const char *DestName, off_t FileDataSize);
+
+OBFUSCATOR_INSTANTIATE_POLICY (QuietObfuscatePolicy)
+OBFUSCATOR_INSTANTIATE_POLICY (TracedObfuscatePolicy)
+OBFUSCATOR_INSTANTIATE_POLICY (VerboseObfuscatePolicy)
+OBFUSCATOR_INSTANTIATE_POLICY (VerboseTracedObfuscatePolicy)
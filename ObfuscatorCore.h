@@ -0,0 +1,170 @@
+/******************************************************************************
+ * ObfuscatorCore.h
+ *
+ * The platform independent part of the obfuscator.  It recursively copies a
+ * source directory into a sink directory, with all identifiable information
+ * changed to a sequence of numbers.  File and directory names, attribute
+ * values and file contents become sequential numbers with leading zeroes, the
+ * same length as the original.  Attribute names are kept.
+ *
+ * The state of a run (sequence number, verbosity, indent level for messages)
+ * is kept in an Obfuscator object, so several can be used independently.
+ */
+
+#ifndef OBFUSCATOR_CORE_H
+#define OBFUSCATOR_CORE_H
+
+#include "ObfuscatorInterfaces.h"
+
+#define PROGRAM_NAME "ObfuscatorOfDirectoryTrees"
+
+static const int MAX_OBFUSCATE_BUFFER_SIZE = 500000000;
+static const int OBFUSCATE_NUMBER_LENGTH = 23; // Max 64 bit is about 20 digits.
+static const int CLONE_MIN_FILE_SIZE = 64 * 1024; // Smaller ones just written.
+
+enum eVerboseLevels
+{
+  VERBOSE_NONE = 0,
+  VERBOSE_DIR,
+  VERBOSE_FILE,
+  VERBOSE_ATTR,
+  VERBOSE_DATA,
+  VERBOSE_EXTREME_DATA,
+  VERBOSE_MAX
+};
+
+
+/******************************************************************************
+ * Display an error message on stderr.  The message part describes the error,
+ * and if ErrorNumber is non-zero, gets the string ", error code $X (standard
+ * description)." appended to it.  The title part is printed before the whole
+ * thing.
+ */
+
+void DisplayErrorMessage (
+  const char *MessageString = NULL,
+  int ErrorNumber = 0,
+  const char *TitleString = NULL);
+
+
+/******************************************************************************
+ * Compile time choice of what the obfuscation does besides obfuscating.  The
+ * directory, file and attribute code is compiled once for each policy, so the
+ * quiet one has no verbosity tests, progress messages or indenting at all, and
+ * the untraced ones have no trace spans.  The verbose ones still check the
+ * verbosity level for how much to print.
+ */
+
+template <bool Verbose, bool Traced>
+struct ObfuscatePolicy
+{
+  static const bool VERBOSE = Verbose;
+  static const bool TRACED = Traced;
+};
+
+typedef ObfuscatePolicy<false, false> QuietObfuscatePolicy;
+typedef ObfuscatePolicy<false, true> TracedObfuscatePolicy;
+typedef ObfuscatePolicy<true, false> VerboseObfuscatePolicy;
+typedef ObfuscatePolicy<true, true> VerboseTracedObfuscatePolicy;
+
+
+/******************************************************************************
+ * Told about each file and directory the obfuscator creates, so the caller can
+ * keep track of which obfuscated name goes with which source entry.
+ * Directories are reported after being created but before their contents are
+ * done, files after they have been written.
+ */
+
+class ObfuscateEntryListener
+{
+public:
+  virtual ~ObfuscateEntryListener () {};
+
+  virtual void EntryObfuscated (ObfuscateSourceDirectory &SourceDir,
+    const char *pSourceName, const struct stat &SourceStat,
+    ObfuscateSinkDirectory &DestDir, const char *pDestName) = 0;
+};
+
+
+class Obfuscator
+{
+public:
+  Obfuscator (eVerboseLevels VerboseLevel = VERBOSE_NONE);
+
+  // Given an already existing source and destination directory, copy and
+  // obfuscate all the files and directories within it, recursively.  Picks
+  // the policy once from the verbosity level and whether tracing is on, the
+  // recursion then stays in that version.  The policy can also be given
+  // explicitly, as ObfuscateDirectory<QuietObfuscatePolicy> (...), same for
+  // the other functions here which have a template version.
+  status_t ObfuscateDirectory (ObfuscateSourceDirectory &SourceDir,
+    ObfuscateSinkDirectory &DestDir);
+  template <class Policy>
+  status_t ObfuscateDirectory (ObfuscateSourceDirectory &SourceDir,
+    ObfuscateSinkDirectory &DestDir);
+
+  // Pick an obfuscated name the same length as the source name which isn't
+  // already in the destination directory, trying longer ones if there are
+  // too many collisions.  The buffer needs B_FILE_NAME_LENGTH bytes.
+  void MakeDestName (const char *pSourceName, ObfuscateSinkDirectory &DestDir,
+    char *pDestName);
+  template <class Policy>
+  void MakeDestName (const char *pSourceName, ObfuscateSinkDirectory &DestDir,
+    char *pDestName);
+
+  // Given an already open source file, create a destination one with
+  // obfuscated attributes and contents.
+  status_t ObfuscateFile (ObfuscateSourceFile &SourceFile,
+    const char *SourceName, ObfuscateSinkDirectory &DestDir,
+    const char *DestName);
+  template <class Policy>
+  status_t ObfuscateFile (ObfuscateSourceFile &SourceFile,
+    const char *SourceName, ObfuscateSinkDirectory &DestDir,
+    const char *DestName);
+
+  // Copy the attributes from a source (file or directory) to a similar type of
+  // destination, obfuscating their values.
+  status_t ObfuscateAttributes (ObfuscateSourceNode &SourceNode,
+    ObfuscateSinkNode &DestNode);
+  template <class Policy>
+  status_t ObfuscateAttributes (ObfuscateSourceNode &SourceNode,
+    ObfuscateSinkNode &DestNode);
+
+  // Write obfuscated file contents by cloning the leading '0' filler, if the
+  // sink can, and writing just the tail with the sequence number.  Returns
+  // B_NOT_SUPPORTED if the contents need to be written the usual way.
+  status_t CloneFileData (ObfuscateSinkFile &DestFile, const char *DestName,
+    off_t FileDataSize);
+  template <class Policy>
+  status_t CloneFileData (ObfuscateSinkFile &DestFile, const char *DestName,
+    off_t FileDataSize);
+
+  // Fill the buffer with the next sequence number in ASCII text form, with as
+  // many leading zeroes as needed.  Result is not NUL terminated.  Has no
+  // messages or spans, so it doesn't need a policy.
+  void ObfuscateBuffer (char *pBuffer, int BufferSize);
+
+  // Print a hex dump of the buffer, indented to the current level.
+  void DumpBuffer (const char *pBuffer, int BufferSize);
+
+  eVerboseLevels GetVerboseLevel () const { return mVerboseLevel; };
+  void SetVerboseLevel (eVerboseLevels VerboseLevel)
+    { mVerboseLevel = VerboseLevel; };
+
+  // The listener, if any, is told about everything ObfuscateDirectory makes.
+  // It isn't owned by the obfuscator.
+  void SetEntryListener (ObfuscateEntryListener *pListener)
+    { mpEntryListener = pListener; };
+
+  long long int GetSequenceNumber () const { return mSequenceNumber; };
+  void SetSequenceNumber (long long int SequenceNumber)
+    { mSequenceNumber = SequenceNumber; };
+
+protected:
+  int mIndentLevel;
+  long long int mSequenceNumber;
+  eVerboseLevels mVerboseLevel;
+  ObfuscateEntryListener *mpEntryListener;
+};
+
+#endif /* OBFUSCATOR_CORE_H */
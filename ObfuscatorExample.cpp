@@ -0,0 +1,388 @@
+/******************************************************************************
+ * ObfuscatorExample.cpp
+ *
+ * Example of embedding the obfuscator library, which also serves as a check
+ * that it works.  A small source tree is described in memory, with a source
+ * implementation written here on top of MemoryNode, and obfuscated into the
+ * in-memory sink.  Then the result is compared with the source: same shape,
+ * same attribute names and types, same sizes, but every name, attribute value
+ * and file contents replaced by a distinct number with leading zeroes.
+ *
+ * Prints what it found wrong and returns non-zero if the check fails, so it
+ * can be run as a test.
+ */
+
+/* Standard C Library. */
+
+#include <stdio.h>
+#include <string.h>
+
+/* Standard C++ library. */
+
+#include <map>
+#include <set>
+#include <string>
+
+/* This program's library headers. */
+
+#include "ObfuscatorCore.h"
+#include "ObfuscatorMemory.h"
+
+using namespace std;
+
+
+/******************************************************************************
+ * A source reading from a MemoryNode tree.  Children are listed in name order,
+ * and regular files are reported with their data size.
+ */
+
+template <class InterfaceClass>
+class ExampleSourceNode : public InterfaceClass
+{
+public:
+  ExampleSourceNode (const MemoryNode &Node, const string &Path)
+    : mNode (Node), mPath (Path), mAttrIndex (0) {};
+
+  virtual const char * GetPath ()
+  {
+    return mPath.c_str ();
+  };
+
+  virtual status_t RewindAttrs ()
+  {
+    mAttrIndex = 0;
+    return B_OK;
+  };
+
+  virtual status_t GetNextAttrName (char *pAttributeName)
+  {
+    if (mAttrIndex >= mNode.mAttributes.size ())
+      return B_ENTRY_NOT_FOUND;
+    strcpy (pAttributeName, mNode.mAttributes[mAttrIndex++].mName.c_str ());
+    return B_OK;
+  };
+
+  virtual status_t GetAttrInfo (const char *pAttributeName,
+    attr_info *pAttributeInfo)
+  {
+    const MemoryAttribute *pAttribute = FindAttribute (pAttributeName);
+    if (pAttribute == NULL)
+      return B_ENTRY_NOT_FOUND;
+    pAttributeInfo->type = pAttribute->mType;
+    pAttributeInfo->size = pAttribute->mSize;
+    return B_OK;
+  };
+
+  virtual ssize_t ReadAttr (const char *pAttributeName, uint32 /* Type */,
+    off_t Offset, void *pBuffer, size_t BufferSize)
+  {
+    const MemoryAttribute *pAttribute = FindAttribute (pAttributeName);
+    if (pAttribute == NULL)
+      return B_ENTRY_NOT_FOUND;
+    if (Offset < 0 || Offset > (off_t) pAttribute->mData.size ())
+      return B_BAD_VALUE;
+    size_t Amount = pAttribute->mData.size () - Offset;
+    if (Amount > BufferSize)
+      Amount = BufferSize;
+    memcpy (pBuffer, pAttribute->mData.data () + Offset, Amount);
+    return Amount;
+  };
+
+protected:
+  const MemoryAttribute * FindAttribute (const char *pAttributeName)
+  {
+    for (size_t i = 0; i < mNode.mAttributes.size (); i++)
+      if (mNode.mAttributes[i].mName == pAttributeName)
+        return &mNode.mAttributes[i];
+    return NULL;
+  };
+
+  const MemoryNode &mNode;
+  string mPath;
+  size_t mAttrIndex;
+};
+
+
+class ExampleSourceFile : public ExampleSourceNode<ObfuscateSourceFile>
+{
+public:
+  ExampleSourceFile (const MemoryNode &Node, const string &Path)
+    : ExampleSourceNode<ObfuscateSourceFile> (Node, Path) {};
+
+  virtual status_t GetSize (off_t *pSize)
+  {
+    *pSize = mNode.mData.size ();
+    return B_OK;
+  };
+
+  virtual ssize_t ReadData (char *pBuffer, off_t BufferSize)
+  {
+    if (BufferSize > (off_t) mNode.mData.size ())
+      BufferSize = mNode.mData.size ();
+    memcpy (pBuffer, mNode.mData.data (), BufferSize);
+    return BufferSize;
+  };
+};
+
+
+class ExampleSourceDirectory :
+  public ExampleSourceNode<ObfuscateSourceDirectory>
+{
+public:
+  ExampleSourceDirectory (const MemoryNode &Node, const string &Path)
+    : ExampleSourceNode<ObfuscateSourceDirectory> (Node, Path)
+  {
+    Rewind ();
+  };
+
+  virtual status_t Rewind ()
+  {
+    mChildIter = mNode.mChildren.begin ();
+    return B_OK;
+  };
+
+  virtual status_t GetNextEntry (char *pName, struct stat *pStat)
+  {
+    if (mChildIter == mNode.mChildren.end ())
+      return B_ENTRY_NOT_FOUND;
+    strcpy (pName, mChildIter->first.c_str ());
+    memset (pStat, 0, sizeof (*pStat));
+    pStat->st_mode = mChildIter->second->mIsDirectory ?
+      (S_IFDIR | 0755) : (S_IFREG | 0644);
+    pStat->st_size = mChildIter->second->mData.size ();
+    mChildIter++;
+    return B_OK;
+  };
+
+  virtual status_t OpenFile (const char *pName, ObfuscateSourceFile **ppFile)
+  {
+    const MemoryNode *pChild = FindChild (pName, false);
+    if (pChild == NULL)
+      return B_ENTRY_NOT_FOUND;
+    *ppFile = new (std::nothrow) ExampleSourceFile (*pChild,
+      mPath + "/" + pName);
+    return (*ppFile == NULL) ? B_NO_MEMORY : B_OK;
+  };
+
+  virtual status_t OpenDirectory (const char *pName,
+    ObfuscateSourceDirectory **ppDirectory)
+  {
+    const MemoryNode *pChild = FindChild (pName, true);
+    if (pChild == NULL)
+      return B_ENTRY_NOT_FOUND;
+    *ppDirectory = new (std::nothrow) ExampleSourceDirectory (*pChild,
+      mPath + "/" + pName);
+    return (*ppDirectory == NULL) ? B_NO_MEMORY : B_OK;
+  };
+
+private:
+  const MemoryNode * FindChild (const char *pName, bool IsDirectory)
+  {
+    map<string, MemoryNode *>::const_iterator ChildIter =
+      mNode.mChildren.find (pName);
+    if (ChildIter == mNode.mChildren.end () ||
+    ChildIter->second->mIsDirectory != IsDirectory)
+      return NULL;
+    return ChildIter->second;
+  };
+
+  map<string, MemoryNode *>::const_iterator mChildIter;
+};
+
+
+/******************************************************************************
+ * Building the source tree.  Names within a directory all have different
+ * lengths, so the checking can pair each source entry with its obfuscated
+ * version by length.
+ */
+
+static MemoryNode * AddNode (MemoryNode &Parent, const char *pName,
+  bool IsDirectory, const char *pContents = "")
+{
+  MemoryNode *pNode = new MemoryNode (IsDirectory);
+  pNode->mData = pContents;
+  pNode->mDataSize = pNode->mData.size ();
+  Parent.mChildren[pName] = pNode;
+  return pNode;
+}
+
+
+static void AddAttribute (MemoryNode &Node, const char *pName, uint32 Type,
+  const char *pValue)
+{
+  MemoryAttribute Attribute;
+  Attribute.mName = pName;
+  Attribute.mType = Type;
+  Attribute.mData = pValue;
+  if (Type == B_STRING_TYPE || Type == B_MIME_STRING_TYPE)
+    Attribute.mData += '\0'; // Stored with the NUL, as BeOS does.
+  Attribute.mSize = Attribute.mData.size ();
+  Node.mAttributes.push_back (Attribute);
+}
+
+
+static void MakeSourceTree (MemoryNode &Root)
+{
+  AddAttribute (Root, "BEOS:TYPE", B_MIME_STRING_TYPE,
+    "application/x-vnd.Be-directory");
+
+  MemoryNode *pMail = AddNode (Root, "mail", true);
+  AddAttribute (*pMail, "Comment", B_STRING_TYPE, "Private");
+  MemoryNode *pMessage = AddNode (*pMail, "Re: Lunch on Friday?", false,
+    "From: someone@example.com\nSubject: Re: Lunch on Friday?\n\nSure!\n");
+  AddAttribute (*pMessage, "MAIL:subject", B_STRING_TYPE,
+    "Re: Lunch on Friday?");
+  AddAttribute (*pMessage, "MAIL:from", B_STRING_TYPE, "someone@example.com");
+  AddNode (*pMail, "Empty", false);
+
+  MemoryNode *pNotes = AddNode (Root, "notes.txt", false,
+    "Bank account 12345678, combination 36-24-36.\n");
+  AddAttribute (*pNotes, "BEOS:TYPE", B_MIME_STRING_TYPE, "text/plain");
+
+  AddNode (*AddNode (Root, "Archive folder", true), "a", false, "x");
+}
+
+
+/******************************************************************************
+ * Checking the result.
+ */
+
+static int gFailureCount = 0;
+
+static void Fail (const string &Path, const char *pProblem)
+{
+  printf ("%s: %s.\n", Path.c_str (), pProblem);
+  gFailureCount++;
+}
+
+
+// Obfuscated text has to be all digits, the same length as the original, and
+// not seen before since each one gets its own sequence number.
+static void CheckObfuscated (const string &Path, const string &Original,
+  const string &Obfuscated, set<string> &SeenValues)
+{
+  if (Obfuscated.size () != Original.size ())
+    Fail (Path, "obfuscated length differs from the original");
+  if (Obfuscated.find_first_not_of ("0123456789") != string::npos)
+    Fail (Path, "obfuscated text isn't all digits");
+  if (!Obfuscated.empty () && !SeenValues.insert (Obfuscated).second)
+    Fail (Path, "obfuscated text is the same as an earlier one");
+}
+
+
+static void CheckNode (const string &Path, const MemoryNode &Source,
+  const MemoryNode &Dest, set<string> &SeenValues)
+{
+  if (Source.mIsDirectory != Dest.mIsDirectory)
+  {
+    Fail (Path, "file versus directory mismatch");
+    return;
+  }
+
+  if (Source.mAttributes.size () != Dest.mAttributes.size ())
+    Fail (Path, "different number of attributes");
+  for (size_t i = 0; i < Source.mAttributes.size () &&
+  i < Dest.mAttributes.size (); i++)
+  {
+    const MemoryAttribute &SourceAttr = Source.mAttributes[i];
+    const MemoryAttribute &DestAttr = Dest.mAttributes[i];
+    string AttrPath = Path + " attribute " + SourceAttr.mName;
+    if (DestAttr.mName != SourceAttr.mName)
+      Fail (AttrPath, "attribute name changed");
+    if (DestAttr.mType != SourceAttr.mType)
+      Fail (AttrPath, "attribute type changed");
+    if (DestAttr.mSize != SourceAttr.mSize)
+      Fail (AttrPath, "attribute size changed");
+    string SourceValue = SourceAttr.mData;
+    string DestValue = DestAttr.mData;
+    if (SourceAttr.mType == B_STRING_TYPE ||
+    SourceAttr.mType == B_MIME_STRING_TYPE)
+    {
+      // Strings keep their NUL at the end.
+      if (DestValue.empty () || DestValue[DestValue.size () - 1] != 0)
+        Fail (AttrPath, "obfuscated string lost its NUL");
+      else
+        DestValue.erase (DestValue.size () - 1);
+      SourceValue.erase (SourceValue.size () - 1);
+    }
+    CheckObfuscated (AttrPath, SourceValue, DestValue, SeenValues);
+  }
+
+  if (!Source.mIsDirectory)
+  {
+    if (Dest.mDataSize != (off_t) Source.mData.size ())
+      Fail (Path, "file size changed");
+    CheckObfuscated (Path + " contents", Source.mData, Dest.mData,
+      SeenValues);
+    return;
+  }
+
+  if (Source.mChildren.size () != Dest.mChildren.size ())
+    Fail (Path, "different number of directory entries");
+  map<string, MemoryNode *>::const_iterator SourceIter;
+  for (SourceIter = Source.mChildren.begin ();
+  SourceIter != Source.mChildren.end (); SourceIter++)
+  {
+    string ChildPath = Path + "/" + SourceIter->first;
+    map<string, MemoryNode *>::const_iterator DestIter;
+    for (DestIter = Dest.mChildren.begin ();
+    DestIter != Dest.mChildren.end (); DestIter++)
+    {
+      if (DestIter->first.size () == SourceIter->first.size ())
+        break;
+    }
+    if (DestIter == Dest.mChildren.end ())
+    {
+      Fail (ChildPath, "no obfuscated entry with a name that long");
+      continue;
+    }
+    CheckObfuscated (ChildPath + " name", SourceIter->first, DestIter->first,
+      SeenValues);
+    CheckNode (ChildPath, *SourceIter->second, *DestIter->second, SeenValues);
+  }
+}
+
+
+int main (int /* argc */, char** /* argv */)
+{
+  MemoryNode SourceRoot (true /* IsDirectory */);
+  MakeSourceTree (SourceRoot);
+
+  MemoryTree Dest (true /* KeepData */);
+  AutoDelete<ObfuscateSinkDirectory> DestDir;
+  status_t ErrorNumber = Dest.OpenSinkDirectory (DestDir.Address ());
+  if (ErrorNumber != B_OK)
+  {
+    DisplayErrorMessage ("Opening the in-memory sink", ErrorNumber, "Main");
+    return 1;
+  }
+
+  ExampleSourceDirectory SourceDir (SourceRoot, "(example)");
+  Obfuscator TheObfuscator;
+  ErrorNumber = TheObfuscator.ObfuscateDirectory (SourceDir, *DestDir);
+  if (ErrorNumber == B_OK)
+    ErrorNumber = DestDir->Finish ();
+  if (ErrorNumber != B_OK)
+  {
+    DisplayErrorMessage ("Obfuscating the example tree", ErrorNumber, "Main");
+    return 1;
+  }
+
+  set<string> SeenValues;
+  CheckNode ("(example)", SourceRoot, Dest.Root (), SeenValues);
+
+  const MemoryTreeStatistics &Stats = Dest.Statistics ();
+  if (Stats.mDirectoryCount != 2 || Stats.mFileCount != 4 ||
+  Stats.mAttributeCount != 5)
+    Fail ("(memory)", "wrong statistics");
+
+  if (gFailureCount != 0)
+  {
+    printf ("%d problems found with the obfuscated tree.\n", gFailureCount);
+    return 1;
+  }
+  printf ("Obfuscated %lld directories, %lld files and %lld attributes, all "
+    "as expected.\n", Stats.mDirectoryCount, Stats.mFileCount,
+    Stats.mAttributeCount);
+  return 0;
+}
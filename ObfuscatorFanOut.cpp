@@ -0,0 +1,810 @@
+/******************************************************************************
+ * ObfuscatorFanOut.cpp
+ *
+ * The fan-out sink and its per-destination writer threads, see
+ * ObfuscatorFanOut.h.
+ */
+
+/* Standard C Library. */
+
+#include <stdio.h>
+#include <string.h>
+
+/* Standard C++ library. */
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+/* This library's headers. */
+
+#include "ObfuscatorCore.h"
+#include "ObfuscatorFanOut.h"
+#include "ObfuscatorTrace.h"
+
+using namespace std;
+
+
+/******************************************************************************
+ * File contents and attribute values, shared by the queues of all the
+ * destinations and freed when the last one is done with it.
+ */
+
+struct FanOutBuffer
+{
+  FanOutBuffer (const IOPolicyRecord &Policy, off_t Size)
+    : mReferences (1),
+      mPolicy (Policy),
+      mSize (Size)
+  {
+    mpData = AllocateAlignedDataBuffer (Policy, Size);
+  };
+
+  ~FanOutBuffer ()
+  {
+    if (mpData != NULL)
+      FreeAlignedDataBuffer (mPolicy, mpData, mSize);
+  };
+
+  void AddReferences (int Count)
+  {
+    mReferences.fetch_add (Count);
+  };
+
+  void Release ()
+  {
+    if (mReferences.fetch_sub (1) == 1)
+      delete this;
+  };
+
+  atomic<int> mReferences;
+  const IOPolicyRecord &mPolicy;
+  char *mpData;
+  off_t mSize;
+};
+
+
+enum eFanOutCommands
+{
+  FANOUT_CREATE_FILE = 0,
+  FANOUT_CREATE_DIRECTORY,
+  FANOUT_WRITE_ATTR,
+  FANOUT_WRITE_DATA,
+  FANOUT_CLONE_ZERO_FILL,
+  FANOUT_WRITE_DATA_AT,
+  FANOUT_CLOSE,
+  FANOUT_FINISH,
+  FANOUT_STOP,
+  FANOUT_MAX
+};
+
+static const char *gFanOutCommandNames[FANOUT_MAX] = {"CreateFile",
+  "CreateDirectory", "WriteAttr", "WriteData", "CloneZeroFill", "WriteDataAt",
+  "Close", "Finish", "Stop"};
+
+
+struct FanOutCommand
+{
+  FanOutCommand (eFanOutCommands Command, uint32 NodeId)
+    : mCommand (Command),
+      mNodeId (NodeId),
+      mNewNodeId (0),
+      mType (0),
+      mOffset (0),
+      mSize (0),
+      mpBuffer (NULL)
+  {
+  };
+
+  eFanOutCommands mCommand;
+  uint32 mNodeId; // Node operated on, or parent directory for creates.
+  uint32 mNewNodeId; // For creates.
+  string mName; // Entry or attribute name.
+  uint32 mType;
+  off_t mOffset;
+  off_t mSize;
+  FanOutBuffer *mpBuffer; // Each queued copy holds a reference.
+};
+
+
+/******************************************************************************
+ * A destination with its writer thread.  The thread owns the sink objects for
+ * all the nodes created in the destination, kept in a table indexed by node
+ * id, NULL if closed or if they couldn't be created.  After the first error,
+ * only Close, Finish and Stop commands get queued, the rest are dropped, while
+ * the other destinations carry on.
+ */
+
+class FanOutDestination
+{
+public:
+  FanOutDestination (const IOPolicyRecord &Policy,
+    ObfuscateSinkDirectory *pRootDir);
+  ~FanOutDestination ();
+
+  void Start ();
+  void Stop ();
+
+  // Returns the command's sequence number, for WaitFor, or zero if it was
+  // dropped because the destination has failed.
+  long long int Post (const FanOutCommand &Command);
+  void WaitFor (long long int SequenceNumber);
+
+  // Reads the names in the top level directory, before Start.
+  status_t GetRootEntryNames (set<string> &Names)
+    { return mpRootDir->GetEntryNames (Names); };
+
+  // Valid after WaitFor on a Finish command.
+  status_t GetLastResult () { return mLastResult; };
+
+  // Can be called from any thread at any time.
+  status_t GetFirstError () { return mFirstError.load (); };
+  const char * GetPath () { return mpRootDir->GetPath (); };
+
+private:
+  struct NodeRecord
+  {
+    ObfuscateSinkNode *mpNode;
+    bool mIsDirectory;
+    off_t mPendingZeroFill; // Clone which this destination couldn't do.
+  };
+
+  void Run ();
+  status_t Execute (FanOutCommand &Command);
+  NodeRecord * GetNode (uint32 NodeId, bool WantDirectory);
+  status_t WriteData (NodeRecord &Record, off_t Offset, const char *pData,
+    off_t DataSize);
+  void ReportError (FanOutCommand &Command, status_t ErrorNumber);
+
+  const IOPolicyRecord &mPolicy;
+  ObfuscateSinkDirectory *mpRootDir;
+  thread mThread;
+  bool mRunning;
+
+  mutex mLock; // Protects the queue and counters below.
+  condition_variable mQueueChanged;
+  deque<FanOutCommand> mQueue;
+  off_t mQueuedBytes;
+  long long int mPostedCount;
+  long long int mCompletedCount;
+
+  // Only used by the writer thread, except for results read after WaitFor.
+  vector<NodeRecord> mNodes;
+  status_t mLastResult;
+
+  atomic<status_t> mFirstError; // Set by the writer thread.
+};
+
+
+FanOutDestination::FanOutDestination (const IOPolicyRecord &Policy,
+  ObfuscateSinkDirectory *pRootDir)
+  : mPolicy (Policy),
+    mpRootDir (pRootDir),
+    mRunning (false),
+    mQueuedBytes (0),
+    mPostedCount (0),
+    mCompletedCount (0),
+    mLastResult (B_OK),
+    mFirstError (B_OK)
+{
+  NodeRecord RootRecord = {pRootDir, true, 0};
+  mNodes.push_back (RootRecord);
+}
+
+
+FanOutDestination::~FanOutDestination ()
+{
+  Stop ();
+  for (size_t iNode = 1; iNode < mNodes.size (); iNode++)
+    delete mNodes[iNode].mpNode;
+  delete mpRootDir;
+}
+
+
+void FanOutDestination::Start ()
+{
+  mThread = thread (&FanOutDestination::Run, this);
+  mRunning = true;
+}
+
+
+void FanOutDestination::Stop ()
+{
+  if (!mRunning)
+    return;
+  Post (FanOutCommand (FANOUT_STOP, 0));
+  mThread.join ();
+  mRunning = false;
+}
+
+
+long long int FanOutDestination::Post (const FanOutCommand &Command)
+{
+  if (Command.mCommand != FANOUT_CLOSE && Command.mCommand != FANOUT_FINISH &&
+  Command.mCommand != FANOUT_STOP && GetFirstError () != B_OK)
+  {
+    if (Command.mpBuffer != NULL)
+      Command.mpBuffer->Release ();
+    return 0;
+  }
+
+  unique_lock<mutex> Lock (mLock);
+  while (mQueuedBytes >= FANOUT_QUEUE_BYTES ||
+  mQueue.size () >= (size_t) FANOUT_QUEUE_OPERATIONS)
+    mQueueChanged.wait (Lock);
+
+  mQueue.push_back (Command);
+  if (Command.mpBuffer != NULL)
+    mQueuedBytes += Command.mpBuffer->mSize;
+  mPostedCount++;
+  mQueueChanged.notify_all ();
+  return mPostedCount;
+}
+
+
+void FanOutDestination::WaitFor (long long int SequenceNumber)
+{
+  unique_lock<mutex> Lock (mLock);
+  while (mCompletedCount < SequenceNumber)
+    mQueueChanged.wait (Lock);
+}
+
+
+void FanOutDestination::Run ()
+{
+  while (true)
+  {
+    FanOutCommand *pCommand;
+    {
+      unique_lock<mutex> Lock (mLock);
+      while (mQueue.empty ())
+        mQueueChanged.wait (Lock);
+      pCommand = &mQueue.front (); // Stays put until popped.
+    }
+
+    if (pCommand->mCommand == FANOUT_STOP)
+      break;
+
+    status_t ErrorNumber = Execute (*pCommand);
+    if (ErrorNumber < 0)
+      ReportError (*pCommand, ErrorNumber);
+    if (pCommand->mpBuffer != NULL)
+      pCommand->mpBuffer->Release ();
+
+    unique_lock<mutex> Lock (mLock);
+    if (pCommand->mpBuffer != NULL)
+      mQueuedBytes -= pCommand->mpBuffer->mSize;
+    mQueue.pop_front ();
+    mCompletedCount++;
+    mQueueChanged.notify_all ();
+  }
+}
+
+
+FanOutDestination::NodeRecord * FanOutDestination::GetNode (uint32 NodeId,
+  bool WantDirectory)
+{
+  if (NodeId >= mNodes.size () || mNodes[NodeId].mpNode == NULL ||
+  mNodes[NodeId].mIsDirectory != WantDirectory)
+    return NULL;
+  return &mNodes[NodeId];
+}
+
+
+status_t FanOutDestination::WriteData (NodeRecord &Record, off_t Offset,
+  const char *pData, off_t DataSize)
+{
+  ObfuscateSinkFile *pFile = static_cast<ObfuscateSinkFile *> (Record.mpNode);
+  ssize_t AmountWritten;
+
+  // If the filler wasn't cloned, write it along with the tail.
+
+  if (Offset != 0 && Record.mPendingZeroFill == Offset)
+  {
+    off_t FullSize = Offset + DataSize;
+    char *pFullData = pFile->AllocateDataBuffer (FullSize);
+    if (pFullData == NULL)
+      return B_NO_MEMORY;
+    memset (pFullData, '0', Offset);
+    memcpy (pFullData + Offset, pData, DataSize);
+    AmountWritten = pFile->WriteData (pFullData, FullSize);
+    pFile->FreeDataBuffer (pFullData, FullSize);
+    Record.mPendingZeroFill = 0;
+    if (AmountWritten == FullSize)
+      return B_OK;
+  }
+  else
+  {
+    if (Offset == 0)
+      AmountWritten = pFile->WriteData (pData, DataSize);
+    else
+      AmountWritten = pFile->WriteDataAt (Offset, pData, DataSize);
+    if (AmountWritten == DataSize)
+      return B_OK;
+  }
+  return AmountWritten < 0 ? AmountWritten : B_IO_ERROR;
+}
+
+
+status_t FanOutDestination::Execute (FanOutCommand &Command)
+{
+  TRACE_SPAN (gFanOutCommandNames[Command.mCommand], Command.mName.c_str ());
+  NodeRecord *pRecord;
+  status_t ErrorNumber;
+
+  switch (Command.mCommand)
+  {
+    case FANOUT_CREATE_FILE:
+    case FANOUT_CREATE_DIRECTORY:
+    {
+      if (Command.mNewNodeId >= mNodes.size ())
+      {
+        NodeRecord EmptyRecord = {NULL, false, 0};
+        mNodes.resize (Command.mNewNodeId + 1, EmptyRecord);
+      }
+      pRecord = GetNode (Command.mNodeId, true);
+      if (pRecord == NULL)
+        return B_OK; // Parent failed earlier, already reported.
+      ObfuscateSinkDirectory *pParent =
+        static_cast<ObfuscateSinkDirectory *> (pRecord->mpNode);
+      NodeRecord &NewRecord = mNodes[Command.mNewNodeId];
+      if (Command.mCommand == FANOUT_CREATE_FILE)
+      {
+        ObfuscateSinkFile *pNewFile = NULL;
+        ErrorNumber = pParent->CreateFile (Command.mName.c_str (), &pNewFile);
+        NewRecord.mpNode = pNewFile;
+      }
+      else
+      {
+        ObfuscateSinkDirectory *pNewDir = NULL;
+        ErrorNumber = pParent->CreateDirectory (Command.mName.c_str (),
+          &pNewDir);
+        NewRecord.mpNode = pNewDir;
+        NewRecord.mIsDirectory = true;
+      }
+      if (ErrorNumber != B_OK)
+        NewRecord.mpNode = NULL;
+      return ErrorNumber;
+    }
+
+    case FANOUT_WRITE_ATTR:
+    {
+      if (Command.mNodeId >= mNodes.size () ||
+      mNodes[Command.mNodeId].mpNode == NULL)
+        return B_OK;
+      ssize_t AmountWritten = mNodes[Command.mNodeId].mpNode->WriteAttr (
+        Command.mName.c_str (), Command.mType, 0 /* offset */,
+        Command.mpBuffer->mpData, Command.mSize);
+      if (AmountWritten == Command.mSize)
+        return B_OK;
+      return AmountWritten < 0 ? AmountWritten : B_IO_ERROR;
+    }
+
+    case FANOUT_WRITE_DATA:
+    case FANOUT_WRITE_DATA_AT:
+      pRecord = GetNode (Command.mNodeId, false);
+      if (pRecord == NULL)
+        return B_OK;
+      return WriteData (*pRecord, Command.mOffset, Command.mpBuffer->mpData,
+        Command.mSize);
+
+    case FANOUT_CLONE_ZERO_FILL:
+    {
+      pRecord = GetNode (Command.mNodeId, false);
+      if (pRecord == NULL)
+        return B_OK;
+      ObfuscateSinkFile *pFile =
+        static_cast<ObfuscateSinkFile *> (pRecord->mpNode);
+      off_t BlockSize = pFile->GetCloneBlockSize ();
+      ErrorNumber = B_NOT_SUPPORTED;
+      if (BlockSize > 0 && Command.mSize % BlockSize == 0)
+        ErrorNumber = pFile->CloneZeroFill (Command.mSize);
+      if (ErrorNumber == B_NOT_SUPPORTED)
+      {
+        pRecord->mPendingZeroFill = Command.mSize;
+        ErrorNumber = B_OK;
+      }
+      return ErrorNumber;
+    }
+
+    case FANOUT_CLOSE:
+      if (Command.mNodeId != 0 && Command.mNodeId < mNodes.size ())
+      {
+        delete mNodes[Command.mNodeId].mpNode;
+        mNodes[Command.mNodeId].mpNode = NULL;
+      }
+      return B_OK;
+
+    case FANOUT_FINISH:
+      mLastResult = mpRootDir->Finish ();
+      return mLastResult;
+
+    default:
+      return B_BAD_VALUE;
+  }
+}
+
+
+void FanOutDestination::ReportError (FanOutCommand &Command,
+  status_t ErrorNumber)
+{
+  char ErrorMessage[B_FILE_NAME_LENGTH+100];
+  status_t NoError = B_OK;
+  mFirstError.compare_exchange_strong (NoError, ErrorNumber);
+  snprintf (ErrorMessage, sizeof (ErrorMessage), "%s \"%s\" failed",
+    gFanOutCommandNames[Command.mCommand], Command.mName.c_str ());
+  DisplayErrorMessage (ErrorMessage, ErrorNumber, mpRootDir->GetPath ());
+}
+
+
+/******************************************************************************
+ * The sink objects the obfuscator sees, which turn each operation into a
+ * command for all the destinations.
+ */
+
+template <class InterfaceClass>
+class FanOutSinkNode : public InterfaceClass
+{
+public:
+  FanOutSinkNode (FanOutWriter &Writer, uint32 NodeId, const string &Path)
+    : mWriter (Writer),
+      mNodeId (NodeId),
+      mPath (Path)
+  {
+  };
+
+  virtual ~FanOutSinkNode ()
+  {
+    if (mNodeId != 0)
+      mWriter.Post (FanOutCommand (FANOUT_CLOSE, mNodeId));
+  };
+
+  virtual const char * GetPath ()
+  {
+    return mPath.c_str ();
+  };
+
+  virtual ssize_t WriteAttr (const char *pAttributeName, uint32 Type,
+    off_t Offset, const void *pBuffer, size_t BufferSize)
+  {
+    if (Offset != 0)
+      return B_BAD_VALUE; // Only whole attributes are written.
+    FanOutCommand Command (FANOUT_WRITE_ATTR, mNodeId);
+    Command.mName = pAttributeName;
+    Command.mType = Type;
+    Command.mSize = BufferSize;
+    status_t ErrorNumber = PostCopy (Command, (const char *) pBuffer);
+    if (ErrorNumber != B_OK)
+      return ErrorNumber;
+    return BufferSize;
+  };
+
+protected:
+  // Posts a command with a copy of the data.
+  status_t PostCopy (FanOutCommand &Command, const char *pData)
+  {
+    FanOutBuffer *pBuffer = new (std::nothrow) FanOutBuffer (
+      mWriter.Policy (), Command.mSize);
+    if (pBuffer == NULL || pBuffer->mpData == NULL)
+    {
+      delete pBuffer;
+      return B_NO_MEMORY;
+    }
+    memcpy (pBuffer->mpData, pData, Command.mSize);
+    Command.mpBuffer = pBuffer;
+    status_t ErrorNumber = mWriter.Post (Command);
+    pBuffer->Release ();
+    return ErrorNumber;
+  };
+
+  FanOutWriter &mWriter;
+  uint32 mNodeId;
+  string mPath;
+};
+
+
+class FanOutSinkFile : public FanOutSinkNode<ObfuscateSinkFile>
+{
+public:
+  FanOutSinkFile (FanOutWriter &Writer, uint32 NodeId, const string &Path)
+    : FanOutSinkNode<ObfuscateSinkFile> (Writer, NodeId, Path),
+      mpDataBuffer (NULL)
+  {
+  };
+
+  virtual ~FanOutSinkFile ()
+  {
+    if (mpDataBuffer != NULL)
+      mpDataBuffer->Release ();
+  };
+
+  // The obfuscator fills the buffer in place, then it gets shared by all
+  // the destination queues without copying.
+
+  virtual char * AllocateDataBuffer (off_t DataSize)
+  {
+    if (mpDataBuffer != NULL)
+      mpDataBuffer->Release ();
+    mpDataBuffer = new (std::nothrow) FanOutBuffer (mWriter.Policy (),
+      DataSize);
+    if (mpDataBuffer == NULL)
+      return NULL;
+    if (mpDataBuffer->mpData == NULL)
+    {
+      delete mpDataBuffer;
+      mpDataBuffer = NULL;
+      return NULL;
+    }
+    return mpDataBuffer->mpData;
+  };
+
+  virtual void FreeDataBuffer (char *pBuffer, off_t /* DataSize */)
+  {
+    if (mpDataBuffer != NULL && pBuffer == mpDataBuffer->mpData)
+    {
+      mpDataBuffer->Release ();
+      mpDataBuffer = NULL;
+    }
+    else
+      delete [] pBuffer;
+  };
+
+  virtual ssize_t WriteData (const char *pBuffer, off_t DataSize)
+  {
+    FanOutCommand Command (FANOUT_WRITE_DATA, mNodeId);
+    Command.mSize = DataSize;
+    if (mpDataBuffer != NULL && pBuffer == mpDataBuffer->mpData &&
+    DataSize == mpDataBuffer->mSize)
+    {
+      Command.mpBuffer = mpDataBuffer;
+      status_t ErrorNumber = mWriter.Post (Command);
+      if (ErrorNumber != B_OK)
+        return ErrorNumber;
+    }
+    else
+    {
+      status_t ErrorNumber = PostCopy (Command, pBuffer);
+      if (ErrorNumber != B_OK)
+        return ErrorNumber;
+    }
+    return DataSize;
+  };
+
+  virtual off_t GetCloneBlockSize ()
+  {
+    return mWriter.GetCloneBlockSize ();
+  };
+
+  virtual status_t CloneZeroFill (off_t Length)
+  {
+    FanOutCommand Command (FANOUT_CLONE_ZERO_FILL, mNodeId);
+    Command.mSize = Length;
+    return mWriter.Post (Command);
+  };
+
+  virtual ssize_t WriteDataAt (off_t Offset, const char *pBuffer,
+    off_t DataSize)
+  {
+    FanOutCommand Command (FANOUT_WRITE_DATA_AT, mNodeId);
+    Command.mOffset = Offset;
+    Command.mSize = DataSize;
+    status_t ErrorNumber = PostCopy (Command, pBuffer);
+    if (ErrorNumber != B_OK)
+      return ErrorNumber;
+    return DataSize;
+  };
+
+private:
+  FanOutBuffer *mpDataBuffer; // From AllocateDataBuffer, not yet freed.
+};
+
+
+// Directories created by the fan-out start out empty in all destinations, so
+// they know what's in them without asking.  The top level one starts with the
+// names already in any of the destinations, read once before writing starts.
+
+class FanOutSinkDirectory : public FanOutSinkNode<ObfuscateSinkDirectory>
+{
+public:
+  FanOutSinkDirectory (FanOutWriter &Writer, uint32 NodeId,
+    const string &Path)
+    : FanOutSinkNode<ObfuscateSinkDirectory> (Writer, NodeId, Path)
+  {
+  };
+
+  set<string> & Names () { return mNames; };
+
+  virtual bool Contains (const char *pName)
+  {
+    return mNames.find (pName) != mNames.end ();
+  };
+
+  virtual status_t CreateFile (const char *pName, ObfuscateSinkFile **ppFile)
+  {
+    *ppFile = NULL;
+    status_t ErrorNumber = mWriter.GetAllFailedError ();
+    if (ErrorNumber != B_OK)
+      return ErrorNumber;
+    FanOutCommand Command (FANOUT_CREATE_FILE, mNodeId);
+    Command.mNewNodeId = mWriter.NewNodeId ();
+    Command.mName = pName;
+    ErrorNumber = mWriter.Post (Command);
+    if (ErrorNumber != B_OK)
+      return ErrorNumber;
+    mNames.insert (pName);
+    *ppFile = new (std::nothrow) FanOutSinkFile (mWriter, Command.mNewNodeId,
+      mPath + "/" + pName);
+    if (*ppFile == NULL)
+    {
+      mWriter.Post (FanOutCommand (FANOUT_CLOSE, Command.mNewNodeId));
+      return B_NO_MEMORY;
+    }
+    return B_OK;
+  };
+
+  virtual status_t CreateDirectory (const char *pName,
+    ObfuscateSinkDirectory **ppDirectory)
+  {
+    *ppDirectory = NULL;
+    status_t ErrorNumber = mWriter.GetAllFailedError ();
+    if (ErrorNumber != B_OK)
+      return ErrorNumber;
+    FanOutCommand Command (FANOUT_CREATE_DIRECTORY, mNodeId);
+    Command.mNewNodeId = mWriter.NewNodeId ();
+    Command.mName = pName;
+    ErrorNumber = mWriter.Post (Command);
+    if (ErrorNumber != B_OK)
+      return ErrorNumber;
+    mNames.insert (pName);
+    *ppDirectory = new (std::nothrow) FanOutSinkDirectory (mWriter,
+      Command.mNewNodeId, mPath + "/" + pName);
+    if (*ppDirectory == NULL)
+    {
+      mWriter.Post (FanOutCommand (FANOUT_CLOSE, Command.mNewNodeId));
+      return B_NO_MEMORY;
+    }
+    return B_OK;
+  };
+
+  // Waits for all the destinations to finish writing.
+
+  virtual status_t Finish ()
+  {
+    return mWriter.PostAndWait (FanOutCommand (FANOUT_FINISH, mNodeId));
+  };
+
+private:
+  set<string> mNames;
+};
+
+
+/******************************************************************************
+ * The writer, which just passes commands on to all the destinations.
+ */
+
+FanOutWriter::FanOutWriter (const IOPolicyRecord &Policy)
+  : mPolicy (Policy),
+    mNextNodeId (1), // Zero is the top level directory.
+    mStarted (false)
+{
+}
+
+
+FanOutWriter::~FanOutWriter ()
+{
+  for (size_t iDest = 0; iDest < mDestinations.size (); iDest++)
+    delete mDestinations[iDest];
+}
+
+
+status_t FanOutWriter::AddDestination (ObfuscateSinkDirectory *pRootDir)
+{
+  if (mStarted)
+  {
+    delete pRootDir;
+    return B_NOT_SUPPORTED;
+  }
+  FanOutDestination *pDestination =
+    new (std::nothrow) FanOutDestination (mPolicy, pRootDir);
+  if (pDestination == NULL)
+  {
+    delete pRootDir;
+    return B_NO_MEMORY;
+  }
+  mDestinations.push_back (pDestination);
+  return B_OK;
+}
+
+
+status_t FanOutWriter::OpenSinkDirectory (ObfuscateSinkDirectory **ppDirectory)
+{
+  if (mDestinations.empty ())
+    return B_BAD_VALUE;
+  if (mStarted)
+    return B_NOT_SUPPORTED;
+  AutoDelete<FanOutSinkDirectory> RootDir (new (std::nothrow)
+    FanOutSinkDirectory (*this, 0, "(fan-out)"));
+  if (RootDir.Get () == NULL)
+    return B_NO_MEMORY;
+
+  // Read the existing names now, while the writer threads aren't touching the
+  // destinations, so Contains never has to wait for them.
+
+  for (size_t iDest = 0; iDest < mDestinations.size (); iDest++)
+  {
+    status_t ErrorNumber =
+      mDestinations[iDest]->GetRootEntryNames (RootDir->Names ());
+    if (ErrorNumber != B_OK)
+      return ErrorNumber;
+  }
+
+  for (size_t iDest = 0; iDest < mDestinations.size (); iDest++)
+    mDestinations[iDest]->Start ();
+  mStarted = true;
+  *ppDirectory = RootDir.Release ();
+  return B_OK;
+}
+
+
+off_t FanOutWriter::GetCloneBlockSize () const
+{
+  return mPolicy.mCloneFiller ? FANOUT_CLONE_BLOCK_SIZE : 0;
+}
+
+
+status_t FanOutWriter::GetAllFailedError () const
+{
+  status_t FirstError = B_OK;
+  for (size_t iDest = 0; iDest < mDestinations.size (); iDest++)
+  {
+    status_t ErrorNumber = mDestinations[iDest]->GetFirstError ();
+    if (ErrorNumber == B_OK)
+      return B_OK; // This one is still going.
+    if (FirstError == B_OK)
+      FirstError = ErrorNumber;
+  }
+  return FirstError;
+}
+
+
+status_t FanOutWriter::Post (const FanOutCommand &Command)
+{
+  status_t ErrorNumber = B_OK;
+  if (Command.mCommand != FANOUT_CLOSE)
+    ErrorNumber = GetAllFailedError ();
+  if (ErrorNumber != B_OK)
+    return ErrorNumber;
+
+  if (Command.mpBuffer != NULL)
+    Command.mpBuffer->AddReferences (mDestinations.size ());
+  for (size_t iDest = 0; iDest < mDestinations.size (); iDest++)
+    mDestinations[iDest]->Post (Command);
+  return B_OK;
+}
+
+
+status_t FanOutWriter::PostAndWait (const FanOutCommand &Command)
+{
+  vector<long long int> SequenceNumbers (mDestinations.size ());
+  for (size_t iDest = 0; iDest < mDestinations.size (); iDest++)
+    SequenceNumbers[iDest] = mDestinations[iDest]->Post (Command);
+
+  status_t Result = B_OK;
+  for (size_t iDest = 0; iDest < mDestinations.size (); iDest++)
+  {
+    mDestinations[iDest]->WaitFor (SequenceNumbers[iDest]);
+    status_t ErrorNumber = mDestinations[iDest]->GetFirstError ();
+    if (ErrorNumber != B_OK)
+      DisplayErrorMessage ("Writing stopped after the first error, so the "
+        "output is incomplete", ErrorNumber, mDestinations[iDest]->GetPath ());
+    else
+      ErrorNumber = mDestinations[iDest]->GetLastResult ();
+    if (Result == B_OK)
+      Result = ErrorNumber;
+  }
+  return Result;
+}
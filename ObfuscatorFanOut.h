@@ -0,0 +1,87 @@
+/******************************************************************************
+ * ObfuscatorFanOut.h
+ *
+ * A sink which copies everything written to it into several destination
+ * sinks, for obfuscating one source into several file systems (BFS, ext4, XFS
+ * and a tmpfs baseline, say) with a single pass over the source.  Since the
+ * names and contents are generated once, the sequence numbering is identical
+ * in all the outputs.
+ *
+ * Each destination has its own writer thread and queue of operations, so a
+ * slow destination doesn't hold up the others until its queue fills up.  File
+ * contents are shared between the queues rather than copied.  Because writes
+ * happen later, an error in a destination is displayed when it happens, and
+ * nothing more gets queued for that destination while the others carry on,
+ * so one file system failing doesn't spoil the comparison with the rest.
+ * Each failed destination is reported again by Finish, which then returns an
+ * error.  Operations only fail once every destination has failed.
+ *
+ * Needs C++11 for the threads.
+ */
+
+#ifndef OBFUSCATOR_FAN_OUT_H
+#define OBFUSCATOR_FAN_OUT_H
+
+#include <vector>
+
+#include "ObfuscatorInterfaces.h"
+#include "ObfuscatorIOPolicy.h"
+
+// A destination can have this much file data queued before the obfuscator
+// waits for it to catch up.
+static const off_t FANOUT_QUEUE_BYTES = 256 * 1024 * 1024;
+static const int FANOUT_QUEUE_OPERATIONS = 100000;
+
+// Cloned filler is a multiple of this size, which is a multiple of the usual
+// file system block sizes.  Destinations which can't clone that get the filler
+// written normally.
+static const off_t FANOUT_CLONE_BLOCK_SIZE = 64 * 1024;
+
+struct FanOutCommand;
+class FanOutDestination;
+
+
+class FanOutWriter
+{
+public:
+  // The policy is used for allocating the shared file data buffers, so they
+  // suit direct I/O if it is on.  It has to outlive the writer.
+  FanOutWriter (const IOPolicyRecord &Policy);
+
+  // Stops the writer threads and deletes the destinations.
+  ~FanOutWriter ();
+
+  // Adds a top level destination directory, which the writer then owns.  Has
+  // to be done before OpenSinkDirectory.
+  status_t AddDestination (ObfuscateSinkDirectory *pRootDir);
+
+  // Reads the names already in the destinations, starts the writer threads
+  // and makes the sink directory to give to the obfuscator, owned by the
+  // caller and deleted before the writer.  Can only be done once.  Fails if a
+  // destination can't list its names.
+  status_t OpenSinkDirectory (ObfuscateSinkDirectory **ppDirectory);
+
+  int DestinationCount () const { return mDestinations.size (); };
+
+  // For the sink objects.  Post queues a command for all destinations, waiting
+  // if a queue is full, or returns an error if all of them have failed (Close
+  // commands are always queued).  PostAndWait also waits for all of them to do
+  // it, and returns the first error from any destination.
+  uint32 NewNodeId () { return mNextNodeId++; };
+  off_t GetCloneBlockSize () const;
+  const IOPolicyRecord & Policy () const { return mPolicy; };
+  status_t GetAllFailedError () const; // B_OK while any destination works.
+  status_t Post (const FanOutCommand &Command);
+  status_t PostAndWait (const FanOutCommand &Command);
+
+private:
+  FanOutWriter (const FanOutWriter &); // Not copyable.
+  FanOutWriter & operator = (const FanOutWriter &);
+
+  const IOPolicyRecord &mPolicy;
+  std::vector<FanOutDestination *> mDestinations;
+  uint32 mNextNodeId;
+  bool mStarted;
+};
+
+#endif /* OBFUSCATOR_FAN_OUT_H */
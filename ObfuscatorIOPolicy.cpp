@@ -0,0 +1,513 @@
+/******************************************************************************
+ * ObfuscatorIOPolicy.cpp
+ *
+ * Page cache friendly file reading and writing, see ObfuscatorIOPolicy.h.
+ */
+
+/* Standard C Library. */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1 // For O_DIRECT, sync_file_range and syncfs on Linux.
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#ifdef __linux__
+  #include <sys/statvfs.h>
+  #include <linux/fs.h> // For FICLONERANGE.
+#endif
+
+/* Standard C++ library. */
+
+#include <map>
+#include <mutex>
+#include <new> // For nothrow option when new'ing memory.
+
+/* This library's headers. */
+
+#include "ObfuscatorIOPolicy.h"
+#include "ObfuscatorTrace.h"
+
+
+bool IOPolicySupportsDropCache ()
+{
+#ifdef POSIX_FADV_DONTNEED
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+bool IOPolicySupportsThrottle ()
+{
+#ifdef SYNC_FILE_RANGE_WRITE
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+bool IOPolicySupportsDirectIO ()
+{
+#ifdef O_DIRECT
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+bool IOPolicySupportsCloneFiller ()
+{
+#ifdef FICLONERANGE
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+bool IOPolicyWantsDirectIO (const IOPolicyRecord &Policy, off_t DataSize)
+{
+  return IOPolicySupportsDirectIO () && Policy.mDirectIO &&
+    DataSize >= DIRECT_IO_MIN_SIZE;
+}
+
+
+/******************************************************************************
+ * Tell the OS that we won't be using the cached data of the given open file
+ * again, for the part starting at Offset and running for Length bytes (zero
+ * length means to the end of the file).  Clean pages get dropped right away,
+ * dirty ones get queued for writing and are dropped later on by the OS.
+ */
+
+void DropFileCache (const IOPolicyRecord &Policy, int FileDescriptor,
+  off_t Offset, off_t Length)
+{
+#ifdef POSIX_FADV_DONTNEED
+  if (Policy.mDropCache)
+  {
+    TRACE_SPAN ("posix_fadvise");
+    posix_fadvise (FileDescriptor, Offset, Length, POSIX_FADV_DONTNEED);
+  }
+#endif
+}
+
+
+/******************************************************************************
+ * Tell the OS that the file is going to be read just once, before reading it.
+ */
+
+void AdviseReadOnce (const IOPolicyRecord &Policy, int FileDescriptor)
+{
+#ifdef POSIX_FADV_NOREUSE
+  if (Policy.mDropCache)
+  {
+    TRACE_SPAN ("posix_fadvise");
+    posix_fadvise (FileDescriptor, 0, 0, POSIX_FADV_NOREUSE);
+    posix_fadvise (FileDescriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+#endif
+}
+
+
+/******************************************************************************
+ * Allocate a buffer for file data.  If it is going to be used for direct I/O,
+ * it is aligned to the disk block size, otherwise it's a plain new'd array.
+ * Returns NULL if out of memory.  Free it with FreeAlignedDataBuffer, using
+ * the same policy and size.
+ */
+
+char * AllocateAlignedDataBuffer (const IOPolicyRecord &Policy,
+  off_t BufferSize)
+{
+#ifdef O_DIRECT
+  if (IOPolicyWantsDirectIO (Policy, BufferSize))
+  {
+    void *pAlignedBuffer = NULL;
+    if (posix_memalign (&pAlignedBuffer, DIRECT_IO_ALIGNMENT, BufferSize) != 0)
+      return NULL;
+    return (char *) pAlignedBuffer;
+  }
+#endif
+  return new (std::nothrow) char [BufferSize];
+}
+
+
+void FreeAlignedDataBuffer (const IOPolicyRecord &Policy, char *pBuffer,
+  off_t BufferSize)
+{
+#ifdef O_DIRECT
+  if (IOPolicyWantsDirectIO (Policy, BufferSize))
+  {
+    free (pBuffer);
+    return;
+  }
+#endif
+  delete [] pBuffer;
+}
+
+
+/******************************************************************************
+ * Read a file's contents from the start of the file using the I/O policy, so
+ * that it doesn't stay in the disk cache afterwards.  Returns the number of
+ * bytes read or a negative error code.
+ */
+
+ssize_t ReadFileData (const IOPolicyRecord &Policy, int FileDescriptor,
+  char *pBuffer, off_t DataSize)
+{
+  AdviseReadOnce (Policy, FileDescriptor);
+
+  off_t AmountRead = 0;
+  while (AmountRead < DataSize)
+  {
+    TRACE_SPAN ("pread");
+    ssize_t ReadSize = pread (FileDescriptor, pBuffer + AmountRead,
+      DataSize - AmountRead, AmountRead);
+    if (ReadSize < 0 && errno == EINTR)
+      continue;
+    if (ReadSize < 0)
+    {
+      AmountRead = ERRNO_TO_STATUS (errno);
+      break;
+    }
+    if (ReadSize == 0)
+      break; // File got shorter while we were reading it.
+    AmountRead += ReadSize;
+  }
+
+  DropFileCache (Policy, FileDescriptor);
+  return AmountRead;
+}
+
+
+/******************************************************************************
+ * Write a file's contents using the I/O policy, starting at StartOffset in the
+ * file, which is usually zero.  The file gets written in chunks, and if
+ * throttling is on, write-back is started for each chunk as soon as it is
+ * written and we wait for the previous chunk to hit the disk before
+ * continuing.  That keeps the amount of dirty data in the disk cache small,
+ * rather than having the OS flush hundreds of megabytes all at once.  With
+ * direct I/O, the whole disk blocks at the start of the buffer bypass the
+ * cache and the left over partial block at the end goes through it.  The
+ * buffer must come from AllocateAlignedDataBuffer with the same policy and
+ * size, and StartOffset has to be a multiple of the block size for direct I/O.
+ * Returns the number of bytes written or a negative error code.
+ */
+
+ssize_t WriteFileData (const IOPolicyRecord &Policy, int FileDescriptor,
+  const char *pBuffer, off_t DataSize, off_t StartOffset)
+{
+  off_t ChunkSize = IO_CHUNK_SIZE;
+  if (Policy.mThrottleMegabytes > 0)
+    ChunkSize = Policy.mThrottleMegabytes * (off_t) 1024 * 1024;
+
+  off_t DirectEnd = 0;
+#ifdef O_DIRECT
+  int OriginalFlags = fcntl (FileDescriptor, F_GETFL);
+  if (IOPolicyWantsDirectIO (Policy, DataSize) &&
+  StartOffset % DIRECT_IO_ALIGNMENT == 0 &&
+  fcntl (FileDescriptor, F_SETFL, OriginalFlags | O_DIRECT) == 0)
+    DirectEnd = DataSize - DataSize % DIRECT_IO_ALIGNMENT;
+#endif
+
+  off_t AmountWritten = 0;
+  off_t PreviousChunkStart = -1;
+  off_t PreviousChunkSize = 0;
+  while (AmountWritten < DataSize)
+  {
+    off_t WriteSize = DataSize - AmountWritten;
+    if (WriteSize > ChunkSize)
+      WriteSize = ChunkSize;
+
+    if (AmountWritten < DirectEnd && AmountWritten + WriteSize > DirectEnd)
+      WriteSize = DirectEnd - AmountWritten; // Stop at the last whole block.
+
+#ifdef O_DIRECT
+    if (DirectEnd > 0 && AmountWritten == DirectEnd)
+    {
+      // Partial block at the end can't be written directly.
+      fcntl (FileDescriptor, F_SETFL, OriginalFlags);
+      DirectEnd = 0;
+    }
+#endif
+
+    ssize_t ChunkWritten;
+    {
+      TRACE_SPAN ("pwrite");
+      ChunkWritten = pwrite (FileDescriptor, pBuffer + AmountWritten,
+        WriteSize, StartOffset + AmountWritten);
+    }
+    if (ChunkWritten < 0 && errno == EINTR)
+      continue;
+#ifdef O_DIRECT
+    if (ChunkWritten < 0 && errno == EINVAL && DirectEnd > 0)
+    {
+      // File system doesn't do direct I/O after all, use the cache.
+      fcntl (FileDescriptor, F_SETFL, OriginalFlags);
+      DirectEnd = 0;
+      continue;
+    }
+#endif
+    if (ChunkWritten < 0)
+      return ERRNO_TO_STATUS (errno);
+    if (ChunkWritten == 0)
+      return AmountWritten;
+
+#ifdef SYNC_FILE_RANGE_WRITE
+    if (Policy.mThrottleMegabytes > 0)
+    {
+      TRACE_SPAN ("sync_file_range");
+      sync_file_range (FileDescriptor, StartOffset + AmountWritten,
+        ChunkWritten, SYNC_FILE_RANGE_WRITE);
+      if (PreviousChunkStart >= 0)
+      {
+        sync_file_range (FileDescriptor, PreviousChunkStart, PreviousChunkSize,
+          SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+          SYNC_FILE_RANGE_WAIT_AFTER);
+        DropFileCache (Policy, FileDescriptor, PreviousChunkStart,
+          PreviousChunkSize);
+      }
+    }
+#endif
+    PreviousChunkStart = StartOffset + AmountWritten;
+    PreviousChunkSize = ChunkWritten;
+    AmountWritten += ChunkWritten;
+  }
+
+#ifdef O_DIRECT
+  if (DirectEnd > 0)
+    fcntl (FileDescriptor, F_SETFL, OriginalFlags);
+#endif
+
+  DropFileCache (Policy, FileDescriptor);
+  return AmountWritten;
+}
+
+
+/******************************************************************************
+ * Flush everything written to the file system containing the given path to
+ * disk, all at once at the end of the run, rather than a bit at a time.
+ */
+
+status_t SyncFileSystem (const char *Path)
+{
+  TRACE_SPAN ("syncfs", Path);
+#ifdef __linux__
+  int FileDescriptor = open (Path, O_RDONLY | O_DIRECTORY);
+  if (FileDescriptor < 0)
+    return ERRNO_TO_STATUS (errno);
+  status_t ErrorNumber = B_OK;
+  if (syncfs (FileDescriptor) != 0)
+    ErrorNumber = ERRNO_TO_STATUS (errno);
+  close (FileDescriptor);
+  return ErrorNumber;
+#else
+  sync ();
+  return B_OK;
+#endif
+}
+
+
+/******************************************************************************
+ * Clone template files, see ObfuscatorIOPolicy.h.
+ */
+
+// Whether reflinks worked, by file system device, shared by all the template
+// sets and the fan-out writer threads.
+
+static std::mutex gCloneMethodsLock;
+static std::map<dev_t, int> gCloneMethods;
+
+
+CloneTemplateSet::CloneTemplateSet (int DirectoryDescriptor)
+  : mDirectoryDescriptor (dup (DirectoryDescriptor)),
+    mDevice (0),
+    mTemplateDescriptor (-1),
+    mTemplateSize (0),
+    mBlockSize (0),
+    mMethod (CLONE_UNKNOWN)
+{
+  struct stat DirectoryStat;
+  if (mDirectoryDescriptor < 0 ||
+  fstat (mDirectoryDescriptor, &DirectoryStat) != 0)
+  {
+    mMethod = CLONE_NONE;
+    return;
+  }
+  mDevice = DirectoryStat.st_dev;
+
+  std::lock_guard<std::mutex> Lock (gCloneMethodsLock);
+  std::map<dev_t, int>::iterator MethodIter = gCloneMethods.find (mDevice);
+  if (MethodIter != gCloneMethods.end ())
+    mMethod = (CloneMethodEnum) MethodIter->second;
+}
+
+
+CloneTemplateSet::~CloneTemplateSet ()
+{
+  if (mTemplateDescriptor >= 0)
+    close (mTemplateDescriptor);
+  if (mDirectoryDescriptor >= 0)
+    close (mDirectoryDescriptor);
+}
+
+
+void CloneTemplateSet::SetMethod (CloneMethodEnum Method)
+{
+  mMethod = Method;
+  std::lock_guard<std::mutex> Lock (gCloneMethodsLock);
+  gCloneMethods[mDevice] = Method;
+}
+
+
+off_t CloneTemplateSet::GetBlockSize ()
+{
+  if (mMethod != CLONE_NONE && mBlockSize <= 0)
+  {
+#ifdef __linux__
+    struct statvfs FileSystemStat;
+    if (fstatvfs (mDirectoryDescriptor, &FileSystemStat) == 0)
+      mBlockSize = FileSystemStat.f_bsize;
+#endif
+    if (mBlockSize <= 0)
+      SetMethod (CLONE_NONE);
+  }
+  return (mMethod == CLONE_NONE) ? 0 : mBlockSize;
+}
+
+
+/******************************************************************************
+ * Get the template file, at least Length bytes long, creating it the first
+ * time and extending it with more '0's when a bigger file comes along.  The
+ * template is unnamed (or named and then deleted right away, if the file
+ * system doesn't do O_TMPFILE), so it vanishes when closed and never shows up
+ * in the output.  Returns -1 if it can't be made.
+ */
+
+int CloneTemplateSet::GetTemplate (off_t Length)
+{
+  if (mTemplateDescriptor >= 0 && mTemplateSize >= Length)
+    return mTemplateDescriptor;
+
+  TRACE_SPAN ("MakeCloneTemplate");
+
+  if (mTemplateDescriptor < 0)
+  {
+    int TemplateDescriptor = -1;
+#ifdef O_TMPFILE
+    TemplateDescriptor = openat (mDirectoryDescriptor, ".",
+      O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+#endif
+    if (TemplateDescriptor < 0)
+    {
+      char TemplateName[64];
+      sprintf (TemplateName, ".ObfuscatorCloneTemplate-%d", (int) getpid ());
+      TemplateDescriptor = openat (mDirectoryDescriptor, TemplateName,
+        O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600);
+      if (TemplateDescriptor < 0)
+        return -1;
+      unlinkat (mDirectoryDescriptor, TemplateName, 0);
+    }
+    mTemplateDescriptor = TemplateDescriptor;
+    mTemplateSize = 0;
+  }
+
+  const int FillerBufferSize = 1024 * 1024;
+  char *pFiller = new (std::nothrow) char [FillerBufferSize];
+  if (pFiller == NULL)
+    return -1;
+  memset (pFiller, '0', FillerBufferSize);
+
+  // Only the new part gets written, the blocks already there may be shared
+  // with output files by now.
+
+  while (mTemplateSize < Length)
+  {
+    off_t WriteSize = Length - mTemplateSize;
+    if (WriteSize > FillerBufferSize)
+      WriteSize = FillerBufferSize;
+    ssize_t ChunkWritten = pwrite (mTemplateDescriptor, pFiller, WriteSize,
+      mTemplateSize);
+    if (ChunkWritten < 0 && errno == EINTR)
+      continue;
+    if (ChunkWritten <= 0)
+      break;
+    mTemplateSize += ChunkWritten;
+  }
+  delete [] pFiller;
+
+  if (mTemplateSize < Length)
+    return -1;
+  return mTemplateDescriptor;
+}
+
+
+/******************************************************************************
+ * Clone the first Length bytes of the template, which has to be at least that
+ * long, to the start of the file.
+ */
+
+status_t CloneTemplateSet::CloneRange (int FileDescriptor, off_t Length)
+{
+#ifdef FICLONERANGE
+  struct file_clone_range CloneRange;
+  CloneRange.src_fd = mTemplateDescriptor;
+  CloneRange.src_offset = 0;
+  CloneRange.src_length = Length;
+  CloneRange.dest_offset = 0;
+  TRACE_SPAN ("FICLONERANGE");
+  if (ioctl (FileDescriptor, FICLONERANGE, &CloneRange) != 0)
+    return ERRNO_TO_STATUS (errno);
+  return B_OK;
+#else
+  (void) FileDescriptor;
+  (void) Length;
+  return B_NOT_SUPPORTED;
+#endif
+}
+
+
+/******************************************************************************
+ * Fill the start of a file with '0's from the template.  If it isn't known
+ * yet whether the file system does reflinks, find out by cloning a one block
+ * template into the file, so a file system without them only costs one block
+ * of template writing.  Once it has worked, later failures are real errors
+ * (out of disk space and such) rather than a sign that it isn't supported.
+ * copy_file_range isn't used as a fallback, since it only avoids the data
+ * writes on file systems which share extents, the same ones where FICLONERANGE
+ * works.  Elsewhere it is a full copy on top of writing the template, slower
+ * than just writing the file.
+ */
+
+status_t CloneTemplateSet::CloneZeroFill (int FileDescriptor, off_t Length)
+{
+  if (GetBlockSize () == 0 || Length <= 0 || Length % mBlockSize != 0)
+    return B_NOT_SUPPORTED;
+
+  if (mMethod == CLONE_UNKNOWN)
+  {
+    if (GetTemplate (mBlockSize) < 0 ||
+    CloneRange (FileDescriptor, mBlockSize) != B_OK)
+    {
+      SetMethod (CLONE_NONE);
+      return B_NOT_SUPPORTED;
+    }
+    SetMethod (CLONE_REFLINK);
+    if (Length == mBlockSize)
+      return B_OK;
+  }
+
+  if (GetTemplate (Length) < 0)
+    return B_NOT_SUPPORTED; // Template didn't grow, write this one instead.
+  return CloneRange (FileDescriptor, Length);
+}
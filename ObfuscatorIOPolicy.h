@@ -0,0 +1,113 @@
+/******************************************************************************
+ * ObfuscatorIOPolicy.h
+ *
+ * The I/O policy controls how file contents go through the operating system's
+ * disk cache.  A full run reads and writes hundreds of gigabytes which will
+ * never be looked at again, so optionally we tell the OS to forget about the
+ * data after each file, throttle the dirty data by starting write-back as we
+ * go, do a single sync of the whole destination file system at the end, and
+ * bypass the cache entirely with direct I/O for large file bodies.  On file
+ * systems with reflinks, the leading '0' filler of file bodies can be cloned
+ * from template files rather than written at all.  Features the OS doesn't
+ * have are compiled out, see the IOPolicySupports functions.
+ *
+ * These work on POSIX file descriptors, and are used by the file system
+ * sources and sinks.
+ */
+
+#ifndef OBFUSCATOR_IO_POLICY_H
+#define OBFUSCATOR_IO_POLICY_H
+
+#include "ObfuscatorPlatform.h"
+
+struct IOPolicyRecord
+{
+  bool mDropCache; // posix_fadvise DONTNEED/NOREUSE after each file.
+  int mThrottleMegabytes; // sync_file_range write-back every N MB, 0 for off.
+  bool mSyncAtEnd; // One syncfs at the end of the run.
+  bool mDirectIO; // O_DIRECT with aligned buffers for large file bodies.
+  bool mCloneFiller; // Reflink the '0' filler of file bodies from templates.
+
+  IOPolicyRecord () : mDropCache (false), mThrottleMegabytes (0),
+    mSyncAtEnd (false), mDirectIO (false), mCloneFiller (false) {};
+};
+
+static const int IO_CHUNK_SIZE = 8 * 1024 * 1024;
+static const int DIRECT_IO_ALIGNMENT = 4096;
+static const int DIRECT_IO_MIN_SIZE = 1024 * 1024;
+
+bool IOPolicySupportsDropCache ();
+bool IOPolicySupportsThrottle ();
+bool IOPolicySupportsDirectIO ();
+bool IOPolicySupportsCloneFiller ();
+
+// True if a file body of the given size would be written with direct I/O.
+bool IOPolicyWantsDirectIO (const IOPolicyRecord &Policy, off_t DataSize);
+
+void DropFileCache (const IOPolicyRecord &Policy, int FileDescriptor,
+  off_t Offset = 0, off_t Length = 0);
+
+void AdviseReadOnce (const IOPolicyRecord &Policy, int FileDescriptor);
+
+char * AllocateAlignedDataBuffer (const IOPolicyRecord &Policy,
+  off_t BufferSize);
+
+void FreeAlignedDataBuffer (const IOPolicyRecord &Policy, char *pBuffer,
+  off_t BufferSize);
+
+ssize_t ReadFileData (const IOPolicyRecord &Policy, int FileDescriptor,
+  char *pBuffer, off_t DataSize);
+
+ssize_t WriteFileData (const IOPolicyRecord &Policy, int FileDescriptor,
+  const char *pBuffer, off_t DataSize, off_t StartOffset = 0);
+
+status_t SyncFileSystem (const char *Path);
+
+
+/******************************************************************************
+ * An unnamed template file full of '0' characters on the destination file
+ * system.  File bodies get their leading '0' filler by cloning blocks from it
+ * with the FICLONERANGE ioctl, on reflink capable file systems (btrfs, XFS).
+ * There is just the one template, extended as bigger files come along, so it
+ * is only as big as the largest filler.  Nothing is made until the first file
+ * asks, then reflinks are tried with a one block template before it grows.
+ * The answer is remembered for the file system, so later template sets for
+ * it (watch mode makes one per change) don't try again.  If reflinks don't
+ * work, GetBlockSize returns zero and the caller writes the data normally.
+ */
+
+class CloneTemplateSet
+{
+public:
+  // The directory is where the template gets created, it has to be on the
+  // same file system as the files being filled.  It is dup'ed, so the caller
+  // can close it.
+  CloneTemplateSet (int DirectoryDescriptor);
+  ~CloneTemplateSet ();
+
+  off_t GetBlockSize ();
+
+  // Make the first Length bytes (a multiple of the block size) of the file
+  // all '0' characters.  Returns B_NOT_SUPPORTED if cloning doesn't work.
+  status_t CloneZeroFill (int FileDescriptor, off_t Length);
+
+private:
+  CloneTemplateSet (const CloneTemplateSet &); // Not copyable.
+  CloneTemplateSet & operator = (const CloneTemplateSet &);
+
+  int GetTemplate (off_t Length);
+  status_t CloneRange (int FileDescriptor, off_t Length);
+
+  enum CloneMethodEnum {CLONE_UNKNOWN, CLONE_REFLINK, CLONE_NONE};
+
+  void SetMethod (CloneMethodEnum Method);
+
+  int mDirectoryDescriptor;
+  dev_t mDevice;
+  int mTemplateDescriptor;
+  off_t mTemplateSize;
+  off_t mBlockSize;
+  CloneMethodEnum mMethod;
+};
+
+#endif /* OBFUSCATOR_IO_POLICY_H */
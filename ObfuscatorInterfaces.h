@@ -0,0 +1,187 @@
+/******************************************************************************
+ * ObfuscatorInterfaces.h
+ *
+ * Abstract interfaces between the obfuscator core and the things it reads
+ * from (sources) and writes to (sinks).  They are modelled after the BeOS
+ * BNode, BFile and BDirectory classes, since that is what the obfuscator was
+ * originally written with, but only have the operations the obfuscator needs.
+ *
+ * Directories hand out new'd file and subdirectory objects, which the caller
+ * then owns and has to delete.  Functions return B_OK or a negative error code,
+ * or for reads and writes the number of bytes transferred or a negative error
+ * code, same as BeOS.  Name buffers passed in need to be B_FILE_NAME_LENGTH
+ * bytes long for file names and B_ATTR_NAME_LENGTH+1 for attribute names.
+ */
+
+#ifndef OBFUSCATOR_INTERFACES_H
+#define OBFUSCATOR_INTERFACES_H
+
+#include <sys/stat.h>
+
+#include <new> // For nothrow option when new'ing memory.
+#include <set>
+#include <string>
+
+#include "ObfuscatorPlatform.h"
+
+
+/******************************************************************************
+ * A source file or directory, something that has attributes which can be read.
+ */
+
+class ObfuscateSourceNode
+{
+public:
+  virtual ~ObfuscateSourceNode () {};
+
+  // Path or other human readable description of the node, for messages.
+  virtual const char * GetPath () = 0;
+
+  virtual status_t RewindAttrs () = 0;
+
+  // Returns B_ENTRY_NOT_FOUND after the last attribute.
+  virtual status_t GetNextAttrName (char *pAttributeName) = 0;
+
+  virtual status_t GetAttrInfo (const char *pAttributeName,
+    attr_info *pAttributeInfo) = 0;
+
+  virtual ssize_t ReadAttr (const char *pAttributeName, uint32 Type,
+    off_t Offset, void *pBuffer, size_t BufferSize) = 0;
+};
+
+
+class ObfuscateSourceFile : public ObfuscateSourceNode
+{
+public:
+  virtual status_t GetSize (off_t *pSize) = 0;
+
+  // Reads from the start of the file.  Only used for verbose data dumps.
+  virtual ssize_t ReadData (char *pBuffer, off_t BufferSize) = 0;
+};
+
+
+class ObfuscateSourceDirectory : public ObfuscateSourceNode
+{
+public:
+  virtual status_t Rewind () = 0;
+
+  // Gets the name and status of the next entry in the directory, not following
+  // symbolic links.  Returns B_ENTRY_NOT_FOUND after the last entry.  Doesn't
+  // return "." or "..".
+  virtual status_t GetNextEntry (char *pName, struct stat *pStat) = 0;
+
+  virtual status_t OpenFile (const char *pName,
+    ObfuscateSourceFile **ppFile) = 0;
+
+  virtual status_t OpenDirectory (const char *pName,
+    ObfuscateSourceDirectory **ppDirectory) = 0;
+};
+
+
+/******************************************************************************
+ * A destination file or directory, something that attributes can be written
+ * to.
+ */
+
+class ObfuscateSinkNode
+{
+public:
+  virtual ~ObfuscateSinkNode () {};
+
+  virtual const char * GetPath () = 0;
+
+  virtual ssize_t WriteAttr (const char *pAttributeName, uint32 Type,
+    off_t Offset, const void *pBuffer, size_t BufferSize) = 0;
+};
+
+
+class ObfuscateSinkFile : public ObfuscateSinkNode
+{
+public:
+  // Gets a buffer suitable for writing DataSize bytes with WriteData.  Sinks
+  // doing direct I/O need the buffer to be aligned, others just new it.
+  // Returns NULL if out of memory.
+  virtual char * AllocateDataBuffer (off_t DataSize)
+  {
+    return new (std::nothrow) char [DataSize];
+  };
+
+  virtual void FreeDataBuffer (char *pBuffer, off_t /* DataSize */)
+  {
+    delete [] pBuffer;
+  };
+
+  // Writes the whole file contents, from the start of the file.  Returns the
+  // number of bytes written or a negative error code.
+  virtual ssize_t WriteData (const char *pBuffer, off_t DataSize) = 0;
+
+  // Sinks which can share disk blocks between files (reflinks) return the
+  // block size here, zero if they can't.  Then CloneZeroFill makes the first
+  // Length bytes of the file (a multiple of the block size) all '0' characters
+  // without writing any data, by cloning a template file's blocks.  After
+  // that, the rest of the file gets written with WriteDataAt.  If cloning
+  // fails with B_NOT_SUPPORTED, the caller falls back to WriteData.
+  virtual off_t GetCloneBlockSize () { return 0; };
+
+  virtual status_t CloneZeroFill (off_t /* Length */)
+    { return B_NOT_SUPPORTED; };
+
+  virtual ssize_t WriteDataAt (off_t /* Offset */,
+    const char * /* pBuffer */, off_t /* DataSize */)
+  {
+    return B_NOT_SUPPORTED;
+  };
+};
+
+
+class ObfuscateSinkDirectory : public ObfuscateSinkNode
+{
+public:
+  virtual bool Contains (const char *pName) = 0;
+
+  // Adds the names of the entries already in the directory to the set, for
+  // callers which need them all up front rather than asking Contains for
+  // each name.  Returns B_NOT_SUPPORTED if the sink can't list its entries.
+  virtual status_t GetEntryNames (std::set<std::string> & /* Names */)
+    { return B_NOT_SUPPORTED; };
+
+  // Create a new file, fails if it already exists.
+  virtual status_t CreateFile (const char *pName,
+    ObfuscateSinkFile **ppFile) = 0;
+
+  virtual status_t CreateDirectory (const char *pName,
+    ObfuscateSinkDirectory **ppDirectory) = 0;
+
+  // Called on the top level directory after everything has been written, to
+  // flush data to disk and such.
+  virtual status_t Finish () { return B_OK; };
+};
+
+
+/******************************************************************************
+ * Utility class to delete an object owned by a pointer when it goes out of
+ * scope, to make error handling easier.
+ */
+
+template <class ObjectClass> class AutoDelete
+{
+public:
+  AutoDelete (ObjectClass *pObject = NULL) : mpObject (pObject) {};
+
+  ~AutoDelete () { delete mpObject; };
+
+  ObjectClass * Get () { return mpObject; };
+  ObjectClass * Release ()
+    { ObjectClass *pObject = mpObject; mpObject = NULL; return pObject; };
+  ObjectClass ** Address () { return &mpObject; };
+  ObjectClass * operator -> () { return mpObject; };
+  ObjectClass & operator * () { return *mpObject; };
+
+private:
+  AutoDelete (const AutoDelete &); // Not copyable.
+  AutoDelete & operator = (const AutoDelete &);
+
+  ObjectClass *mpObject;
+};
+
+#endif /* OBFUSCATOR_INTERFACES_H */
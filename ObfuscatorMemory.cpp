@@ -0,0 +1,198 @@
+/******************************************************************************
+ * ObfuscatorMemory.cpp
+ *
+ * The in-memory sink, see ObfuscatorMemory.h.
+ */
+
+/* Standard C Library. */
+
+#include <string.h>
+
+/* This library's headers. */
+
+#include "ObfuscatorMemory.h"
+
+using namespace std;
+
+
+MemoryNode::~MemoryNode ()
+{
+  map<string, MemoryNode *>::iterator ChildIter;
+  for (ChildIter = mChildren.begin (); ChildIter != mChildren.end ();
+  ChildIter++)
+    delete ChildIter->second;
+}
+
+
+/******************************************************************************
+ * Sink objects referring to a node in the tree.
+ */
+
+template <class InterfaceClass>
+class MemorySinkNode : public InterfaceClass
+{
+public:
+  MemorySinkNode (MemoryTree &Tree, MemoryNode &Node, const string &Path)
+    : mTree (Tree),
+      mNode (Node),
+      mPath (Path)
+  {
+  };
+
+  virtual const char * GetPath ()
+  {
+    return mPath.c_str ();
+  };
+
+  virtual ssize_t WriteAttr (const char *pAttributeName, uint32 Type,
+    off_t Offset, const void *pBuffer, size_t BufferSize)
+  {
+    if (Offset != 0)
+      return B_BAD_VALUE; // Only whole attributes are written.
+
+    MemoryAttribute *pAttribute = NULL;
+    vector<MemoryAttribute>::iterator AttrIter;
+    for (AttrIter = mNode.mAttributes.begin ();
+    AttrIter != mNode.mAttributes.end (); AttrIter++)
+    {
+      if (AttrIter->mName == pAttributeName)
+      {
+        pAttribute = &*AttrIter;
+        mTree.MutableStatistics().mAttributeBytes -= pAttribute->mSize;
+        break;
+      }
+    }
+    if (pAttribute == NULL)
+    {
+      mNode.mAttributes.push_back (MemoryAttribute ());
+      pAttribute = &mNode.mAttributes.back ();
+      pAttribute->mName = pAttributeName;
+      mTree.MutableStatistics().mAttributeCount++;
+    }
+
+    pAttribute->mType = Type;
+    pAttribute->mSize = BufferSize;
+    if (mTree.KeepData ())
+      pAttribute->mData.assign ((const char *) pBuffer, BufferSize);
+    mTree.MutableStatistics().mAttributeBytes += BufferSize;
+    return BufferSize;
+  };
+
+protected:
+  MemoryTree &mTree;
+  MemoryNode &mNode;
+  string mPath;
+};
+
+
+class MemorySinkFile : public MemorySinkNode<ObfuscateSinkFile>
+{
+public:
+  MemorySinkFile (MemoryTree &Tree, MemoryNode &Node, const string &Path)
+    : MemorySinkNode<ObfuscateSinkFile> (Tree, Node, Path)
+  {
+  };
+
+  virtual ssize_t WriteData (const char *pBuffer, off_t DataSize)
+  {
+    mTree.MutableStatistics().mDataBytes += DataSize - mNode.mDataSize;
+    mNode.mDataSize = DataSize;
+    if (mTree.KeepData ())
+      mNode.mData.assign (pBuffer, DataSize);
+    return DataSize;
+  };
+};
+
+
+class MemorySinkDirectory : public MemorySinkNode<ObfuscateSinkDirectory>
+{
+public:
+  MemorySinkDirectory (MemoryTree &Tree, MemoryNode &Node, const string &Path)
+    : MemorySinkNode<ObfuscateSinkDirectory> (Tree, Node, Path)
+  {
+  };
+
+  virtual bool Contains (const char *pName)
+  {
+    return mNode.mChildren.find (pName) != mNode.mChildren.end ();
+  };
+
+  virtual status_t GetEntryNames (set<string> &Names)
+  {
+    map<string, MemoryNode *>::iterator ChildIter;
+    for (ChildIter = mNode.mChildren.begin ();
+    ChildIter != mNode.mChildren.end (); ChildIter++)
+      Names.insert (ChildIter->first);
+    return B_OK;
+  };
+
+  virtual status_t CreateFile (const char *pName, ObfuscateSinkFile **ppFile)
+  {
+    MemoryNode *pNewNode = NULL;
+    status_t ErrorNumber = AddChild (pName, false, &pNewNode);
+    if (ErrorNumber != B_OK)
+      return ErrorNumber;
+    *ppFile = new (std::nothrow) MemorySinkFile (mTree, *pNewNode,
+      mPath + "/" + pName);
+    if (*ppFile == NULL)
+      return B_NO_MEMORY;
+    mTree.MutableStatistics().mFileCount++;
+    return B_OK;
+  };
+
+  virtual status_t CreateDirectory (const char *pName,
+    ObfuscateSinkDirectory **ppDirectory)
+  {
+    MemoryNode *pNewNode = NULL;
+    status_t ErrorNumber = AddChild (pName, true, &pNewNode);
+    if (ErrorNumber != B_OK)
+      return ErrorNumber;
+    *ppDirectory = new (std::nothrow) MemorySinkDirectory (mTree, *pNewNode,
+      mPath + "/" + pName);
+    if (*ppDirectory == NULL)
+      return B_NO_MEMORY;
+    mTree.MutableStatistics().mDirectoryCount++;
+    return B_OK;
+  };
+
+private:
+  status_t AddChild (const char *pName, bool IsDirectory,
+    MemoryNode **ppNewNode)
+  {
+    if (pName[0] == 0 || strlen (pName) >= B_FILE_NAME_LENGTH)
+      return B_BAD_VALUE;
+    if (Contains (pName))
+      return B_FILE_EXISTS;
+    *ppNewNode = new (std::nothrow) MemoryNode (IsDirectory);
+    if (*ppNewNode == NULL)
+      return B_NO_MEMORY;
+    mNode.mChildren[pName] = *ppNewNode;
+    return B_OK;
+  };
+};
+
+
+/******************************************************************************
+ * The tree itself.
+ */
+
+MemoryTree::MemoryTree (bool KeepData)
+  : mRoot (true /* IsDirectory */),
+    mKeepData (KeepData)
+{
+}
+
+
+MemoryTree::~MemoryTree ()
+{
+}
+
+
+status_t MemoryTree::OpenSinkDirectory (ObfuscateSinkDirectory **ppDirectory)
+{
+  *ppDirectory = new (std::nothrow) MemorySinkDirectory (*this, mRoot,
+    "(memory)");
+  if (*ppDirectory == NULL)
+    return B_NO_MEMORY;
+  return B_OK;
+}
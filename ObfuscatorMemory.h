@@ -0,0 +1,83 @@
+/******************************************************************************
+ * ObfuscatorMemory.h
+ *
+ * An in-memory sink, for embedding the obfuscator in other programs and for
+ * benchmarking the core without any file system noise.  The obfuscated tree
+ * is kept in a MemoryTree, which owns all the nodes.  The sink objects handed
+ * out to the obfuscator just refer to nodes in the tree, so deleting them
+ * doesn't lose any data.
+ *
+ * If KeepData is false, attribute values and file contents are not stored,
+ * only their sizes are counted, so that huge trees can be benchmarked without
+ * running out of memory.
+ */
+
+#ifndef OBFUSCATOR_MEMORY_H
+#define OBFUSCATOR_MEMORY_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ObfuscatorInterfaces.h"
+
+struct MemoryAttribute
+{
+  std::string mName;
+  uint32 mType;
+  off_t mSize;
+  std::string mData; // Empty if the tree doesn't keep data.
+};
+
+struct MemoryNode
+{
+  MemoryNode (bool IsDirectory) : mIsDirectory (IsDirectory), mDataSize (0) {};
+  ~MemoryNode ();
+
+  bool mIsDirectory;
+  std::vector<MemoryAttribute> mAttributes;
+  off_t mDataSize;
+  std::string mData; // File contents, empty if the tree doesn't keep data.
+  std::map<std::string, MemoryNode *> mChildren; // Owned by this node.
+};
+
+struct MemoryTreeStatistics
+{
+  long long int mDirectoryCount;
+  long long int mFileCount;
+  long long int mAttributeCount;
+  long long int mAttributeBytes;
+  long long int mDataBytes;
+
+  MemoryTreeStatistics () : mDirectoryCount (0), mFileCount (0),
+    mAttributeCount (0), mAttributeBytes (0), mDataBytes (0) {};
+};
+
+
+class MemoryTree
+{
+public:
+  MemoryTree (bool KeepData = true);
+  ~MemoryTree ();
+
+  // Makes a new sink object for the top level directory of the tree, owned by
+  // the caller.
+  status_t OpenSinkDirectory (ObfuscateSinkDirectory **ppDirectory);
+
+  MemoryNode & Root () { return mRoot; };
+  const MemoryTreeStatistics & Statistics () const { return mStatistics; };
+  bool KeepData () const { return mKeepData; };
+
+  // For the sink objects to update the statistics.
+  MemoryTreeStatistics & MutableStatistics () { return mStatistics; };
+
+private:
+  MemoryTree (const MemoryTree &); // Not copyable.
+  MemoryTree & operator = (const MemoryTree &);
+
+  MemoryNode mRoot;
+  MemoryTreeStatistics mStatistics;
+  bool mKeepData;
+};
+
+#endif /* OBFUSCATOR_MEMORY_H */
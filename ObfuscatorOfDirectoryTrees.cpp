@@ -12,6 +12,11 @@
  * hundreds of thousands of e-mails without revealing personal data, and making
  * it small enough to fit in a Zip file.
  *
+ * This file is just the command line program.  The obfuscation itself is done
+ * by the library in ObfuscatorCore.cpp, reading and writing through the
+ * interfaces in ObfuscatorInterfaces.h, with BeOS, POSIX and in-memory
+ * implementations of them.
+ *
  * $Log: ObfuscatorOfDirectoryTrees.cpp,v $
  * Revision 1.13  2014/04/25 15:23:25  agmsmith
  * Oops, forgot to NUL terminate the string.
@@ -62,111 +67,76 @@
 
 #include <stdio.h>
 #include <ctype.h>
-#include <errno.h>
-#include <malloc.h>
-#include <sys/stat.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
 
 /* Standard C++ library. */
 
 #include <iostream>
-#include <new> // For nothrow option when new'ing memory.
 
-/* BeOS (Be Operating System) headers. */
+/* This program's library headers. */
 
-#include <fs_attr.h>
-#include <ByteOrder.h>
-#include <Node.h>
-#include <Directory.h>
-#include <Entry.h>
-#include <File.h>
-#include <NodeInfo.h>
-#include <Path.h>
-#include <String.h>
+#include "ObfuscatorCore.h"
+#include "ObfuscatorFanOut.h"
+#include "ObfuscatorIOPolicy.h"
+#include "ObfuscatorMemory.h"
+#include "ObfuscatorProfile.h"
+#include "ObfuscatorRecord.h"
+#include "ObfuscatorTrace.h"
+#include "ObfuscatorWatch.h"
+#ifdef OBFUSCATOR_BEOS
+  #include "ObfuscatorBeOS.h"
+#else
+  #include "ObfuscatorPosix.h"
+#endif
 
-
-/******************************************************************************
- * Global variables, and not-so-variable things too.
- */
-
-#define PROGRAM_NAME "ObfuscatorOfDirectoryTrees"
-static const int MAX_OBFUSCATE_BUFFER_SIZE = 500000000;
-int gIndentLevel = 0;
-long long int gSequenceNumber = 0;
-
-enum eVerboseLevels
-{
-  VERBOSE_NONE = 0,
-  VERBOSE_DIR,
-  VERBOSE_FILE,
-  VERBOSE_ATTR,
-  VERBOSE_DATA,
-  VERBOSE_EXTREME_DATA,
-  VERBOSE_MAX
-} gVerboseLevel = VERBOSE_NONE;
+using namespace std;
 
 
 /******************************************************************************
- * Utility class to increment the indent level in its constructor and decrement
- * in the destructor.
+ * Open the top level source and destination directories with whichever file
+ * system implementation this platform has.
  */
 
-class AutoIndentIncrement
+static status_t OpenSourceDirectory (const char *pPath,
+  const IOPolicyRecord &Policy, ObfuscateSourceDirectory **ppDirectory)
 {
-public:
-  AutoIndentIncrement (int IncrementAmount = 1)
-  {
-    mIncrementAmount = IncrementAmount;
-    gIndentLevel += mIncrementAmount;
-  };
+#ifdef OBFUSCATOR_BEOS
+  return BeOSOpenSourceDirectory (pPath, Policy, ppDirectory);
+#else
+  return PosixOpenSourceDirectory (pPath, Policy, ppDirectory);
+#endif
+}
 
-  ~AutoIndentIncrement ()
-  {
-    gIndentLevel -= mIncrementAmount;
-  };
 
-private:
-  int mIncrementAmount;
-};
+static status_t OpenSinkDirectory (const char *pPath,
+  const IOPolicyRecord &Policy, ObfuscateSinkDirectory **ppDirectory,
+  bool *pCreated)
+{
+#ifdef OBFUSCATOR_BEOS
+  return BeOSOpenSinkDirectory (pPath, Policy, true /* create */, ppDirectory,
+    pCreated);
+#else
+  return PosixOpenSinkDirectory (pPath, Policy, true /* create */,
+    ppDirectory, pCreated);
+#endif
+}
 
 
 /******************************************************************************
- * Global utility function to display an error message and return.  The message
- * part describes the error, and if ErrorNumber is non-zero, gets the string ",
- * error code $X (standard description)." appended to it.  If the message is
- * NULL then it gets defaulted to "Something went wrong".  The title part is
- * printed before the whole thing.  The text gets printed to stderr.
+ * Control-C and kill stop the watch mode cleanly, so the trace still gets
+ * saved.
  */
 
-static void DisplayErrorMessage (
-  const char *MessageString = NULL,
-  int ErrorNumber = 0,
-  const char *TitleString = NULL)
-{
-  char ErrorBuffer [PATH_MAX + 1500];
-
-  if (TitleString == NULL)
-    TitleString = PROGRAM_NAME " Error Message";
-
-  if (MessageString == NULL)
-  {
-    if (ErrorNumber == 0)
-      MessageString = "No error, no message, why bother?";
-    else
-      MessageString = "Something went wrong";
-  }
+static volatile sig_atomic_t gStopRequested = 0;
 
-  if (ErrorNumber != 0)
-  {
-    sprintf (ErrorBuffer, "%s, error code $%X/%d (%s) has occured.",
-      MessageString, ErrorNumber, ErrorNumber, strerror (ErrorNumber));
-    MessageString = ErrorBuffer;
-  }
-
-  cerr << TitleString << ": " << MessageString << endl;
+static void StopSignalHandler (int /* SignalNumber */)
+{
+  gStopRequested = 1;
 }
 
 
-
 /******************************************************************************
  * Word wrap a long line of text into shorter 79 column lines and print the
  * result on the given output stream.
@@ -262,593 +232,425 @@ static ostream& PrintUsage (ostream& OutputStream)
 "items the same should be sufficient for recreating the bug, as well as making\n"
 "it compress really well.\n"
 "\n"
-"Usage: " PROGRAM_NAME " [-v|-vv|-vvv|-vvvv|-vvvvv] InputDir OutputDir\n"
+"Usage: " PROGRAM_NAME " [-v|-vv|-vvv|-vvvv|-vvvvv] [-dropcache]\n"
+"  [-throttle=MB] [-syncfs] [-direct] [-reflink] InputDir OutputDir...\n"
+"Or: " PROGRAM_NAME " [-v...] -watch InputDir OutputDir\n"
+"Or: " PROGRAM_NAME " [-v...] -memory InputDir\n"
+"Or: " PROGRAM_NAME " [-v...] -replay=FILE [-realtime] OutputDir\n"
+"Or: " PROGRAM_NAME " [-v...] -profile=FILE InputDir\n"
+"Or: " PROGRAM_NAME " [-v...] -synthesize=FILE [-seed=N] OutputDir\n"
+"Add -trace=FILE to any of them to save timings of each step, -record=FILE to\n"
+"save the sequence of file system operations.\n"
 "\n"
-"-v for verbose mode, where more 'v's list more progress information.\n\n";
+"-v for verbose mode, where more 'v's list more progress information.\n"
+"Several OutputDirs can be given, to obfuscate into several file systems with\n"
+"  one pass over InputDir and identical numbering, each written by its own\n"
+"  thread so a slow one doesn't hold up the others.\n"
+"-watch keeps OutputDir up to date after the usual pass, using change\n"
+"  notifications to redo just the created, changed, renamed and deleted\n"
+"  entries a few seconds after each burst of changes.  Existing entries keep\n"
+"  their obfuscated names.  Runs until interrupted with Control-C.\n"
+"-memory obfuscates into a tree in memory rather than an output directory,\n"
+"  only counting the data, for timing the obfuscation without disk writes.\n"
+"-record=FILE saves the creates, attribute writes and data writes done on the\n"
+"  output, just their sizes, in a compact binary file.\n"
+"-replay=FILE does those operations again in OutputDir, instead of reading\n"
+"  an InputDir.  The tree comes out the same.  Useful for reproducing file\n"
+"  system bugs with a small file, or as a metadata benchmark.\n"
+"-realtime makes the replay wait between operations to match the original\n"
+"  timing, rather than going as fast as possible.\n"
+"-profile=FILE saves statistics about InputDir (histograms of directory\n"
+"  fan-out, depth, file sizes, name lengths, and attribute names, types and\n"
+"  sizes) in a small text file, without writing an output tree.\n"
+"-synthesize=FILE makes up an obfuscated tree in OutputDir with the same\n"
+"  statistics as a saved profile, instead of reading an InputDir.  The tree\n"
+"  is random, -seed=N picks a different one.\n"
+"-trace=FILE saves how long each directory, file, attribute and system call\n"
+"  took, as Chrome trace JSON for viewing in chrome://tracing or Perfetto.\n"
+"\n"
+"The other options are for running on a busy computer, to avoid filling the\n"
+"disk cache with data that will never be used again:\n"
+"-dropcache tells the OS to forget each file's data after it has been done.\n"
+"-throttle=MB starts writing dirty data to disk every MB megabytes and waits\n"
+"  for the previous chunk to finish, so dirty data doesn't pile up.\n"
+"-syncfs does one sync of the whole destination file system at the end.\n"
+"-direct uses direct I/O for file contents bigger than a megabyte, bypassing\n"
+"  the disk cache completely.\n"
+"-reflink makes the zeroes at the start of big files by sharing disk blocks\n"
+"  with a template file, on file systems with reflinks (btrfs, XFS), so only\n"
+"  the last block with the number gets written.  Uses normal writes on\n"
+"  other file systems.\n"
+"Options which the OS doesn't support are ignored with a warning.\n\n";
 
   return OutputStream;
 }
 
 
 /******************************************************************************
- * Print out a readable version of the given data buffer.  Hex dump plus
- * strings.  Optionally cuts off after a few hundred bytes.  Indents too.
+ * Finally, the main program which drives it all.
  */
 
-static void DumpBuffer (const char *pBuffer, int BufferSize)
+int main (int argc, char** argv)
 {
-  AutoIndentIncrement AutoIndenter;
-  const char *pBufferEnd;
-  const int BytesPerLine = 16;
-  const int MaxPrintByteCount = 320;
+  // Declared first so they outlive the directories which refer to them.
+  IOPolicyRecord IOPolicy;
+  AutoDelete<MemoryTree> MemoryDest;
+  OperationRecorder Recorder;
+  TreeProfile Profile; // Being collected.
+  TreeProfile SynthesizeProfile; // Loaded for making a synthetic source.
+  AutoDelete<FanOutWriter> FanOut; // Owns the destinations if several.
+
+  AutoDelete<ObfuscateSinkDirectory> DestDir;
+  AutoDelete<ObfuscateSinkDirectory> RecordingDir; // Wraps DestDir.
+  status_t ErrorNumber = B_OK;
+  Obfuscator TheObfuscator;
+  WatchedMirror Mirror (TheObfuscator, IOPolicy);
+  bool WatchMode = false;
+  AutoDelete<ObfuscateSourceDirectory> SourceDir;
+  eVerboseLevels VerboseLevel = VERBOSE_NONE;
+  const char *pTracePath = NULL;
+  const char *pRecordPath = NULL;
+  const char *pReplayPath = NULL;
+  bool RealTimeReplay = false;
+  const char *pProfilePath = NULL;
+  const char *pSynthesizePath = NULL;
+  uint64 SynthesizeSeed = 1;
+  int OutputDirCount = 0;
 
-  if (pBuffer == NULL || BufferSize <= 0)
-    return;
+  enum ArgStateEnum {ASE_LOOKING_FOR_SOURCE, ASE_LOOKING_FOR_DEST, ASE_DONE}
+    eArgState = ASE_LOOKING_FOR_SOURCE;
 
-  if (gVerboseLevel < VERBOSE_EXTREME_DATA &&
-  BufferSize > MaxPrintByteCount)
-    pBufferEnd = pBuffer + MaxPrintByteCount;
-  else
-    pBufferEnd = pBuffer + BufferSize;
-
-  // Each byte printed uses 4 bytes of output: 2 for the hex digits, 1 for the
-  // string value, and one space.  Format is:
-  // 00 11 22 33 44 55 66 77 88 99 00 aa bb cc dd ee ff "0123456789abcdef"
-  char OutputLine[BytesPerLine * 4 + 3];
-
-  int LineBytes = 0;
-  memset (OutputLine, ' ', sizeof (OutputLine) - 1);
-  OutputLine[BytesPerLine * 3] = '"';
-  OutputLine[BytesPerLine * 4 + 1] = '"';
-  OutputLine[sizeof (OutputLine) - 1] = 0;
-  while (true)
+  int iArg;
+  for (iArg = 1; iArg < argc; iArg++)
   {
-    char TempBuf[4];
-    unsigned char ByteValue = *pBuffer;
-    sprintf (TempBuf, "%02X", ByteValue);
-    OutputLine[LineBytes * 3] = TempBuf[0];
-    OutputLine[LineBytes * 3 + 1] = TempBuf[1];
-    if (ByteValue < 32)
-      ByteValue = '_'; // Can't print control characters, use underscore.
-    OutputLine[BytesPerLine * 3 + LineBytes + 1] = ByteValue;
-
-    pBuffer++;
-    LineBytes++;
-
-    if (LineBytes >= BytesPerLine || pBuffer >= pBufferEnd)
+    char ErrorMessage [1024];
+
+    if (strlen(argv[iArg]) > sizeof (ErrorMessage) - 100)
+      cerr << "Argument is too long, ignoring it: " << argv[iArg] << endl;
+    else if (strcmp(argv[iArg], "-v") == 0)
+      VerboseLevel = VERBOSE_DIR;
+    else if (strcmp(argv[iArg], "-vv") == 0)
+      VerboseLevel = VERBOSE_FILE;
+    else if (strcmp(argv[iArg], "-vvv") == 0)
+      VerboseLevel = VERBOSE_ATTR;
+    else if (strcmp(argv[iArg], "-vvvv") == 0)
+      VerboseLevel = VERBOSE_DATA;
+    else if (strcmp(argv[iArg], "-vvvvv") == 0)
+      VerboseLevel = VERBOSE_EXTREME_DATA;
+    else if (strcmp(argv[iArg], "-dropcache") == 0)
     {
-      printf ("%*s%s\n", gIndentLevel, "", OutputLine);
-      LineBytes = 0;
-      memset (OutputLine, ' ', sizeof (OutputLine) - 1);
-      OutputLine[BytesPerLine * 3] = '"';
-      OutputLine[BytesPerLine * 4 + 1] = '"';
-      OutputLine[sizeof (OutputLine) - 1] = 0;
+      if (IOPolicySupportsDropCache ())
+        IOPolicy.mDropCache = true;
+      else
+        cerr << "Dropping the disk cache isn't supported, ignoring " <<
+          argv[iArg] << endl;
     }
-
-    if (pBuffer >= pBufferEnd)
-      break;
-  }
-
-  if (gVerboseLevel < VERBOSE_EXTREME_DATA && BufferSize > MaxPrintByteCount)
-    printf ("%*s... and %d more bytes.\n", gIndentLevel, "",
-      BufferSize - MaxPrintByteCount);
-}
-
-
-/******************************************************************************
- * Obfuscate the given buffer by filling it with the sequence number in ASCII
- * text form.  Adds as many leading zeros as needed to fill the whole buffer.
- * Result is not NUL terminated.
- *
- * Since this is running in 32 bit BeOS, the buffer can be at most about 1.8GB
- * in size, thus BufferSize is fine as an int.
- */
-
-static void ObfuscateBuffer(char *pBuffer, int BufferSize)
-{
-  const int NumberLength = 23; // Max 64 bit number is about 20 digits.
-  char NumberString[NumberLength + 1];
-
-  if (pBuffer == NULL || BufferSize <= 0)
-  {
-    DisplayErrorMessage ("NULL or not postive size buffer inputs",
-      B_BAD_VALUE, "ObfuscateBuffer");
-    return;
-  }
-
-  memset (pBuffer, '0', BufferSize);
-  sprintf (NumberString, "%0*Ld", NumberLength, gSequenceNumber++);
-
-  // Copy as much of the number as will fit to the end of the buffer.
-
-  int CopyLength = NumberLength;
-  int StartPosition = BufferSize - NumberLength;
-  if (StartPosition < 0)
-  {
-    CopyLength += StartPosition; // Reduces amount copied.
-    StartPosition = 0;
-  }
-  memcpy (pBuffer + StartPosition, NumberString + (NumberLength - CopyLength),
-    CopyLength);
-}
-
-
-/******************************************************************************
- * Copy the attributes from a source (file or directory) to a similar type of
- * destination.
- */
-
-static status_t ObfuscateAttributes (BNode &SourceNode, BNode &DestNode)
-{
-  char AttributeName[B_ATTR_NAME_LENGTH+1];
-  AutoIndentIncrement AutoIndenter;
-  char ErrorMessage[B_ATTR_NAME_LENGTH+100];
-  status_t ErrorNumber;
-
-  ErrorNumber = SourceNode.RewindAttrs();
-  if (ErrorNumber != B_OK)
-  {
-    DisplayErrorMessage ("Unable to rewind to first attribute", ErrorNumber,
-      "ObfuscateAttributes");
-    return ErrorNumber;
-  }
-
-  while (B_OK == (ErrorNumber = SourceNode.GetNextAttrName(AttributeName)))
-  {
-    struct attr_info AttributeInfo;
-    ErrorNumber = SourceNode.GetAttrInfo(AttributeName, &AttributeInfo);
-    if (ErrorNumber != B_OK)
+    else if (strncmp(argv[iArg], "-throttle=", 10) == 0)
     {
-      sprintf (ErrorMessage, "Can't get info about \"%s\" attribute",
-        AttributeName);
-      DisplayErrorMessage (ErrorMessage, ErrorNumber, "ObfuscateAttributes");
-      return ErrorNumber;
+      if (!IOPolicySupportsThrottle ())
+        cerr << "Write-back throttling isn't supported, ignoring " <<
+          argv[iArg] << endl;
+      else
+      {
+        IOPolicy.mThrottleMegabytes = atoi (argv[iArg] + 10);
+        if (IOPolicy.mThrottleMegabytes <= 0)
+          cerr << "Throttle size needs to be a positive number of megabytes, "
+            "ignoring " << argv[iArg] << endl;
+      }
     }
-
-    if (gVerboseLevel >= VERBOSE_ATTR)
+    else if (strcmp(argv[iArg], "-syncfs") == 0)
+      IOPolicy.mSyncAtEnd = true;
+    else if (strcmp(argv[iArg], "-direct") == 0)
     {
-      char TypeString[5];
-      * (uint32 *) TypeString = B_BENDIAN_TO_HOST_INT32(AttributeInfo.type);
-      TypeString[4] = 0;
-
-      printf ("%*sAttribute \"%s\" of type '%s', length %d.\n",
-        gIndentLevel, "", AttributeName, TypeString, (int) AttributeInfo.size);
+      if (IOPolicySupportsDirectIO ())
+        IOPolicy.mDirectIO = true;
+      else
+        cerr << "Direct I/O isn't supported, ignoring " << argv[iArg] << endl;
     }
-
-    if (AttributeInfo.size < 0)
+    else if (strcmp(argv[iArg], "-reflink") == 0)
     {
-      ErrorNumber = B_BAD_VALUE;
-      sprintf (ErrorMessage, "Attribute \"%s\" has negative size %Ld",
-        AttributeName, AttributeInfo.size);
-      DisplayErrorMessage (ErrorMessage, ErrorNumber, "ObfuscateAttributes");
-      return ErrorNumber;
+      if (IOPolicySupportsCloneFiller ())
+        IOPolicy.mCloneFiller = true;
+      else
+        cerr << "Cloning file contents isn't supported, ignoring " <<
+          argv[iArg] << endl;
     }
-
-    if (AttributeInfo.size > MAX_OBFUSCATE_BUFFER_SIZE)
+    else if (strncmp(argv[iArg], "-trace=", 7) == 0)
+      pTracePath = argv[iArg] + 7;
+    else if (strncmp(argv[iArg], "-record=", 8) == 0)
+      pRecordPath = argv[iArg] + 8;
+    else if (strncmp(argv[iArg], "-replay=", 8) == 0)
+    {
+      // Replaying only needs the output directory.
+      pReplayPath = argv[iArg] + 8;
+      if (eArgState == ASE_LOOKING_FOR_SOURCE)
+        eArgState = ASE_LOOKING_FOR_DEST;
+    }
+    else if (strcmp(argv[iArg], "-realtime") == 0)
+      RealTimeReplay = true;
+    else if (strncmp(argv[iArg], "-profile=", 9) == 0)
+      pProfilePath = argv[iArg] + 9;
+    else if (strncmp(argv[iArg], "-synthesize=", 12) == 0)
     {
-      if (gVerboseLevel >= VERBOSE_ATTR)
+      // The synthetic tree replaces the input directory.
+      pSynthesizePath = argv[iArg] + 12;
+      if (eArgState == ASE_LOOKING_FOR_SOURCE)
+        eArgState = ASE_LOOKING_FOR_DEST;
+    }
+    else if (strncmp(argv[iArg], "-seed=", 6) == 0)
+      SynthesizeSeed = strtoull (argv[iArg] + 6, NULL, 10);
+    else if (strcmp(argv[iArg], "-watch") == 0)
+      WatchMode = true;
+    else if (strcmp(argv[iArg], "-memory") == 0)
+    {
+      if (MemoryDest.Get () == NULL)
+        *MemoryDest.Address () = new MemoryTree (false /* KeepData */);
+    }
+    else if (eArgState == ASE_LOOKING_FOR_SOURCE)
+    {
+      ErrorNumber = OpenSourceDirectory (argv[iArg], IOPolicy,
+        SourceDir.Address ());
+      if (ErrorNumber != B_OK)
       {
-        AutoIndentIncrement AutoIndentMore;
-        printf ("%*sTruncating attribute \"%s\" size from %Ld down to %d.\n",
-          gIndentLevel, "", AttributeName, AttributeInfo.size,
-          MAX_OBFUSCATE_BUFFER_SIZE);
+        sprintf(ErrorMessage,
+          "Unable to open source directory \"%s\"", argv[iArg]);
+        DisplayErrorMessage (ErrorMessage, ErrorNumber, "Main");
+        break;
       }
-      AttributeInfo.size = MAX_OBFUSCATE_BUFFER_SIZE;
+      eArgState = ASE_LOOKING_FOR_DEST;
     }
-
-    char *pData = new (std::nothrow) char [AttributeInfo.size];
-    if (pData == NULL)
+    else if (eArgState == ASE_LOOKING_FOR_DEST)
     {
-      ErrorNumber = B_NO_MEMORY;
-      sprintf (ErrorMessage,
-        "Unable to allocate memory for attribute \"%s\" size %Ld",
-        AttributeName, AttributeInfo.size);
-      DisplayErrorMessage (ErrorMessage, ErrorNumber, "ObfuscateAttributes");
-      return ErrorNumber;
+      bool Created = false;
+      ErrorNumber = OpenSinkDirectory (argv[iArg], IOPolicy,
+        DestDir.Address (), &Created);
+      if (ErrorNumber != B_OK)
+      {
+        sprintf(ErrorMessage,
+          "Unable to open or create destination directory \"%s\"", argv[iArg]);
+        DisplayErrorMessage (ErrorMessage, ErrorNumber, "Main");
+        break;
+      }
+      if (Created && VerboseLevel >= VERBOSE_DIR)
+        cout << "Created destination directory \"" << argv[iArg] << "\"\n";
+      OutputDirCount++;
+      eArgState = ASE_DONE;
     }
-
-    if (gVerboseLevel >= VERBOSE_DATA)
+    else // More destinations, one pass over the source writes to all of them.
     {
-      ssize_t AmountRead = SourceNode.ReadAttr (AttributeName,
-        AttributeInfo.type, 0 /* offset */, pData, AttributeInfo.size);
-      if (AmountRead == AttributeInfo.size)
+      bool Created = false;
+      ObfuscateSinkDirectory *pExtraDestDir = NULL;
+      ErrorNumber = OpenSinkDirectory (argv[iArg], IOPolicy, &pExtraDestDir,
+        &Created);
+      if (ErrorNumber != B_OK)
       {
-        DumpBuffer (pData, AttributeInfo.size);
+        sprintf(ErrorMessage,
+          "Unable to open or create destination directory \"%s\"", argv[iArg]);
+        DisplayErrorMessage (ErrorMessage, ErrorNumber, "Main");
+        eArgState = ASE_LOOKING_FOR_DEST; // So it doesn't run.
+        break;
       }
-      else
+      if (Created && VerboseLevel >= VERBOSE_DIR)
+        cout << "Created destination directory \"" << argv[iArg] << "\"\n";
+      OutputDirCount++;
+      if (FanOut.Get () == NULL)
       {
-        DisplayErrorMessage (AttributeName, AmountRead,
-          "Unable to read attribute value (nonfatal - don't need data)");
+        *FanOut.Address () = new FanOutWriter (IOPolicy);
+        FanOut->AddDestination (DestDir.Release ());
       }
+      FanOut->AddDestination (pExtraDestDir);
     }
+  }
 
-    // For string type attributes, put the NUL back at the end of the
-    // obfuscated string, otherwise it looks weird in the attribute viewer.
-
-    if (AttributeInfo.size >= 1 && (AttributeInfo.type == B_MIME_STRING_TYPE ||
-    AttributeInfo.type == B_STRING_TYPE))
-    {
-      ObfuscateBuffer (pData, AttributeInfo.size - 1);
-      pData[AttributeInfo.size - 1] = 0;
-    }
-    else
-      ObfuscateBuffer (pData, AttributeInfo.size);
+  if (FanOut.Get () != NULL && eArgState == ASE_DONE)
+  {
+    ErrorNumber = FanOut->OpenSinkDirectory (DestDir.Address ());
+    if (ErrorNumber != B_OK)
+      eArgState = ASE_LOOKING_FOR_DEST;
+  }
 
-    ssize_t AmountWritten = DestNode.WriteAttr (AttributeName,
-      AttributeInfo.type, 0 /* offset */, pData, AttributeInfo.size);
-    delete [] pData; // Get rid of buffer now, makes error handling easier.
-    if (AmountWritten != AttributeInfo.size)
+  if (pSynthesizePath != NULL && ErrorNumber == B_OK)
+  {
+    ErrorNumber = SynthesizeProfile.Load (pSynthesizePath);
+    if (ErrorNumber == B_OK)
+      ErrorNumber = SyntheticOpenSourceDirectory (SynthesizeProfile,
+        SynthesizeSeed,
+        SourceDir.Address ());
+    if (ErrorNumber != B_OK)
     {
-      ErrorNumber = AmountWritten;
-      if (ErrorNumber >= 0)
-        ErrorNumber = B_IO_ERROR;
-      sprintf (ErrorMessage, "Only wrote %d bytes of %d for \"%s\" attribute",
-        (int) AmountWritten, (int) AttributeInfo.size, AttributeName);
-      DisplayErrorMessage (ErrorMessage, ErrorNumber, "ObfuscateAttributes");
-      return ErrorNumber;
+      DisplayErrorMessage (pSynthesizePath, ErrorNumber,
+        "Main: Unable to load profile");
+      eArgState = ASE_LOOKING_FOR_SOURCE;
     }
+  }
 
-  } // end while GetNextAttrName
-
-  if (ErrorNumber == B_ENTRY_NOT_FOUND)
-    ErrorNumber = B_OK; // Reaching end of list isn't an error.
-  else
-    DisplayErrorMessage ("Problems reading attribute name list", ErrorNumber,
-      "ObfuscateAttributes");
-
-  return ErrorNumber;
-}
-
-
-/******************************************************************************
- * Given an already existing source file, create a destination one with
- * obfuscated contents.
- */
-
-static status_t ObfuscateFile (BEntry &SourceEntry, BDirectory &DestDir,
-  const char *DestName)
-{
-  AutoIndentIncrement AutoIndenter;
-  char ErrorMessage[B_FILE_NAME_LENGTH+100];
-  status_t ErrorNumber;
-
-  char SourceName[B_FILE_NAME_LENGTH];
-  SourceEntry.GetName (SourceName);
+  // The in-memory or profiling destination replaces the output directory
+  // argument.
 
-  BFile SourceFile (&SourceEntry, B_READ_ONLY);
-  ErrorNumber = SourceFile.InitCheck();
-  if (ErrorNumber != B_OK)
+  if (eArgState == ASE_LOOKING_FOR_DEST && pProfilePath != NULL &&
+  ErrorNumber == B_OK)
   {
-    DisplayErrorMessage (SourceName, ErrorNumber,
-      "ObfuscateFile: Unable to open file for reading");
-    return ErrorNumber;
+    ErrorNumber = ProfileOpenSinkDirectory (Profile, DestDir.Address ());
+    if (ErrorNumber == B_OK)
+      eArgState = ASE_DONE;
   }
 
-  BFile DestFile;
-  ErrorNumber = DestDir.CreateFile (DestName, &DestFile,
-    true /* fail if exists */);
-  if (ErrorNumber != B_OK)
+  if (eArgState == ASE_LOOKING_FOR_DEST && MemoryDest.Get () != NULL &&
+  ErrorNumber == B_OK)
   {
-    DisplayErrorMessage (DestName, ErrorNumber,
-      "ObfuscateFile: Unable to open file for writing");
-    return ErrorNumber;
+    ErrorNumber = MemoryDest->OpenSinkDirectory (DestDir.Address ());
+    if (ErrorNumber == B_OK)
+      eArgState = ASE_DONE;
   }
 
-  if (gVerboseLevel >= VERBOSE_FILE)
+  if (eArgState != ASE_DONE)
   {
-    printf ("%*sFile \"%s\" is being obfuscated into \"%s\".\n",
-      gIndentLevel, "", SourceName, DestName);
+    cerr << "Insufficient number of valid arguments provided.\n";
+    PrintUsage(cout);
+    ErrorNumber = -1;
   }
-
-  ErrorNumber = ObfuscateAttributes (SourceFile, DestFile);
-  if (ErrorNumber != B_OK)
+  else if (pProfilePath != NULL && OutputDirCount > 0)
   {
-    cerr << "Failed while obfuscating attributes of file \"" <<
-      SourceName << "\".\n";
-    return ErrorNumber;
+    cerr << "-profile only reads InputDir, it doesn't work with an "
+      "OutputDir.\n";
+    PrintUsage(cout);
+    ErrorNumber = -1;
   }
-
-  off_t FileDataSize = 0;
-  ErrorNumber = SourceFile.GetSize (&FileDataSize);
-  if (ErrorNumber != B_OK)
+  else if (MemoryDest.Get () != NULL &&
+  (OutputDirCount > 0 || pProfilePath != NULL))
   {
-    DisplayErrorMessage (SourceName, ErrorNumber,
-      "ObfuscateFile: Unable to get size of file");
-    return ErrorNumber;
+    cerr << "-memory replaces the OutputDir, it doesn't work with one or "
+      "with -profile.\n";
+    PrintUsage(cout);
+    ErrorNumber = -1;
   }
-
-  AutoIndentIncrement AutoIndentOneMore;
-
-  if (gVerboseLevel >= VERBOSE_DATA)
+  else if (WatchMode && (SourceDir.Get () == NULL || FanOut.Get () != NULL ||
+  MemoryDest.Get () != NULL || pProfilePath != NULL || pRecordPath != NULL ||
+  pReplayPath != NULL || pSynthesizePath != NULL))
+  {
+    cerr << "-watch needs one InputDir and one OutputDir, and doesn't work "
+      "with -memory, -profile, -record, -replay or -synthesize.\n";
+    ErrorNumber = -1;
+  }
+  else if (pRecordPath != NULL &&
+  ((ErrorNumber = Recorder.Open (pRecordPath)) != B_OK ||
+  (ErrorNumber = Recorder.WrapSinkDirectory (*DestDir,
+  RecordingDir.Address ())) != B_OK))
   {
-    printf ("%*sFile contents of length %d.\n", gIndentLevel, "",
-      (int) FileDataSize);
+    DisplayErrorMessage (pRecordPath, ErrorNumber,
+      "Main: Unable to start recording");
   }
-
-  if (FileDataSize > 0)
+  else
   {
-    if (FileDataSize > MAX_OBFUSCATE_BUFFER_SIZE)
+    ObfuscateSinkDirectory *pOutputDir = DestDir.Get ();
+    if (RecordingDir.Get () != NULL)
+      pOutputDir = RecordingDir.Get ();
+
+    TheObfuscator.SetVerboseLevel (VerboseLevel);
+    if (VerboseLevel > VERBOSE_NONE)
     {
-      if (gVerboseLevel >= VERBOSE_FILE)
-      {
-        printf ("%*sTruncating file \"%s\" size from %Ld down to %d.\n",
-          gIndentLevel, "", SourceName, FileDataSize,
-          MAX_OBFUSCATE_BUFFER_SIZE);
-      }
-      FileDataSize = MAX_OBFUSCATE_BUFFER_SIZE;
+      static const char* VerboseNames[VERBOSE_MAX] = {
+        "None", "Directory", "File", "Attribute", "Data", "Extreme Data"};
+      printf ("Starting obfuscation, verbosity level '%s'.\n",
+        VerboseNames[VerboseLevel]);
     }
+    if (pTracePath != NULL)
+      TraceStart ();
 
-    char *pFileData = new (std::nothrow) char [FileDataSize];
-    if (pFileData == NULL)
+    if (pReplayPath != NULL)
     {
-      ErrorNumber = B_NO_MEMORY;
-      sprintf (ErrorMessage,
-        "Unable to allocate memory for file \"%s\" data size %Ld",
-        SourceName, FileDataSize);
-      DisplayErrorMessage (ErrorMessage, ErrorNumber, "ObfuscateFile");
-      return ErrorNumber;
+      // The recording includes the finishing up of the destination.
+      long long int OperationCount = 0;
+      int64 StartTime = TraceNow ();
+      ErrorNumber = ReplayOperations (pReplayPath, *pOutputDir,
+        RealTimeReplay, &OperationCount);
+      printf ("Replayed %lld operations in %.3f seconds.\n", OperationCount,
+        (TraceNow () - StartTime) / 1e9);
     }
-
-    if (gVerboseLevel >= VERBOSE_DATA)
+    else
     {
-      ssize_t AmountRead = SourceFile.Read (pFileData, FileDataSize);
-      if (AmountRead == FileDataSize)
-      {
-        DumpBuffer (pFileData, FileDataSize);
-      }
+      // The mirror does the usual pass, remembering what it made.
+      if (WatchMode)
+        ErrorNumber = Mirror.Start (*SourceDir, *pOutputDir);
       else
+        ErrorNumber = TheObfuscator.ObfuscateDirectory (*SourceDir,
+          *pOutputDir);
+
+      if (IOPolicy.mSyncAtEnd && VerboseLevel > VERBOSE_NONE)
+        printf ("Syncing destination file system.\n");
+      status_t FinishErrorNumber = pOutputDir->Finish ();
+      if (FinishErrorNumber != B_OK)
       {
-        DisplayErrorMessage (SourceName, AmountRead,
-          "Unable to read file contents (nonfatal - don't need data)");
+        DisplayErrorMessage (pOutputDir->GetPath (), FinishErrorNumber,
+          "Main: Problems finishing up the destination");
+        if (ErrorNumber == B_OK)
+          ErrorNumber = FinishErrorNumber;
       }
-    }
-
-    ObfuscateBuffer(pFileData, FileDataSize);
 
-    ssize_t AmountWritten = DestFile.Write (pFileData, FileDataSize);
-    delete [] pFileData; // Get rid of buffer now, makes error handling easier.
-    if (AmountWritten != FileDataSize)
-    {
-      ErrorNumber = AmountWritten;
-      if (ErrorNumber >= 0)
-        ErrorNumber = B_IO_ERROR;
-      sprintf (ErrorMessage, "Only wrote %d bytes of %d for file \"%s\" data",
-        (int) AmountWritten, (int) FileDataSize, DestName);
-      DisplayErrorMessage (ErrorMessage, ErrorNumber, "ObfuscateFile");
-      return ErrorNumber;
-    }
-  }
-  return B_OK;
-}
-
-
-/******************************************************************************
- * Given an already existing source and destination directory, copy/obfuscate
- * all the files and directories within it.
- */
-
-static status_t ObfuscateDirectory (BDirectory &SourceDir, BDirectory &DestDir)
-{
-  status_t ErrorNumber = 0;
-
-  BPath DestPath (&DestDir, ".");
-  BPath SourcePath (&SourceDir, ".");
-
-  if (gVerboseLevel >= VERBOSE_DIR)
-  {
-    printf ("%*sDirectory \"%s\" is being obfuscated into \"%s\".\n",
-      gIndentLevel, "", SourcePath.Path(), DestPath.Path());
-  }
-
-  ErrorNumber = ObfuscateAttributes (SourceDir, DestDir);
-  if (ErrorNumber != B_OK)
-  {
-    cerr << "Failed while obfuscating attributes of directory \"" <<
-      SourcePath.Path() << "\".\n";
-    return ErrorNumber;
-  }
-
-  SourceDir.Rewind();
-
-  BEntry CurSourceEntry;
-  char CurDestName[B_FILE_NAME_LENGTH];
-  char CurSourceName[B_FILE_NAME_LENGTH];
-  struct stat CurSourceStat;
-
-  while (B_OK == (ErrorNumber = SourceDir.GetNextEntry(&CurSourceEntry)))
-  {
-    ErrorNumber = CurSourceEntry.GetName (CurSourceName);
-    if (ErrorNumber != B_OK)
-    {
-      DisplayErrorMessage (SourcePath.Path(), ErrorNumber,
-        "ObfuscateDirectory: Problems getting contained item name");
-      return ErrorNumber;
-    }
-
-    // Generate a new obfuscated name.  If it collides with existing obfuscated
-    // names, try a few other names.  Can happen with short names, indeed there
-    // are only 10 possible one letter names.  If there are too many
-    // collisions, try a longer name, though that breaks the obfuscation rules.
-
-    int GenerateNameRetryCount;
-    for (GenerateNameRetryCount = 0; GenerateNameRetryCount < 48;
-    GenerateNameRetryCount++)
-    {
-      int NewLength = strlen (CurSourceName) + (GenerateNameRetryCount >> 3);
-      if (NewLength >= B_FILE_NAME_LENGTH)
-        NewLength = B_FILE_NAME_LENGTH - 1;
-
-      ObfuscateBuffer (CurDestName, NewLength);
-      CurDestName[NewLength] = 0;
-
-      if (!DestDir.Contains(CurDestName))
-        break; // Doesn't contain the new name, safe to use it.
-
-      if (gVerboseLevel > VERBOSE_NONE)
+      if (WatchMode && ErrorNumber == B_OK)
       {
-        AutoIndentIncrement AutoIndentMore;
-
-        printf ("%*sName \"%s\" already exists in directory \"%s\", "
-          "will try another possibly longer name.\n", gIndentLevel, "",
-          CurDestName, DestPath.Path());
+        signal (SIGINT, StopSignalHandler);
+        signal (SIGTERM, StopSignalHandler);
+        printf ("Watching \"%s\" for changes, Control-C to stop.\n",
+          SourceDir->GetPath ());
+        fflush (stdout);
+        ErrorNumber = Mirror.Watch (&gStopRequested);
+        printf ("Stopped watching, mirrored %lld changes.\n",
+          Mirror.GetChangeCount ());
       }
     }
 
-    ErrorNumber = CurSourceEntry.GetStat(&CurSourceStat);
-    if (ErrorNumber != B_OK)
+    if (pProfilePath != NULL && Profile.mDirectoryCount > 0)
     {
-      DisplayErrorMessage (CurSourceName, ErrorNumber,
-        "ObfuscateDirectory: Problems reading entry status");
-      return ErrorNumber;
-    }
-
-    if (S_ISREG(CurSourceStat.st_mode))
-    {
-      ErrorNumber = ObfuscateFile (CurSourceEntry, DestDir, CurDestName);
-    }
-    else if (S_ISDIR(CurSourceStat.st_mode))
-    {
-      BDirectory SubDestDir;
-      ErrorNumber = DestDir.CreateDirectory (CurDestName, &SubDestDir);
-      if (ErrorNumber != B_OK)
+      status_t ProfileErrorNumber = Profile.Save (pProfilePath);
+      if (ProfileErrorNumber != B_OK)
       {
-        DisplayErrorMessage (CurDestName, ErrorNumber,
-          "ObfuscateDirectory: Failed to create destination directory");
-        // Fall through for directory level error message.
+        DisplayErrorMessage (pProfilePath, ProfileErrorNumber,
+          "Main: Unable to save the profile");
+        if (ErrorNumber == B_OK)
+          ErrorNumber = ProfileErrorNumber;
       }
       else
-      {
-        AutoIndentIncrement AutoIndenter;
-        BDirectory SubSourceDir (&CurSourceEntry);
-        ErrorNumber = ObfuscateDirectory (SubSourceDir, SubDestDir);
-      }
-    }
-    else if (S_ISLNK(CurSourceStat.st_mode))
-    {
-      if (gVerboseLevel >= VERBOSE_FILE)
-        printf ("%*sSymbolic link \"%s\" will be ignored.\n",
-          gIndentLevel, "", CurSourceName);
-    }
-    else
-    {
-      if (gVerboseLevel >= VERBOSE_FILE)
-        printf ("%*sHard link or other unknown file system entity "
-          "\"%s\" will be ignored.\n", gIndentLevel, "", CurSourceName);
+        printf ("Profiled %lld directories and %lld files into \"%s\".\n",
+          Profile.mDirectoryCount, Profile.mFileCount, pProfilePath);
     }
 
-    if (ErrorNumber != B_OK)
+    if (pRecordPath != NULL)
     {
-      cerr << "ObfuscateDirectory failed while converting item \"" <<
-        CurSourceName << "\" in directory \"" << SourcePath.Path() <<
-        "\" into item \"" << CurDestName << "\" in directory \"" <<
-        DestPath.Path() << "\".\n";
-      return ErrorNumber;
-    }
-  }
-
-  if (ErrorNumber == B_ENTRY_NOT_FOUND)
-    ErrorNumber = B_OK; // Reaching end of list isn't an error.
-  else
-  {
-    DisplayErrorMessage (SourcePath.Path(), ErrorNumber,
-      "ObfuscateDirectory: Problems reading directory entries");
-  }
-  return B_OK;
-}
-
-
-/******************************************************************************
- * Finally, the main program which drives it all.
- */
-
-int main (int argc, char** argv)
-{
-  BDirectory DestDir;
-  status_t ErrorNumber;
-  BDirectory SourceDir;
-
-  enum ArgStateEnum {ASE_LOOKING_FOR_SOURCE, ASE_LOOKING_FOR_DEST, ASE_DONE}
-    eArgState = ASE_LOOKING_FOR_SOURCE;
-
-  int iArg;
-  for (iArg = 1; iArg < argc; iArg++)
-  {
-    char ErrorMessage [1024];
-
-    if (strlen(argv[iArg]) > sizeof (ErrorMessage) - 100)
-      cerr << "Argument is too long, ignoring it: " << argv[iArg] << endl;
-    else if (strcmp(argv[iArg], "-v") == 0)
-      gVerboseLevel = VERBOSE_DIR;
-    else if (strcmp(argv[iArg], "-vv") == 0)
-      gVerboseLevel = VERBOSE_FILE;
-    else if (strcmp(argv[iArg], "-vvv") == 0)
-      gVerboseLevel = VERBOSE_ATTR;
-    else if (strcmp(argv[iArg], "-vvvv") == 0)
-      gVerboseLevel = VERBOSE_DATA;
-    else if (strcmp(argv[iArg], "-vvvvv") == 0)
-      gVerboseLevel = VERBOSE_EXTREME_DATA;
-    else if (eArgState == ASE_LOOKING_FOR_SOURCE)
-    {
-      ErrorNumber = SourceDir.SetTo(argv[iArg]);
-      if (ErrorNumber != B_OK)
+      status_t RecordErrorNumber = Recorder.Close ();
+      if (RecordErrorNumber != B_OK)
       {
-        sprintf(ErrorMessage,
-          "Unable to open source directory \"%s\"", argv[iArg]);
-        DisplayErrorMessage (ErrorMessage, ErrorNumber, "Main");
-        break;
+        DisplayErrorMessage (pRecordPath, RecordErrorNumber,
+          "Main: Unable to save the recording");
+        if (ErrorNumber == B_OK)
+          ErrorNumber = RecordErrorNumber;
       }
-      eArgState = ASE_LOOKING_FOR_DEST;
+      else if (VerboseLevel > VERBOSE_NONE)
+        printf ("Recorded %lld operations to \"%s\".\n",
+          Recorder.GetOperationCount (), pRecordPath);
     }
-    else if (eArgState == ASE_LOOKING_FOR_DEST)
+
+    if (MemoryDest.Get () != NULL)
     {
-      ErrorNumber = DestDir.SetTo(argv[iArg]);
-      if (ErrorNumber == B_ENTRY_NOT_FOUND)
-      {
-        ErrorNumber = create_directory(argv[iArg], 0777);
-        if (ErrorNumber == B_OK)
-        {
-          if (gVerboseLevel >= VERBOSE_DIR)
-            cout << "Created destination directory \"" << argv[iArg] << "\"\n";
-        }
-        else
-        {
-          sprintf(ErrorMessage,
-            "Unable to create destination directory \"%s\"", argv[iArg]);
-          DisplayErrorMessage (ErrorMessage, ErrorNumber, "Main");
-          break;
-        }
-        ErrorNumber = DestDir.SetTo(argv[iArg]);
-      }
-      if (ErrorNumber != B_OK)
-      {
-        sprintf(ErrorMessage,
-          "Unable to open destination directory \"%s\"", argv[iArg]);
-        DisplayErrorMessage (ErrorMessage, ErrorNumber, "Main");
-        break;
-      }
-      eArgState = ASE_DONE;
+      const MemoryTreeStatistics &Stats = MemoryDest->Statistics ();
+      printf ("In-memory destination has %lld directories, %lld files, "
+        "%lld attributes with %lld bytes of values, %lld bytes of file "
+        "contents.\n", Stats.mDirectoryCount, Stats.mFileCount,
+        Stats.mAttributeCount, Stats.mAttributeBytes, Stats.mDataBytes);
     }
-  }
 
-  if (eArgState != ASE_DONE)
-  {
-    cerr << "Insufficient number of valid arguments provided.\n";
-    PrintUsage(cout);
-    ErrorNumber = -1;
-  }
-  else
-  {
-    if (gVerboseLevel > VERBOSE_NONE)
+    if (pTracePath != NULL)
     {
-      static const char* VerboseNames[VERBOSE_MAX] = {
-        "None", "Directory", "File", "Attribute", "Data", "Extreme Data"};
-      printf ("Starting obfuscation, verbosity level '%s'.\n",
-        VerboseNames[gVerboseLevel]);
+      status_t TraceErrorNumber = TraceExportChromeJson (pTracePath);
+      if (TraceErrorNumber != B_OK)
+        DisplayErrorMessage (pTracePath, TraceErrorNumber,
+          "Main: Unable to save the trace");
+      else if (VerboseLevel > VERBOSE_NONE)
+        printf ("Saved trace to \"%s\".\n", pTracePath);
     }
-    ErrorNumber = ObfuscateDirectory (SourceDir, DestDir);
   }
 
-  if (gVerboseLevel > VERBOSE_NONE)
+  if (VerboseLevel > VERBOSE_NONE)
   {
     cerr << PROGRAM_NAME " finished, return code " << ErrorNumber << ".\n";
   }
@@ -0,0 +1,88 @@
+/******************************************************************************
+ * ObfuscatorPlatform.h
+ *
+ * Platform definitions for the obfuscator library.  On BeOS and Haiku these
+ * come from the system headers.  Elsewhere the few BeOS types, error codes and
+ * constants which the library uses are defined here, so that the core code can
+ * stay the same on all platforms.
+ *
+ * Error codes (status_t) are negative numbers, zero (B_OK) for success, same
+ * as on BeOS.  On POSIX systems they are the negated errno values.
+ */
+
+#ifndef OBFUSCATOR_PLATFORM_H
+#define OBFUSCATOR_PLATFORM_H
+
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+
+#if defined(__BEOS__) || defined(__HAIKU__)
+
+#define OBFUSCATOR_BEOS 1
+
+#include <ByteOrder.h>
+#include <Errors.h>
+#include <StorageDefs.h>
+#include <SupportDefs.h>
+#include <TypeConstants.h>
+#include <fs_attr.h>
+
+/* BeOS errno values are already negative status codes. */
+#define ERRNO_TO_STATUS(ErrnoValue) (ErrnoValue)
+#define STATUS_TO_ERRNO(StatusValue) (StatusValue)
+
+#else /* Not BeOS, assume POSIX. */
+
+#include <stdint.h>
+#include <limits.h>
+
+typedef int32_t status_t;
+typedef uint32_t uint32;
+typedef int32_t int32;
+typedef int64_t int64;
+typedef uint64_t uint64;
+
+#define ERRNO_TO_STATUS(ErrnoValue) (-(ErrnoValue))
+#define STATUS_TO_ERRNO(StatusValue) (-(StatusValue))
+
+#define B_OK 0
+#define B_ERROR (-1)
+#define B_NO_MEMORY ERRNO_TO_STATUS (ENOMEM)
+#define B_IO_ERROR ERRNO_TO_STATUS (EIO)
+#define B_BAD_VALUE ERRNO_TO_STATUS (EINVAL)
+#define B_ENTRY_NOT_FOUND ERRNO_TO_STATUS (ENOENT)
+#define B_FILE_EXISTS ERRNO_TO_STATUS (EEXIST)
+#define B_NAME_TOO_LONG ERRNO_TO_STATUS (ENAMETOOLONG)
+#define B_NOT_SUPPORTED ERRNO_TO_STATUS (EOPNOTSUPP)
+
+#define B_FILE_NAME_LENGTH 256
+#define B_ATTR_NAME_LENGTH 256
+
+/* Four character type codes, spelled out to avoid multi-character constant
+warnings. */
+
+#define B_RAW_TYPE 0x52415754 /* 'RAWT' */
+#define B_STRING_TYPE 0x43535452 /* 'CSTR' */
+#define B_MIME_STRING_TYPE 0x4D494D53 /* 'MIMS' */
+
+#define B_BENDIAN_TO_HOST_INT32(Value) BigEndianToHostInt32(Value)
+
+static inline uint32 BigEndianToHostInt32 (uint32 Value)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return Value;
+#else
+  return __builtin_bswap32 (Value);
+#endif
+}
+
+struct attr_info
+{
+  uint32 type;
+  off_t size;
+};
+
+#endif /* OBFUSCATOR_BEOS */
+
+#endif /* OBFUSCATOR_PLATFORM_H */
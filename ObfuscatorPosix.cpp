@@ -0,0 +1,564 @@
+/******************************************************************************
+ * ObfuscatorPosix.cpp
+ *
+ * Source and sink implementations for POSIX file systems with extended
+ * attributes, see ObfuscatorPosix.h.
+ */
+
+/* Standard C Library. */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+
+/* Standard C++ library. */
+
+#include <set>
+#include <string>
+
+/* This library's headers. */
+
+#include "ObfuscatorPosix.h"
+#include "ObfuscatorTrace.h"
+
+using namespace std;
+
+static const char XATTR_NAME_PREFIX[] = "user.";
+static const int XATTR_NAME_PREFIX_LENGTH = sizeof (XATTR_NAME_PREFIX) - 1;
+
+
+/******************************************************************************
+ * Source files and directories, reading attributes from an open file
+ * descriptor.  The attribute name list is read all at once when rewinding.
+ */
+
+template <class InterfaceClass>
+class PosixSourceNode : public InterfaceClass
+{
+public:
+  PosixSourceNode (int FileDescriptor, const string &Path,
+    const IOPolicyRecord &Policy)
+    : mFileDescriptor (FileDescriptor),
+      mPath (Path),
+      mPolicy (Policy),
+      mpAttrList (NULL),
+      mAttrListSize (0),
+      mAttrListPosition (0)
+  {
+  };
+
+  virtual ~PosixSourceNode ()
+  {
+    free (mpAttrList);
+    if (mFileDescriptor >= 0)
+      close (mFileDescriptor);
+  };
+
+  virtual const char * GetPath ()
+  {
+    return mPath.c_str ();
+  };
+
+  virtual status_t RewindAttrs ()
+  {
+    free (mpAttrList);
+    mpAttrList = NULL;
+    mAttrListSize = 0;
+    mAttrListPosition = 0;
+
+    // The list can grow between asking for its size and reading it, so retry.
+
+    TRACE_SPAN ("flistxattr");
+    while (true)
+    {
+      ssize_t ListSize = flistxattr (mFileDescriptor, NULL, 0);
+      if (ListSize < 0 && (errno == ENOTSUP || errno == EOPNOTSUPP))
+        return B_OK; // File system without attributes has none to list.
+      if (ListSize < 0)
+        return ERRNO_TO_STATUS (errno);
+      if (ListSize == 0)
+        return B_OK;
+
+      mpAttrList = (char *) malloc (ListSize);
+      if (mpAttrList == NULL)
+        return B_NO_MEMORY;
+
+      mAttrListSize = flistxattr (mFileDescriptor, mpAttrList, ListSize);
+      if (mAttrListSize >= 0)
+        return B_OK;
+
+      status_t ErrorNumber = ERRNO_TO_STATUS (errno);
+      free (mpAttrList);
+      mpAttrList = NULL;
+      mAttrListSize = 0;
+      if (ErrorNumber != ERRNO_TO_STATUS (ERANGE))
+        return ErrorNumber;
+    }
+  };
+
+  virtual status_t GetNextAttrName (char *pAttributeName)
+  {
+    while (mAttrListPosition < mAttrListSize)
+    {
+      const char *pListName = mpAttrList + mAttrListPosition;
+      size_t ListNameLength = strlen (pListName);
+      mAttrListPosition += ListNameLength + 1;
+
+      if (strncmp (pListName, XATTR_NAME_PREFIX, XATTR_NAME_PREFIX_LENGTH) != 0)
+        continue; // Skip security, system and trusted attributes.
+      if (ListNameLength - XATTR_NAME_PREFIX_LENGTH > B_ATTR_NAME_LENGTH)
+        continue; // Too long to be a BeOS style attribute name.
+
+      strcpy (pAttributeName, pListName + XATTR_NAME_PREFIX_LENGTH);
+      return B_OK;
+    }
+    return B_ENTRY_NOT_FOUND;
+  };
+
+  virtual status_t GetAttrInfo (const char *pAttributeName,
+    attr_info *pAttributeInfo)
+  {
+    TRACE_SPAN ("fgetxattr");
+    string FullName = string (XATTR_NAME_PREFIX) + pAttributeName;
+    ssize_t AttributeSize = fgetxattr (mFileDescriptor, FullName.c_str (),
+      NULL, 0);
+    if (AttributeSize < 0)
+      return ERRNO_TO_STATUS (errno);
+    pAttributeInfo->type = B_RAW_TYPE;
+    pAttributeInfo->size = AttributeSize;
+    return B_OK;
+  };
+
+  virtual ssize_t ReadAttr (const char *pAttributeName, uint32 /* Type */,
+    off_t Offset, void *pBuffer, size_t BufferSize)
+  {
+    if (Offset != 0)
+      return B_BAD_VALUE; // Extended attributes are read all at once.
+    TRACE_SPAN ("fgetxattr");
+    string FullName = string (XATTR_NAME_PREFIX) + pAttributeName;
+    ssize_t AmountRead = fgetxattr (mFileDescriptor, FullName.c_str (),
+      pBuffer, BufferSize);
+    if (AmountRead < 0)
+      return ERRNO_TO_STATUS (errno);
+    return AmountRead;
+  };
+
+protected:
+  int mFileDescriptor;
+  string mPath;
+  const IOPolicyRecord &mPolicy;
+  char *mpAttrList;
+  ssize_t mAttrListSize;
+  ssize_t mAttrListPosition;
+};
+
+
+class PosixSourceFile : public PosixSourceNode<ObfuscateSourceFile>
+{
+public:
+  PosixSourceFile (int FileDescriptor, const string &Path,
+    const IOPolicyRecord &Policy)
+    : PosixSourceNode<ObfuscateSourceFile> (FileDescriptor, Path, Policy)
+  {
+  };
+
+  virtual status_t GetSize (off_t *pSize)
+  {
+    TRACE_SPAN ("fstat");
+    struct stat FileStat;
+    if (fstat (mFileDescriptor, &FileStat) != 0)
+      return ERRNO_TO_STATUS (errno);
+    *pSize = FileStat.st_size;
+    return B_OK;
+  };
+
+  virtual ssize_t ReadData (char *pBuffer, off_t BufferSize)
+  {
+    return ReadFileData (mPolicy, mFileDescriptor, pBuffer, BufferSize);
+  };
+};
+
+
+class PosixSourceDirectory : public PosixSourceNode<ObfuscateSourceDirectory>
+{
+public:
+  PosixSourceDirectory (int FileDescriptor, const string &Path,
+    const IOPolicyRecord &Policy)
+    : PosixSourceNode<ObfuscateSourceDirectory> (FileDescriptor, Path, Policy),
+      mpDirStream (NULL)
+  {
+  };
+
+  virtual ~PosixSourceDirectory ()
+  {
+    if (mpDirStream != NULL)
+      closedir (mpDirStream);
+  };
+
+  virtual status_t Rewind ()
+  {
+    if (mpDirStream == NULL)
+    {
+      // The directory stream gets its own descriptor, since closedir closes
+      // it and the attribute code still needs the original.
+
+      int StreamDescriptor = dup (mFileDescriptor);
+      if (StreamDescriptor < 0)
+        return ERRNO_TO_STATUS (errno);
+      mpDirStream = fdopendir (StreamDescriptor);
+      if (mpDirStream == NULL)
+      {
+        status_t ErrorNumber = ERRNO_TO_STATUS (errno);
+        close (StreamDescriptor);
+        return ErrorNumber;
+      }
+    }
+    rewinddir (mpDirStream);
+    return B_OK;
+  };
+
+  virtual status_t GetNextEntry (char *pName, struct stat *pStat)
+  {
+    if (mpDirStream == NULL)
+    {
+      status_t ErrorNumber = Rewind ();
+      if (ErrorNumber != B_OK)
+        return ErrorNumber;
+    }
+
+    while (true)
+    {
+      TRACE_SPAN ("readdir");
+      errno = 0;
+      struct dirent *pEntry = readdir (mpDirStream);
+      if (pEntry == NULL)
+        return (errno == 0) ? B_ENTRY_NOT_FOUND : ERRNO_TO_STATUS (errno);
+
+      if (strcmp (pEntry->d_name, ".") == 0 ||
+      strcmp (pEntry->d_name, "..") == 0)
+        continue;
+      if (strlen (pEntry->d_name) >= B_FILE_NAME_LENGTH)
+        return B_NAME_TOO_LONG;
+
+      TRACE_SPAN ("fstatat");
+      if (fstatat (mFileDescriptor, pEntry->d_name, pStat,
+      AT_SYMLINK_NOFOLLOW) != 0)
+        return ERRNO_TO_STATUS (errno);
+      strcpy (pName, pEntry->d_name);
+      return B_OK;
+    }
+  };
+
+  virtual status_t OpenFile (const char *pName, ObfuscateSourceFile **ppFile)
+  {
+    TRACE_SPAN ("openat");
+    int FileDescriptor = openat (mFileDescriptor, pName,
+      O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (FileDescriptor < 0)
+      return ERRNO_TO_STATUS (errno);
+    *ppFile = new (std::nothrow) PosixSourceFile (FileDescriptor,
+      mPath + "/" + pName, mPolicy);
+    if (*ppFile == NULL)
+    {
+      close (FileDescriptor);
+      return B_NO_MEMORY;
+    }
+    return B_OK;
+  };
+
+  virtual status_t OpenDirectory (const char *pName,
+    ObfuscateSourceDirectory **ppDirectory)
+  {
+    TRACE_SPAN ("openat");
+    int FileDescriptor = openat (mFileDescriptor, pName,
+      O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (FileDescriptor < 0)
+      return ERRNO_TO_STATUS (errno);
+    *ppDirectory = new (std::nothrow) PosixSourceDirectory (FileDescriptor,
+      mPath + "/" + pName, mPolicy);
+    if (*ppDirectory == NULL)
+    {
+      close (FileDescriptor);
+      return B_NO_MEMORY;
+    }
+    return B_OK;
+  };
+
+private:
+  DIR *mpDirStream;
+};
+
+
+/******************************************************************************
+ * Sink files and directories, writing through an open file descriptor.
+ */
+
+template <class InterfaceClass>
+class PosixSinkNode : public InterfaceClass
+{
+public:
+  PosixSinkNode (int FileDescriptor, const string &Path,
+    const IOPolicyRecord &Policy)
+    : mFileDescriptor (FileDescriptor),
+      mPath (Path),
+      mPolicy (Policy)
+  {
+  };
+
+  virtual ~PosixSinkNode ()
+  {
+    if (mFileDescriptor >= 0)
+      close (mFileDescriptor);
+  };
+
+  virtual const char * GetPath ()
+  {
+    return mPath.c_str ();
+  };
+
+  virtual ssize_t WriteAttr (const char *pAttributeName, uint32 /* Type */,
+    off_t Offset, const void *pBuffer, size_t BufferSize)
+  {
+    if (Offset != 0)
+      return B_BAD_VALUE; // Extended attributes are written all at once.
+    TRACE_SPAN ("fsetxattr");
+    string FullName = string (XATTR_NAME_PREFIX) + pAttributeName;
+    if (fsetxattr (mFileDescriptor, FullName.c_str (), pBuffer, BufferSize,
+    0 /* create or replace */) != 0)
+      return ERRNO_TO_STATUS (errno);
+    return BufferSize;
+  };
+
+protected:
+  int mFileDescriptor;
+  string mPath;
+  const IOPolicyRecord &mPolicy;
+};
+
+
+class PosixSinkFile : public PosixSinkNode<ObfuscateSinkFile>
+{
+public:
+  PosixSinkFile (int FileDescriptor, const string &Path,
+    const IOPolicyRecord &Policy, CloneTemplateSet *pCloneTemplates)
+    : PosixSinkNode<ObfuscateSinkFile> (FileDescriptor, Path, Policy),
+      mpCloneTemplates (pCloneTemplates)
+  {
+  };
+
+  virtual char * AllocateDataBuffer (off_t DataSize)
+  {
+    return AllocateAlignedDataBuffer (mPolicy, DataSize);
+  };
+
+  virtual void FreeDataBuffer (char *pBuffer, off_t DataSize)
+  {
+    FreeAlignedDataBuffer (mPolicy, pBuffer, DataSize);
+  };
+
+  virtual ssize_t WriteData (const char *pBuffer, off_t DataSize)
+  {
+    return WriteFileData (mPolicy, mFileDescriptor, pBuffer, DataSize);
+  };
+
+  // The policy is looked at here rather than when the directory was opened,
+  // since the command line can turn on -reflink after naming the output.
+
+  virtual off_t GetCloneBlockSize ()
+  {
+    if (mpCloneTemplates == NULL || !mPolicy.mCloneFiller)
+      return 0;
+    return mpCloneTemplates->GetBlockSize ();
+  };
+
+  virtual status_t CloneZeroFill (off_t Length)
+  {
+    if (mpCloneTemplates == NULL || !mPolicy.mCloneFiller)
+      return B_NOT_SUPPORTED;
+    return mpCloneTemplates->CloneZeroFill (mFileDescriptor, Length);
+  };
+
+  virtual ssize_t WriteDataAt (off_t Offset, const char *pBuffer,
+    off_t DataSize)
+  {
+    return WriteFileData (mPolicy, mFileDescriptor, pBuffer, DataSize,
+      Offset);
+  };
+
+private:
+  CloneTemplateSet *mpCloneTemplates; // Not owned.
+};
+
+
+class PosixSinkDirectory : public PosixSinkNode<ObfuscateSinkDirectory>
+{
+public:
+  // The top level directory makes the clone template set and the
+  // subdirectories share it.  It doesn't make any files or even look at the
+  // file system until a file asks for cloning.
+
+  PosixSinkDirectory (int FileDescriptor, const string &Path,
+    const IOPolicyRecord &Policy, CloneTemplateSet *pCloneTemplates = NULL)
+    : PosixSinkNode<ObfuscateSinkDirectory> (FileDescriptor, Path, Policy),
+      mpCloneTemplates (pCloneTemplates),
+      mOwnsCloneTemplates (false)
+  {
+    if (mpCloneTemplates == NULL)
+    {
+      mpCloneTemplates = new (std::nothrow) CloneTemplateSet (FileDescriptor);
+      mOwnsCloneTemplates = true;
+    }
+  };
+
+  virtual ~PosixSinkDirectory ()
+  {
+    if (mOwnsCloneTemplates)
+      delete mpCloneTemplates;
+  };
+
+  virtual bool Contains (const char *pName)
+  {
+    TRACE_SPAN ("fstatat");
+    struct stat EntryStat;
+    return fstatat (mFileDescriptor, pName, &EntryStat,
+      AT_SYMLINK_NOFOLLOW) == 0;
+  };
+
+  virtual status_t GetEntryNames (set<string> &Names)
+  {
+    TRACE_SPAN ("readdir");
+    int StreamDescriptor = dup (mFileDescriptor);
+    if (StreamDescriptor < 0)
+      return ERRNO_TO_STATUS (errno);
+    DIR *pDirStream = fdopendir (StreamDescriptor);
+    if (pDirStream == NULL)
+    {
+      status_t ErrorNumber = ERRNO_TO_STATUS (errno);
+      close (StreamDescriptor);
+      return ErrorNumber;
+    }
+    rewinddir (pDirStream); // The duplicate shares the file position.
+
+    status_t ErrorNumber = B_OK;
+    while (true)
+    {
+      errno = 0;
+      struct dirent *pEntry = readdir (pDirStream);
+      if (pEntry == NULL)
+      {
+        if (errno != 0)
+          ErrorNumber = ERRNO_TO_STATUS (errno);
+        break;
+      }
+      if (strcmp (pEntry->d_name, ".") != 0 &&
+      strcmp (pEntry->d_name, "..") != 0)
+        Names.insert (pEntry->d_name);
+    }
+    closedir (pDirStream);
+    return ErrorNumber;
+  };
+
+  virtual status_t CreateFile (const char *pName, ObfuscateSinkFile **ppFile)
+  {
+    TRACE_SPAN ("openat create");
+    int FileDescriptor = openat (mFileDescriptor, pName,
+      O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (FileDescriptor < 0)
+      return ERRNO_TO_STATUS (errno);
+    *ppFile = new (std::nothrow) PosixSinkFile (FileDescriptor,
+      mPath + "/" + pName, mPolicy, mpCloneTemplates);
+    if (*ppFile == NULL)
+    {
+      close (FileDescriptor);
+      return B_NO_MEMORY;
+    }
+    return B_OK;
+  };
+
+  virtual status_t CreateDirectory (const char *pName,
+    ObfuscateSinkDirectory **ppDirectory)
+  {
+    TRACE_SPAN ("mkdirat");
+    if (mkdirat (mFileDescriptor, pName, 0777) != 0)
+      return ERRNO_TO_STATUS (errno);
+    int FileDescriptor = openat (mFileDescriptor, pName,
+      O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (FileDescriptor < 0)
+      return ERRNO_TO_STATUS (errno);
+    *ppDirectory = new (std::nothrow) PosixSinkDirectory (FileDescriptor,
+      mPath + "/" + pName, mPolicy, mpCloneTemplates);
+    if (*ppDirectory == NULL)
+    {
+      close (FileDescriptor);
+      return B_NO_MEMORY;
+    }
+    return B_OK;
+  };
+
+  virtual status_t Finish ()
+  {
+    if (!mPolicy.mSyncAtEnd)
+      return B_OK;
+    return SyncFileSystem (mPath.c_str ());
+  };
+
+private:
+  CloneTemplateSet *mpCloneTemplates;
+  bool mOwnsCloneTemplates;
+};
+
+
+/******************************************************************************
+ * Factory functions for the top level directories.
+ */
+
+status_t PosixOpenSourceDirectory (const char *pPath,
+  const IOPolicyRecord &Policy, ObfuscateSourceDirectory **ppDirectory)
+{
+  int FileDescriptor = open (pPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (FileDescriptor < 0)
+    return ERRNO_TO_STATUS (errno);
+  *ppDirectory = new (std::nothrow) PosixSourceDirectory (FileDescriptor,
+    pPath, Policy);
+  if (*ppDirectory == NULL)
+  {
+    close (FileDescriptor);
+    return B_NO_MEMORY;
+  }
+  return B_OK;
+}
+
+
+status_t PosixOpenSinkDirectory (const char *pPath,
+  const IOPolicyRecord &Policy, bool CreateIfMissing,
+  ObfuscateSinkDirectory **ppDirectory, bool *pCreated)
+{
+  if (pCreated != NULL)
+    *pCreated = false;
+
+  int FileDescriptor = open (pPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (FileDescriptor < 0 && errno == ENOENT && CreateIfMissing)
+  {
+    if (mkdir (pPath, 0777) != 0)
+      return ERRNO_TO_STATUS (errno);
+    if (pCreated != NULL)
+      *pCreated = true;
+    FileDescriptor = open (pPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  }
+  if (FileDescriptor < 0)
+    return ERRNO_TO_STATUS (errno);
+
+  *ppDirectory = new (std::nothrow) PosixSinkDirectory (FileDescriptor,
+    pPath, Policy);
+  if (*ppDirectory == NULL)
+  {
+    close (FileDescriptor);
+    return B_NO_MEMORY;
+  }
+  return B_OK;
+}
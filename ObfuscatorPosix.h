@@ -0,0 +1,28 @@
+/******************************************************************************
+ * ObfuscatorPosix.h
+ *
+ * Source and sink implementations for POSIX file systems, using file
+ * descriptors and Linux style extended attributes.  Only attributes in the
+ * "user." name space are copied, with that prefix removed from the attribute
+ * name.  Extended attributes don't have a type, so they are read as
+ * B_RAW_TYPE, and the type is ignored when writing.
+ */
+
+#ifndef OBFUSCATOR_POSIX_H
+#define OBFUSCATOR_POSIX_H
+
+#include "ObfuscatorInterfaces.h"
+#include "ObfuscatorIOPolicy.h"
+
+// Opens an existing directory for reading.  The policy needs to stay around
+// while the directory and things opened from it are in use.
+status_t PosixOpenSourceDirectory (const char *pPath,
+  const IOPolicyRecord &Policy, ObfuscateSourceDirectory **ppDirectory);
+
+// Opens a directory for writing, creating it first if it doesn't exist and
+// CreateIfMissing is true, in which case *pCreated gets set to true.
+status_t PosixOpenSinkDirectory (const char *pPath,
+  const IOPolicyRecord &Policy, bool CreateIfMissing,
+  ObfuscateSinkDirectory **ppDirectory, bool *pCreated = NULL);
+
+#endif /* OBFUSCATOR_POSIX_H */
@@ -0,0 +1,936 @@
+/******************************************************************************
+ * ObfuscatorProfile.cpp
+ *
+ * Tree profile histograms, the profiling sink and the synthetic source, see
+ * ObfuscatorProfile.h.
+ */
+
+/* Standard C Library. */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/* Standard C++ library. */
+
+#include <vector>
+
+/* This library's headers. */
+
+#include "ObfuscatorProfile.h"
+
+using namespace std;
+
+#define PROFILE_FILE_HEADER "ObfuscatorProfile 2"
+#define PROFILE_FILE_HEADER_VERSION_1 "ObfuscatorProfile 1" // Raw names.
+
+
+/******************************************************************************
+ * Histograms.
+ */
+
+static int LogarithmicBucket (long long int Value)
+{
+  int Bucket = 0;
+  while (Value > 0)
+  {
+    Bucket++;
+    Value >>= 1;
+  }
+  return Bucket;
+}
+
+
+void ProfileHistogram::Add (long long int Value, long long int Count)
+{
+  if (mLogarithmic)
+    Value = LogarithmicBucket (Value);
+  mCounts[Value] += Count;
+  mTotal += Count;
+}
+
+
+long long int ProfileHistogram::Count (long long int Value) const
+{
+  if (mLogarithmic)
+    Value = LogarithmicBucket (Value);
+  map<long long int, long long int>::const_iterator CountIter =
+    mCounts.find (Value);
+  if (CountIter == mCounts.end ())
+    return 0;
+  return CountIter->second;
+}
+
+
+long long int ProfileHistogram::Sample (double RandomFraction) const
+{
+  double Target = RandomFraction * mTotal;
+  map<long long int, long long int>::const_iterator CountIter;
+  for (CountIter = mCounts.begin (); CountIter != mCounts.end ();
+  CountIter++)
+  {
+    if (Target < CountIter->second)
+      break;
+    Target -= CountIter->second;
+  }
+  if (CountIter == mCounts.end ())
+  {
+    if (mCounts.empty ())
+      return 0;
+    CountIter--; // Rounding error at the very end.
+    Target = 0;
+  }
+
+  long long int Bucket = CountIter->first;
+  if (!mLogarithmic || Bucket <= 1)
+    return Bucket;
+
+  // Reuse the leftover fraction within the bucket to pick a value in it.
+  long long int Low = 1LL << (Bucket - 1);
+  double WithinBucket = Target / CountIter->second;
+  return Low + (long long int) (WithinBucket * Low);
+}
+
+
+void ProfileHistogram::Save (FILE *pFile) const
+{
+  fputs (mLogarithmic ? "log" : "exact", pFile);
+  map<long long int, long long int>::const_iterator CountIter;
+  for (CountIter = mCounts.begin (); CountIter != mCounts.end ();
+  CountIter++)
+    fprintf (pFile, " %lld:%lld", CountIter->first, CountIter->second);
+  fputc ('\n', pFile);
+}
+
+
+status_t ProfileHistogram::Load (const char *pText)
+{
+  while (*pText == ' ')
+    pText++;
+  if (strncmp (pText, "log", 3) == 0)
+  {
+    mLogarithmic = true;
+    pText += 3;
+  }
+  else if (strncmp (pText, "exact", 5) == 0)
+  {
+    mLogarithmic = false;
+    pText += 5;
+  }
+  else
+    return B_BAD_VALUE;
+
+  mCounts.clear ();
+  mTotal = 0;
+  while (*pText != 0)
+  {
+    char *pEnd;
+    long long int Bucket = strtoll (pText, &pEnd, 10);
+    if (pEnd == pText)
+      break; // End of line.
+    if (*pEnd != ':')
+      return B_BAD_VALUE;
+    pText = pEnd + 1;
+    long long int Count = strtoll (pText, &pEnd, 10);
+    if (pEnd == pText || Count < 0 || Bucket < 0 ||
+    (mLogarithmic && Bucket > 62))
+      return B_BAD_VALUE;
+    pText = pEnd;
+    mCounts[Bucket] += Count;
+    mTotal += Count;
+  }
+  return B_OK;
+}
+
+
+/******************************************************************************
+ * The profile as a whole.
+ */
+
+TreeProfile::TreeProfile ()
+  : mDirectoryCount (0),
+    mFileCount (0),
+    mFileSizes (true)
+{
+}
+
+
+void TreeProfile::AddEntry (bool IsDirectory, int Depth, int NameLength)
+{
+  if (IsDirectory)
+  {
+    mDirectoryCount++;
+    mDirectoryDepths.Add (Depth);
+  }
+  else
+  {
+    mFileCount++;
+    mFileDepths.Add (Depth);
+  }
+  if (Depth > 0)
+    mNameLengths.Add (NameLength);
+}
+
+
+void TreeProfile::AddAttribute (bool IsDirectory, const char *pAttributeName,
+  uint32 Type, off_t Size)
+{
+  ProfileAttribute &Attribute =
+    mAttributes[make_pair (Type, string (pAttributeName))];
+  if (IsDirectory)
+    Attribute.mDirectoryCount++;
+  else
+    Attribute.mFileCount++;
+  Attribute.mSizes.Add (Size);
+}
+
+
+/******************************************************************************
+ * Attribute names are saved with %XX escapes for '%', spaces, control
+ * characters and DEL, so a name is always one word on its line no matter
+ * what's in it.  Other bytes, including UTF-8, are left as they are so the
+ * file stays readable.
+ */
+
+static void SaveAttributeName (FILE *pFile, const string &Name)
+{
+  for (size_t i = 0; i < Name.size (); i++)
+  {
+    unsigned char Letter = Name[i];
+    if (Letter <= ' ' || Letter == '%' || Letter == 0x7F)
+      fprintf (pFile, "%%%02X", Letter);
+    else
+      fputc (Letter, pFile);
+  }
+}
+
+
+static status_t LoadAttributeName (const char *pText, string &Name)
+{
+  Name.clear ();
+  while (*pText != 0)
+  {
+    if (*pText != '%')
+    {
+      Name += *pText++;
+      continue;
+    }
+    unsigned int Letter;
+    if (!isxdigit ((unsigned char) pText[1]) ||
+    !isxdigit ((unsigned char) pText[2]) ||
+    sscanf (pText + 1, "%2x", &Letter) != 1 || Letter == 0)
+      return B_BAD_VALUE;
+    Name += (char) Letter;
+    pText += 3;
+  }
+  return B_OK;
+}
+
+
+status_t TreeProfile::Save (const char *pPath) const
+{
+  FILE *pFile = fopen (pPath, "w");
+  if (pFile == NULL)
+    return ERRNO_TO_STATUS (errno);
+
+  fprintf (pFile, PROFILE_FILE_HEADER "\n");
+  fprintf (pFile, "directories %lld\n", mDirectoryCount);
+  fprintf (pFile, "files %lld\n", mFileCount);
+  fputs ("fanout ", pFile);
+  mFanOut.Save (pFile);
+  fputs ("directorydepth ", pFile);
+  mDirectoryDepths.Save (pFile);
+  fputs ("filedepth ", pFile);
+  mFileDepths.Save (pFile);
+  fputs ("namelength ", pFile);
+  mNameLengths.Save (pFile);
+  fputs ("filesize ", pFile);
+  mFileSizes.Save (pFile);
+
+  ProfileAttributeMap::const_iterator AttrIter;
+  for (AttrIter = mAttributes.begin (); AttrIter != mAttributes.end ();
+  AttrIter++)
+  {
+    fprintf (pFile, "attribute %08X %lld %lld ",
+      (unsigned int) AttrIter->first.first, AttrIter->second.mFileCount,
+      AttrIter->second.mDirectoryCount);
+    SaveAttributeName (pFile, AttrIter->first.second);
+    fputc ('\n', pFile);
+    fputs ("attributesize ", pFile);
+    AttrIter->second.mSizes.Save (pFile);
+  }
+
+  if (ferror (pFile))
+  {
+    fclose (pFile);
+    return B_IO_ERROR;
+  }
+  if (fclose (pFile) != 0)
+    return ERRNO_TO_STATUS (errno);
+  return B_OK;
+}
+
+
+// Reads a line of any length, without the end of line character.  Returns
+// false at the end of the file.
+
+static bool ReadProfileLine (FILE *pFile, string &Line)
+{
+  Line.clear ();
+  int Letter;
+  while ((Letter = getc (pFile)) != EOF && Letter != '\n')
+    Line += (char) Letter;
+  return Letter != EOF || !Line.empty ();
+}
+
+
+status_t TreeProfile::Load (const char *pPath)
+{
+  FILE *pFile = fopen (pPath, "r");
+  if (pFile == NULL)
+    return ERRNO_TO_STATUS (errno);
+
+  *this = TreeProfile ();
+  status_t ErrorNumber = B_OK;
+  string Line;
+  bool EscapedNames = true;
+  if (!ReadProfileLine (pFile, Line))
+    ErrorNumber = B_BAD_VALUE;
+  else if (Line == PROFILE_FILE_HEADER_VERSION_1)
+    EscapedNames = false;
+  else if (Line != PROFILE_FILE_HEADER)
+    ErrorNumber = B_BAD_VALUE;
+
+  ProfileAttribute *pLastAttribute = NULL;
+  while (ErrorNumber == B_OK && ReadProfileLine (pFile, Line))
+  {
+    const char *pText = Line.c_str ();
+    const char *pValue = strchr (pText, ' ');
+    if (pValue == NULL)
+    {
+      if (Line.empty ())
+        continue;
+      ErrorNumber = B_BAD_VALUE;
+      break;
+    }
+    string Keyword (pText, pValue - pText);
+    pValue++;
+
+    if (Keyword == "directories")
+      mDirectoryCount = atoll (pValue);
+    else if (Keyword == "files")
+      mFileCount = atoll (pValue);
+    else if (Keyword == "fanout")
+      ErrorNumber = mFanOut.Load (pValue);
+    else if (Keyword == "directorydepth")
+      ErrorNumber = mDirectoryDepths.Load (pValue);
+    else if (Keyword == "filedepth")
+      ErrorNumber = mFileDepths.Load (pValue);
+    else if (Keyword == "namelength")
+      ErrorNumber = mNameLengths.Load (pValue);
+    else if (Keyword == "filesize")
+      ErrorNumber = mFileSizes.Load (pValue);
+    else if (Keyword == "attribute")
+    {
+      unsigned int Type;
+      long long int FileCount, DirectoryCount;
+      int NameOffset = 0;
+      string Name;
+      if (sscanf (pValue, "%x %lld %lld%n", &Type, &FileCount,
+      &DirectoryCount, &NameOffset) < 3 || pValue[NameOffset] != ' ')
+        ErrorNumber = B_BAD_VALUE;
+      else if (EscapedNames)
+        ErrorNumber = LoadAttributeName (pValue + NameOffset + 1, Name);
+      else
+        Name = pValue + NameOffset + 1;
+      if (ErrorNumber == B_OK &&
+      (Name.empty () || Name.size () > B_ATTR_NAME_LENGTH))
+        ErrorNumber = B_BAD_VALUE;
+      if (ErrorNumber == B_OK)
+      {
+        pLastAttribute = &mAttributes[make_pair ((uint32) Type, Name)];
+        pLastAttribute->mFileCount = FileCount;
+        pLastAttribute->mDirectoryCount = DirectoryCount;
+      }
+    }
+    else if (Keyword == "attributesize" && pLastAttribute != NULL)
+      ErrorNumber = pLastAttribute->mSizes.Load (pValue);
+    else
+      ErrorNumber = B_BAD_VALUE;
+  }
+
+  if (ErrorNumber == B_OK && ferror (pFile))
+    ErrorNumber = B_IO_ERROR;
+  fclose (pFile);
+  return ErrorNumber;
+}
+
+
+/******************************************************************************
+ * Profiling sink objects.  Files add their size to the profile when they are
+ * deleted, directories their fan-out, or when finished for the top level one
+ * since that doesn't get deleted until after the profile has been saved.
+ */
+
+template <class InterfaceClass>
+class ProfileSinkNode : public InterfaceClass
+{
+public:
+  ProfileSinkNode (TreeProfile &Profile, bool IsDirectory, int Depth,
+    const string &Path)
+    : mProfile (Profile),
+      mIsDirectory (IsDirectory),
+      mDepth (Depth),
+      mPath (Path)
+  {
+  };
+
+  virtual const char * GetPath ()
+  {
+    return mPath.c_str ();
+  };
+
+  virtual ssize_t WriteAttr (const char *pAttributeName, uint32 Type,
+    off_t Offset, const void * /* pBuffer */, size_t BufferSize)
+  {
+    if (Offset != 0)
+      return B_BAD_VALUE; // Only whole attributes are written.
+    mProfile.AddAttribute (mIsDirectory, pAttributeName, Type, BufferSize);
+    return BufferSize;
+  };
+
+protected:
+  TreeProfile &mProfile;
+  bool mIsDirectory;
+  int mDepth;
+  string mPath;
+};
+
+
+class ProfileSinkFile : public ProfileSinkNode<ObfuscateSinkFile>
+{
+public:
+  ProfileSinkFile (TreeProfile &Profile, int Depth, const string &Path)
+    : ProfileSinkNode<ObfuscateSinkFile> (Profile, false, Depth, Path),
+      mDataSize (0)
+  {
+  };
+
+  virtual ~ProfileSinkFile ()
+  {
+    mProfile.mFileSizes.Add (mDataSize);
+  };
+
+  virtual ssize_t WriteData (const char * /* pBuffer */, off_t DataSize)
+  {
+    mDataSize = DataSize;
+    return DataSize;
+  };
+
+  // Pretending to clone with single byte blocks means the obfuscator only
+  // makes the tail of big files, rather than filling a huge buffer.
+
+  virtual off_t GetCloneBlockSize () { return 1; };
+
+  virtual status_t CloneZeroFill (off_t Length)
+  {
+    mDataSize = Length;
+    return B_OK;
+  };
+
+  virtual ssize_t WriteDataAt (off_t Offset, const char * /* pBuffer */,
+    off_t DataSize)
+  {
+    if (Offset + DataSize > mDataSize)
+      mDataSize = Offset + DataSize;
+    return DataSize;
+  };
+
+private:
+  off_t mDataSize;
+};
+
+
+class ProfileSinkDirectory : public ProfileSinkNode<ObfuscateSinkDirectory>
+{
+public:
+  ProfileSinkDirectory (TreeProfile &Profile, int Depth, const string &Path)
+    : ProfileSinkNode<ObfuscateSinkDirectory> (Profile, true, Depth, Path),
+      mEntryCount (0),
+      mFanOutAdded (false)
+  {
+  };
+
+  virtual ~ProfileSinkDirectory ()
+  {
+    AddFanOut ();
+  };
+
+  virtual bool Contains (const char * /* pName */)
+  {
+    return false; // Names are all made up by the obfuscator anyway.
+  };
+
+  virtual status_t GetEntryNames (set<string> & /* Names */)
+  {
+    return B_OK; // Same as Contains, never anything there.
+  };
+
+  virtual status_t CreateFile (const char *pName, ObfuscateSinkFile **ppFile)
+  {
+    *ppFile = new (std::nothrow) ProfileSinkFile (mProfile, mDepth + 1,
+      mPath + "/" + pName);
+    if (*ppFile == NULL)
+      return B_NO_MEMORY;
+    mProfile.AddEntry (false, mDepth + 1, strlen (pName));
+    mEntryCount++;
+    return B_OK;
+  };
+
+  virtual status_t CreateDirectory (const char *pName,
+    ObfuscateSinkDirectory **ppDirectory)
+  {
+    *ppDirectory = new (std::nothrow) ProfileSinkDirectory (mProfile,
+      mDepth + 1, mPath + "/" + pName);
+    if (*ppDirectory == NULL)
+      return B_NO_MEMORY;
+    mProfile.AddEntry (true, mDepth + 1, strlen (pName));
+    mEntryCount++;
+    return B_OK;
+  };
+
+  virtual status_t Finish ()
+  {
+    AddFanOut ();
+    return B_OK;
+  };
+
+private:
+  void AddFanOut ()
+  {
+    if (!mFanOutAdded)
+      mProfile.mFanOut.Add (mEntryCount);
+    mFanOutAdded = true;
+  };
+
+  long long int mEntryCount;
+  bool mFanOutAdded;
+};
+
+
+status_t ProfileOpenSinkDirectory (TreeProfile &Profile,
+  ObfuscateSinkDirectory **ppDirectory)
+{
+  *ppDirectory = new (std::nothrow) ProfileSinkDirectory (Profile, 0,
+    "(profile)");
+  if (*ppDirectory == NULL)
+    return B_NO_MEMORY;
+  Profile.AddEntry (true, 0, 0);
+  return B_OK;
+}
+
+
+/******************************************************************************
+ * Random numbers for the synthetic source, using SplitMix64 so that the same
+ * seed gives the same tree everywhere, unlike the standard library ones.
+ */
+
+static uint64 RandomNumber (uint64 &State)
+{
+  uint64 Result = (State += 0x9E3779B97F4A7C15ULL);
+  Result = (Result ^ (Result >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  Result = (Result ^ (Result >> 27)) * 0x94D049BB133111EBULL;
+  return Result ^ (Result >> 31);
+}
+
+
+// From 0 up to but not including 1.
+static double RandomFraction (uint64 &State)
+{
+  return (RandomNumber (State) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+/******************************************************************************
+ * Synthetic source objects.  Each node gets a seed from its parent, which
+ * determines its attributes and, for directories, its entries.
+ *
+ * Sampling each directory's fan-out independently tends to either die out or
+ * run away, so the tree is built to the profile's counts of files and
+ * directories at each depth instead.  A directory reserves a number of
+ * entries at the next depth, sampled from the fan-out histogram scaled to the
+ * average needed at that depth, and the last directory at a depth to do so
+ * gets whatever is left.  Each entry is then a file or directory in proportion
+ * to how many of each are left at that depth.
+ */
+
+struct SyntheticDepthRecord
+{
+  long long int mDirectoriesLeft; // Not yet made, at this depth.
+  long long int mFilesLeft;
+  long long int mUnreservedEntries; // Not yet reserved by a parent.
+  long long int mUnexpandedDirectories; // Haven't reserved their entries yet.
+  double mAverageFanOut; // Of the directories one level up.
+};
+
+
+struct SyntheticTreeState
+{
+  SyntheticTreeState (const TreeProfile &Profile)
+    : mProfile (Profile),
+      mGlobalAverageFanOut (0)
+  {
+    if (Profile.mDirectoryCount > 0)
+      mGlobalAverageFanOut = (Profile.mDirectoryCount - 1 +
+        Profile.mFileCount) / (double) Profile.mDirectoryCount;
+
+    for (int Depth = 0; ; Depth++)
+    {
+      SyntheticDepthRecord Record;
+      Record.mDirectoriesLeft = Profile.mDirectoryDepths.Count (Depth);
+      Record.mFilesLeft = Profile.mFileDepths.Count (Depth);
+      if (Record.mDirectoriesLeft + Record.mFilesLeft <= 0)
+        break;
+      Record.mUnreservedEntries = Record.mDirectoriesLeft + Record.mFilesLeft;
+      Record.mUnexpandedDirectories = Record.mDirectoriesLeft;
+      Record.mAverageFanOut = 0;
+      if (Depth > 0 && mDepths[Depth - 1].mDirectoriesLeft > 0)
+        Record.mAverageFanOut = Record.mUnreservedEntries /
+          (double) mDepths[Depth - 1].mDirectoriesLeft;
+      mDepths.push_back (Record);
+    }
+    if (mDepths.empty ())
+      mDepths.push_back (SyntheticDepthRecord ());
+    mDepths[0].mUnreservedEntries = 0; // Top level is already there.
+  };
+
+  // Returns NULL if there is nothing at that depth.
+  SyntheticDepthRecord * Depth (int Depth)
+  {
+    if (Depth < 0 || Depth >= (int) mDepths.size ())
+      return NULL;
+    return &mDepths[Depth];
+  };
+
+  const TreeProfile &mProfile;
+  double mGlobalAverageFanOut;
+  vector<SyntheticDepthRecord> mDepths;
+};
+
+
+struct SyntheticAttribute
+{
+  const string *mpName;
+  uint32 mType;
+  off_t mSize;
+};
+
+
+template <class InterfaceClass>
+class SyntheticSourceNode : public InterfaceClass
+{
+public:
+  SyntheticSourceNode (SyntheticTreeState &State, bool IsDirectory,
+    uint64 Seed, const string &Path)
+    : mState (State),
+      mPath (Path),
+      mAttrIndex (0)
+  {
+    const TreeProfile &Profile = mState.mProfile;
+    long long int NodeCount =
+      IsDirectory ? Profile.mDirectoryCount : Profile.mFileCount;
+    uint64 RandomState = Seed ^ 0xA77B5A7EULL;
+
+    ProfileAttributeMap::const_iterator AttrIter;
+    for (AttrIter = Profile.mAttributes.begin ();
+    AttrIter != Profile.mAttributes.end (); AttrIter++)
+    {
+      long long int HaveCount = IsDirectory ?
+        AttrIter->second.mDirectoryCount : AttrIter->second.mFileCount;
+      if (NodeCount <= 0 ||
+      RandomFraction (RandomState) * NodeCount >= HaveCount)
+        continue;
+      SyntheticAttribute Attribute;
+      Attribute.mpName = &AttrIter->first.second;
+      Attribute.mType = AttrIter->first.first;
+      Attribute.mSize =
+        AttrIter->second.mSizes.Sample (RandomFraction (RandomState));
+      mAttributes.push_back (Attribute);
+    }
+  };
+
+  virtual const char * GetPath ()
+  {
+    return mPath.c_str ();
+  };
+
+  virtual status_t RewindAttrs ()
+  {
+    mAttrIndex = 0;
+    return B_OK;
+  };
+
+  virtual status_t GetNextAttrName (char *pAttributeName)
+  {
+    if (mAttrIndex >= mAttributes.size ())
+      return B_ENTRY_NOT_FOUND;
+    strcpy (pAttributeName, mAttributes[mAttrIndex++].mpName->c_str ());
+    return B_OK;
+  };
+
+  virtual status_t GetAttrInfo (const char *pAttributeName,
+    attr_info *pAttributeInfo)
+  {
+    const SyntheticAttribute *pAttribute = FindAttribute (pAttributeName);
+    if (pAttribute == NULL)
+      return B_ENTRY_NOT_FOUND;
+    pAttributeInfo->type = pAttribute->mType;
+    pAttributeInfo->size = pAttribute->mSize;
+    return B_OK;
+  };
+
+  virtual ssize_t ReadAttr (const char *pAttributeName, uint32 /* Type */,
+    off_t Offset, void *pBuffer, size_t BufferSize)
+  {
+    const SyntheticAttribute *pAttribute = FindAttribute (pAttributeName);
+    if (pAttribute == NULL)
+      return B_ENTRY_NOT_FOUND;
+    if (Offset >= pAttribute->mSize)
+      return 0;
+    if ((off_t) BufferSize > pAttribute->mSize - Offset)
+      BufferSize = pAttribute->mSize - Offset;
+    memset (pBuffer, 0, BufferSize);
+    return BufferSize;
+  };
+
+protected:
+  const SyntheticAttribute * FindAttribute (const char *pAttributeName)
+  {
+    for (size_t iAttr = 0; iAttr < mAttributes.size (); iAttr++)
+    {
+      if (*mAttributes[iAttr].mpName == pAttributeName)
+        return &mAttributes[iAttr];
+    }
+    return NULL;
+  };
+
+  SyntheticTreeState &mState;
+  string mPath;
+  vector<SyntheticAttribute> mAttributes;
+  size_t mAttrIndex;
+};
+
+
+class SyntheticSourceFile : public SyntheticSourceNode<ObfuscateSourceFile>
+{
+public:
+  SyntheticSourceFile (SyntheticTreeState &State, uint64 Seed, off_t Size,
+    const string &Path)
+    : SyntheticSourceNode<ObfuscateSourceFile> (State, false, Seed, Path),
+      mSize (Size)
+  {
+  };
+
+  virtual status_t GetSize (off_t *pSize)
+  {
+    *pSize = mSize;
+    return B_OK;
+  };
+
+  virtual ssize_t ReadData (char *pBuffer, off_t BufferSize)
+  {
+    if (BufferSize > mSize)
+      BufferSize = mSize;
+    memset (pBuffer, 0, BufferSize);
+    return BufferSize;
+  };
+
+private:
+  off_t mSize;
+};
+
+
+class SyntheticSourceDirectory :
+  public SyntheticSourceNode<ObfuscateSourceDirectory>
+{
+public:
+  SyntheticSourceDirectory (SyntheticTreeState &State, uint64 Seed, int Depth,
+    const string &Path)
+    : SyntheticSourceNode<ObfuscateSourceDirectory> (State, true, Seed, Path),
+      mSeed (Seed),
+      mDepth (Depth),
+      mReservedEntries (0),
+      mDirectoriesMade (0),
+      mFilesMade (0),
+      mExpanded (false)
+  {
+    Rewind ();
+  };
+
+  virtual status_t Rewind ()
+  {
+    SyntheticDepthRecord *pThisDepth = mState.Depth (mDepth);
+    SyntheticDepthRecord *pBelow = mState.Depth (mDepth + 1);
+
+    // Give back this directory's share, since the same entries will be
+    // reserved and made again.
+
+    if (mExpanded && pBelow != NULL)
+    {
+      pThisDepth->mUnexpandedDirectories++;
+      pBelow->mUnreservedEntries += mReservedEntries;
+      pBelow->mDirectoriesLeft += mDirectoriesMade;
+      pBelow->mFilesLeft += mFilesMade;
+    }
+    mReservedEntries = mDirectoriesMade = mFilesMade = 0;
+    mExpanded = true;
+    mRandomState = mSeed;
+    mCurrentName.clear ();
+    mCurrentIsDirectory = false;
+    if (pBelow == NULL)
+      return B_OK;
+
+    if (pThisDepth->mUnexpandedDirectories <= 1)
+      mReservedEntries = pBelow->mUnreservedEntries;
+    else
+    {
+      double FanOut = mState.mProfile.mFanOut.Sample (
+        RandomFraction (mRandomState));
+      if (mState.mGlobalAverageFanOut > 0)
+        FanOut *= pBelow->mAverageFanOut / mState.mGlobalAverageFanOut;
+      mReservedEntries = (long long int) (FanOut +
+        RandomFraction (mRandomState));
+      if (mReservedEntries > pBelow->mUnreservedEntries)
+        mReservedEntries = pBelow->mUnreservedEntries;
+    }
+    if (pThisDepth->mUnexpandedDirectories > 0)
+      pThisDepth->mUnexpandedDirectories--;
+    pBelow->mUnreservedEntries -= mReservedEntries;
+    return B_OK;
+  };
+
+  virtual status_t GetNextEntry (char *pName, struct stat *pStat)
+  {
+    const TreeProfile &Profile = mState.mProfile;
+    SyntheticDepthRecord *pBelow = mState.Depth (mDepth + 1);
+    if (pBelow == NULL ||
+    mDirectoriesMade + mFilesMade >= mReservedEntries ||
+    pBelow->mDirectoriesLeft + pBelow->mFilesLeft <= 0)
+      return B_ENTRY_NOT_FOUND;
+
+    mCurrentIsDirectory = RandomFraction (mRandomState) *
+      (pBelow->mDirectoriesLeft + pBelow->mFilesLeft) <
+      pBelow->mDirectoriesLeft;
+
+    int NameLength =
+      Profile.mNameLengths.Sample (RandomFraction (mRandomState));
+    if (NameLength < 1)
+      NameLength = 1;
+    if (NameLength >= B_FILE_NAME_LENGTH)
+      NameLength = B_FILE_NAME_LENGTH - 1;
+    for (int iLetter = 0; iLetter < NameLength; iLetter++)
+      pName[iLetter] = 'a' + RandomNumber (mRandomState) % 26;
+    pName[NameLength] = 0;
+
+    mCurrentName = pName;
+    mCurrentSeed = RandomNumber (mRandomState);
+    mCurrentSize = 0;
+
+    memset (pStat, 0, sizeof (*pStat));
+    if (mCurrentIsDirectory)
+    {
+      pStat->st_mode = S_IFDIR | 0755;
+      pBelow->mDirectoriesLeft--;
+      mDirectoriesMade++;
+    }
+    else
+    {
+      mCurrentSize = Profile.mFileSizes.Sample (RandomFraction (mRandomState));
+      pStat->st_mode = S_IFREG | 0644;
+      pStat->st_size = mCurrentSize;
+      pBelow->mFilesLeft--;
+      mFilesMade++;
+    }
+    return B_OK;
+  };
+
+  // Only the entry most recently returned by GetNextEntry can be opened,
+  // which is all the obfuscator needs.
+
+  virtual status_t OpenFile (const char *pName, ObfuscateSourceFile **ppFile)
+  {
+    if (mCurrentIsDirectory || mCurrentName != pName)
+      return B_ENTRY_NOT_FOUND;
+    *ppFile = new (std::nothrow) SyntheticSourceFile (mState, mCurrentSeed,
+      mCurrentSize, mPath + "/" + pName);
+    if (*ppFile == NULL)
+      return B_NO_MEMORY;
+    return B_OK;
+  };
+
+  virtual status_t OpenDirectory (const char *pName,
+    ObfuscateSourceDirectory **ppDirectory)
+  {
+    if (!mCurrentIsDirectory || mCurrentName != pName)
+      return B_ENTRY_NOT_FOUND;
+    *ppDirectory = new (std::nothrow) SyntheticSourceDirectory (mState,
+      mCurrentSeed, mDepth + 1, mPath + "/" + pName);
+    if (*ppDirectory == NULL)
+      return B_NO_MEMORY;
+    return B_OK;
+  };
+
+private:
+  uint64 mSeed;
+  int mDepth;
+  uint64 mRandomState;
+  long long int mReservedEntries;
+  long long int mDirectoriesMade;
+  long long int mFilesMade;
+  bool mExpanded;
+  string mCurrentName;
+  bool mCurrentIsDirectory;
+  uint64 mCurrentSeed;
+  off_t mCurrentSize;
+};
+
+
+/******************************************************************************
+ * The top level synthetic directory owns the shared state.
+ */
+
+class SyntheticRootDirectory : public SyntheticSourceDirectory
+{
+public:
+  SyntheticRootDirectory (uint64 Seed, SyntheticTreeState *pState)
+    : SyntheticSourceDirectory (*pState, Seed, 0, "(synthetic)"),
+      mpOwnedState (pState)
+  {
+  };
+
+  virtual ~SyntheticRootDirectory ()
+  {
+    delete mpOwnedState;
+  };
+
+private:
+  SyntheticTreeState *mpOwnedState;
+};
+
+
+status_t SyntheticOpenSourceDirectory (const TreeProfile &Profile,
+  uint64 Seed, ObfuscateSourceDirectory **ppDirectory)
+{
+  SyntheticTreeState *pState = new (std::nothrow) SyntheticTreeState (Profile);
+  if (pState == NULL)
+    return B_NO_MEMORY;
+  *ppDirectory = new (std::nothrow) SyntheticRootDirectory (Seed, pState);
+  if (*ppDirectory == NULL)
+  {
+    delete pState;
+    return B_NO_MEMORY;
+  }
+  return B_OK;
+}
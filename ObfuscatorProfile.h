@@ -0,0 +1,116 @@
+/******************************************************************************
+ * ObfuscatorProfile.h
+ *
+ * Tree profiles, for when the obfuscator can't be run over someone's data but
+ * statistics about it can be collected.  A profile has histograms of the
+ * directory fan-out, depth, file sizes, name lengths and the attributes (name,
+ * type, sizes and how many files and directories have them).  It is collected
+ * by running the obfuscator into a profiling sink, so it sees exactly what an
+ * obfuscated copy would have, and saved as a small text file, so that whoever
+ * ships it can see what's in it.  Note that attribute names are included, same
+ * as in an obfuscated tree.
+ *
+ * The synthetic source goes the other way, making up a tree with the same
+ * statistics from a profile, using a seeded random number generator so the
+ * same seed gives the same tree.  Run the obfuscator from it into a real sink
+ * to make an obfuscation-equivalent tree, with no source disk reads.
+ */
+
+#ifndef OBFUSCATOR_PROFILE_H
+#define OBFUSCATOR_PROFILE_H
+
+#include <stdio.h>
+
+#include <map>
+#include <string>
+
+#include "ObfuscatorInterfaces.h"
+
+
+/******************************************************************************
+ * Counts of values.  Exact histograms count each value separately, for small
+ * numbers like depths and name lengths.  Logarithmic ones count powers of two,
+ * bucket 0 for zero and bucket N for values from 2^(N-1) to 2^N - 1, for
+ * things like sizes.
+ */
+
+class ProfileHistogram
+{
+public:
+  ProfileHistogram (bool Logarithmic = false)
+    : mLogarithmic (Logarithmic),
+      mTotal (0)
+  {
+  };
+
+  void Add (long long int Value, long long int Count = 1);
+
+  // Picks a value with the same distribution, given a random fraction from 0
+  // up to but not including 1.  Values within a logarithmic bucket are equally
+  // likely.  Returns zero if the histogram is empty.
+  long long int Sample (double RandomFraction) const;
+
+  long long int Total () const { return mTotal; };
+  long long int Count (long long int Value) const;
+
+  // Writes the histogram as "log" or "exact" followed by bucket:count pairs,
+  // reads it back from the same text.
+  void Save (FILE *pFile) const;
+  status_t Load (const char *pText);
+
+private:
+  bool mLogarithmic;
+  long long int mTotal;
+  std::map<long long int, long long int> mCounts; // Keyed by bucket.
+};
+
+
+struct ProfileAttribute
+{
+  ProfileAttribute () : mFileCount (0), mDirectoryCount (0),
+    mSizes (true) {};
+
+  long long int mFileCount; // Number of files with this attribute.
+  long long int mDirectoryCount;
+  ProfileHistogram mSizes;
+};
+
+// Attributes are keyed by the type code and name.
+typedef std::map<std::pair<uint32, std::string>, ProfileAttribute>
+  ProfileAttributeMap;
+
+
+struct TreeProfile
+{
+  TreeProfile ();
+
+  // Depth is 0 for the top level directory, 1 for things in it and so on.
+  void AddEntry (bool IsDirectory, int Depth, int NameLength);
+  void AddAttribute (bool IsDirectory, const char *pAttributeName,
+    uint32 Type, off_t Size);
+
+  status_t Save (const char *pPath) const;
+  status_t Load (const char *pPath);
+
+  long long int mDirectoryCount; // Including the top level one.
+  long long int mFileCount;
+  ProfileHistogram mFanOut; // Entries per directory.
+  ProfileHistogram mDirectoryDepths;
+  ProfileHistogram mFileDepths;
+  ProfileHistogram mNameLengths;
+  ProfileHistogram mFileSizes;
+  ProfileAttributeMap mAttributes;
+};
+
+
+// Makes a sink which just adds what's written to the profile.  The profile
+// has to outlive the sink objects.
+status_t ProfileOpenSinkDirectory (TreeProfile &Profile,
+  ObfuscateSinkDirectory **ppDirectory);
+
+// Makes a source with a made up tree matching the profile, which has to
+// outlive the source objects.
+status_t SyntheticOpenSourceDirectory (const TreeProfile &Profile, uint64 Seed,
+  ObfuscateSourceDirectory **ppDirectory);
+
+#endif /* OBFUSCATOR_PROFILE_H */
@@ -0,0 +1,790 @@
+/******************************************************************************
+ * ObfuscatorRecord.cpp
+ *
+ * Recording sink wrappers and the replayer, see ObfuscatorRecord.h.
+ */
+
+/* Standard C Library. */
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef OBFUSCATOR_BEOS
+  #include <OS.h>
+#endif
+
+/* Standard C++ library. */
+
+#include <vector>
+
+/* This library's headers. */
+
+#include "ObfuscatorCore.h"
+#include "ObfuscatorRecord.h"
+#include "ObfuscatorTrace.h"
+
+using namespace std;
+
+
+/******************************************************************************
+ * Sink objects which pass operations through to another sink and record them.
+ * The top level one doesn't own the sink it wraps, the ones it creates do.
+ */
+
+template <class InterfaceClass>
+class RecordingSinkNode : public InterfaceClass
+{
+public:
+  RecordingSinkNode (OperationRecorder &Recorder, InterfaceClass *pWrapped,
+    bool OwnsWrapped, uint32 NodeId)
+    : mRecorder (Recorder),
+      mpWrapped (pWrapped),
+      mOwnsWrapped (OwnsWrapped),
+      mNodeId (NodeId)
+  {
+  };
+
+  virtual ~RecordingSinkNode ()
+  {
+    if (mOwnsWrapped)
+    {
+      int64 StartTime = TraceNow ();
+      delete mpWrapped;
+      mRecorder.RecordNodeOperation (RECORD_OP_CLOSE, StartTime, mNodeId);
+    }
+  };
+
+  virtual const char * GetPath ()
+  {
+    return mpWrapped->GetPath ();
+  };
+
+  virtual ssize_t WriteAttr (const char *pAttributeName, uint32 Type,
+    off_t Offset, const void *pBuffer, size_t BufferSize)
+  {
+    if (Offset != 0)
+      return B_BAD_VALUE; // Only whole attributes can be recorded.
+    int64 StartTime = TraceNow ();
+    ssize_t AmountWritten = mpWrapped->WriteAttr (pAttributeName, Type, Offset,
+      pBuffer, BufferSize);
+    if (AmountWritten >= 0)
+      mRecorder.RecordAttrOperation (StartTime, mNodeId, pAttributeName, Type,
+        AmountWritten);
+    return AmountWritten;
+  };
+
+protected:
+  OperationRecorder &mRecorder;
+  InterfaceClass *mpWrapped;
+  bool mOwnsWrapped;
+  uint32 mNodeId;
+};
+
+
+class RecordingSinkFile : public RecordingSinkNode<ObfuscateSinkFile>
+{
+public:
+  RecordingSinkFile (OperationRecorder &Recorder, ObfuscateSinkFile *pWrapped,
+    uint32 NodeId)
+    : RecordingSinkNode<ObfuscateSinkFile> (Recorder, pWrapped, true, NodeId)
+  {
+  };
+
+  virtual char * AllocateDataBuffer (off_t DataSize)
+  {
+    return mpWrapped->AllocateDataBuffer (DataSize);
+  };
+
+  virtual void FreeDataBuffer (char *pBuffer, off_t DataSize)
+  {
+    mpWrapped->FreeDataBuffer (pBuffer, DataSize);
+  };
+
+  virtual ssize_t WriteData (const char *pBuffer, off_t DataSize)
+  {
+    int64 StartTime = TraceNow ();
+    ssize_t AmountWritten = mpWrapped->WriteData (pBuffer, DataSize);
+    // A short write is recorded as what actually got written, so a replay
+    // makes the same file.
+    if (AmountWritten >= 0)
+      mRecorder.RecordDataOperation (RECORD_OP_WRITE_DATA, StartTime, mNodeId,
+        0, AmountWritten);
+    return AmountWritten;
+  };
+
+  virtual off_t GetCloneBlockSize ()
+  {
+    return mpWrapped->GetCloneBlockSize ();
+  };
+
+  virtual status_t CloneZeroFill (off_t Length)
+  {
+    int64 StartTime = TraceNow ();
+    status_t ErrorNumber = mpWrapped->CloneZeroFill (Length);
+    if (ErrorNumber == B_OK)
+      mRecorder.RecordDataOperation (RECORD_OP_CLONE_ZERO_FILL, StartTime,
+        mNodeId, 0, Length);
+    return ErrorNumber;
+  };
+
+  virtual ssize_t WriteDataAt (off_t Offset, const char *pBuffer,
+    off_t DataSize)
+  {
+    int64 StartTime = TraceNow ();
+    ssize_t AmountWritten = mpWrapped->WriteDataAt (Offset, pBuffer, DataSize);
+    if (AmountWritten >= 0)
+      mRecorder.RecordDataOperation (RECORD_OP_WRITE_DATA_AT, StartTime,
+        mNodeId, Offset, AmountWritten);
+    return AmountWritten;
+  };
+};
+
+
+class RecordingSinkDirectory : public RecordingSinkNode<ObfuscateSinkDirectory>
+{
+public:
+  RecordingSinkDirectory (OperationRecorder &Recorder,
+    ObfuscateSinkDirectory *pWrapped, bool OwnsWrapped, uint32 NodeId)
+    : RecordingSinkNode<ObfuscateSinkDirectory> (Recorder, pWrapped,
+      OwnsWrapped, NodeId)
+  {
+  };
+
+  virtual bool Contains (const char *pName)
+  {
+    int64 StartTime = TraceNow ();
+    bool Result = mpWrapped->Contains (pName);
+    mRecorder.RecordNameOperation (RECORD_OP_CONTAINS, StartTime, mNodeId,
+      pName);
+    return Result;
+  };
+
+  // Not recorded, since a replay makes its own names and only asks Contains.
+  virtual status_t GetEntryNames (set<string> &Names)
+  {
+    return mpWrapped->GetEntryNames (Names);
+  };
+
+  virtual status_t CreateFile (const char *pName, ObfuscateSinkFile **ppFile)
+  {
+    int64 StartTime = TraceNow ();
+    ObfuscateSinkFile *pNewFile = NULL;
+    status_t ErrorNumber = mpWrapped->CreateFile (pName, &pNewFile);
+    if (ErrorNumber != B_OK)
+      return ErrorNumber;
+    *ppFile = new (std::nothrow) RecordingSinkFile (mRecorder, pNewFile,
+      mRecorder.NewNodeId ());
+    if (*ppFile == NULL)
+    {
+      delete pNewFile;
+      return B_NO_MEMORY;
+    }
+    mRecorder.RecordNameOperation (RECORD_OP_CREATE_FILE, StartTime, mNodeId,
+      pName);
+    return B_OK;
+  };
+
+  virtual status_t CreateDirectory (const char *pName,
+    ObfuscateSinkDirectory **ppDirectory)
+  {
+    int64 StartTime = TraceNow ();
+    ObfuscateSinkDirectory *pNewDir = NULL;
+    status_t ErrorNumber = mpWrapped->CreateDirectory (pName, &pNewDir);
+    if (ErrorNumber != B_OK)
+      return ErrorNumber;
+    *ppDirectory = new (std::nothrow) RecordingSinkDirectory (mRecorder,
+      pNewDir, true, mRecorder.NewNodeId ());
+    if (*ppDirectory == NULL)
+    {
+      delete pNewDir;
+      return B_NO_MEMORY;
+    }
+    mRecorder.RecordNameOperation (RECORD_OP_CREATE_DIRECTORY, StartTime,
+      mNodeId, pName);
+    return B_OK;
+  };
+
+  virtual status_t Finish ()
+  {
+    int64 StartTime = TraceNow ();
+    status_t ErrorNumber = mpWrapped->Finish ();
+    if (ErrorNumber == B_OK)
+      mRecorder.RecordNodeOperation (RECORD_OP_FINISH, StartTime, mNodeId);
+    return ErrorNumber;
+  };
+};
+
+
+/******************************************************************************
+ * The recorder itself, writing to a buffered stdio file.
+ */
+
+OperationRecorder::OperationRecorder ()
+  : mpFile (NULL),
+    mPreviousTime (0),
+    mNextNodeId (0),
+    mOperationCount (0)
+{
+}
+
+
+OperationRecorder::~OperationRecorder ()
+{
+  Close ();
+}
+
+
+status_t OperationRecorder::Open (const char *pPath)
+{
+  Close ();
+  mpFile = fopen (pPath, "wb");
+  if (mpFile == NULL)
+    return ERRNO_TO_STATUS (errno);
+  setvbuf (mpFile, NULL, _IOFBF, 1024 * 1024);
+  if (fwrite (RECORD_FILE_MAGIC, 8, 1, mpFile) != 1)
+    return ERRNO_TO_STATUS (errno);
+
+  mPreviousTime = TraceNow ();
+  mNextNodeId = 1; // Zero is the top level directory.
+  mOperationCount = 0;
+  mAttrNameIndices.clear ();
+  return B_OK;
+}
+
+
+status_t OperationRecorder::Close ()
+{
+  if (mpFile == NULL)
+    return B_OK;
+  status_t ErrorNumber = B_OK;
+  if (ferror (mpFile))
+    ErrorNumber = B_IO_ERROR;
+  if (fclose (mpFile) != 0 && ErrorNumber == B_OK)
+    ErrorNumber = ERRNO_TO_STATUS (errno);
+  mpFile = NULL;
+  return ErrorNumber;
+}
+
+
+status_t OperationRecorder::WrapSinkDirectory (
+  ObfuscateSinkDirectory &Directory, ObfuscateSinkDirectory **ppDirectory)
+{
+  *ppDirectory = new (std::nothrow) RecordingSinkDirectory (*this, &Directory,
+    false /* OwnsWrapped */, 0 /* NodeId */);
+  if (*ppDirectory == NULL)
+    return B_NO_MEMORY;
+  return B_OK;
+}
+
+
+void OperationRecorder::WriteNumber (unsigned long long int Number)
+{
+  do
+  {
+    unsigned char Byte = Number & 0x7F;
+    Number >>= 7;
+    if (Number != 0)
+      Byte |= 0x80;
+    putc (Byte, mpFile);
+  } while (Number != 0);
+}
+
+
+void OperationRecorder::WriteHeader (eRecordedOperations Operation,
+  int64 StartTime)
+{
+  putc (Operation, mpFile);
+  int64 Delta = StartTime - mPreviousTime;
+  WriteNumber (Delta > 0 ? Delta / 1000 : 0);
+  if (StartTime > mPreviousTime)
+    mPreviousTime = StartTime;
+  mOperationCount++;
+}
+
+
+void OperationRecorder::RecordNameOperation (eRecordedOperations Operation,
+  int64 StartTime, uint32 ParentId, const char *pName)
+{
+  if (mpFile == NULL)
+    return;
+  WriteHeader (Operation, StartTime);
+  WriteNumber (ParentId);
+  WriteNumber (strlen (pName));
+}
+
+
+void OperationRecorder::RecordAttrOperation (int64 StartTime, uint32 NodeId,
+  const char *pAttributeName, uint32 Type, off_t Size)
+{
+  if (mpFile == NULL)
+    return;
+
+  uint32 NameIndex;
+  map<string, uint32>::iterator NameIter = mAttrNameIndices.find (
+    pAttributeName);
+  if (NameIter != mAttrNameIndices.end ())
+    NameIndex = NameIter->second;
+  else
+  {
+    NameIndex = mAttrNameIndices.size ();
+    mAttrNameIndices[pAttributeName] = NameIndex;
+    size_t NameLength = strlen (pAttributeName);
+    WriteHeader (RECORD_OP_ATTR_NAME, StartTime);
+    WriteNumber (NameLength);
+    fwrite (pAttributeName, NameLength, 1, mpFile);
+  }
+
+  WriteHeader (RECORD_OP_WRITE_ATTR, StartTime);
+  WriteNumber (NodeId);
+  WriteNumber (NameIndex);
+  WriteNumber (Type);
+  WriteNumber (Size);
+}
+
+
+void OperationRecorder::RecordDataOperation (eRecordedOperations Operation,
+  int64 StartTime, uint32 NodeId, off_t Offset, off_t Size)
+{
+  if (mpFile == NULL)
+    return;
+  WriteHeader (Operation, StartTime);
+  WriteNumber (NodeId);
+  if (Operation == RECORD_OP_WRITE_DATA_AT)
+    WriteNumber (Offset);
+  WriteNumber (Size);
+}
+
+
+void OperationRecorder::RecordNodeOperation (eRecordedOperations Operation,
+  int64 StartTime, uint32 NodeId)
+{
+  if (mpFile == NULL)
+    return;
+  WriteHeader (Operation, StartTime);
+  if (Operation != RECORD_OP_FINISH)
+    WriteNumber (NodeId);
+}
+
+
+/******************************************************************************
+ * The replayer.  Sink objects are kept in a table indexed by node id, until
+ * their close operation.  Names are generated by Contains, and the following
+ * create of the same length in the same directory uses that name, same as the
+ * obfuscator does when it checks for a free name before creating it.
+ */
+
+struct ReplayNodeRecord
+{
+  ObfuscateSinkNode *mpNode;
+  bool mIsDirectory;
+  off_t mPendingZeroFill; // Clone which wasn't supported by the target.
+};
+
+
+class OperationReplayer
+{
+public:
+  OperationReplayer (ObfuscateSinkDirectory &RootDir, bool RealTime);
+  ~OperationReplayer ();
+
+  status_t Replay (FILE *pFile);
+
+  long long int GetOperationCount () const { return mOperationCount; };
+
+private:
+  bool ReadNumber (unsigned long long int *pNumber);
+  status_t ReadNodeId (bool WantDirectory, ReplayNodeRecord **ppRecord);
+  void WaitUntil (int64 Time);
+  void MakeName (uint32 ParentId, unsigned long long int NameLength,
+    bool FromContains);
+  status_t ReplayCreate (eRecordedOperations Operation);
+  status_t ReplayWriteAttr ();
+  status_t ReplayWriteData (ReplayNodeRecord &Record, off_t Offset,
+    off_t DataSize);
+
+  FILE *mpFile;
+  ObfuscateSinkDirectory &mRootDir;
+  bool mRealTime;
+  Obfuscator mNumberer; // Just for making sequence numbers.
+  vector<ReplayNodeRecord> mNodes;
+  vector<string> mAttrNames;
+  char mName[B_FILE_NAME_LENGTH];
+  bool mNameFromContains;
+  uint32 mNameParentId;
+  int64 mStartTime;
+  int64 mRecordedTime;
+  long long int mOperationCount;
+};
+
+
+OperationReplayer::OperationReplayer (ObfuscateSinkDirectory &RootDir,
+  bool RealTime)
+  : mpFile (NULL),
+    mRootDir (RootDir),
+    mRealTime (RealTime),
+    mNameFromContains (false),
+    mNameParentId (0),
+    mStartTime (0),
+    mRecordedTime (0),
+    mOperationCount (0)
+{
+  ReplayNodeRecord RootRecord = {&RootDir, true, 0};
+  mNodes.push_back (RootRecord);
+  mName[0] = 0;
+}
+
+
+OperationReplayer::~OperationReplayer ()
+{
+  for (size_t iNode = 1; iNode < mNodes.size (); iNode++)
+    delete mNodes[iNode].mpNode;
+}
+
+
+bool OperationReplayer::ReadNumber (unsigned long long int *pNumber)
+{
+  unsigned long long int Number = 0;
+  int Shift = 0;
+  int Byte;
+  do
+  {
+    Byte = getc (mpFile);
+    if (Byte == EOF || Shift > 63)
+      return false;
+    Number |= (unsigned long long int) (Byte & 0x7F) << Shift;
+    Shift += 7;
+  } while (Byte & 0x80);
+  *pNumber = Number;
+  return true;
+}
+
+
+status_t OperationReplayer::ReadNodeId (bool WantDirectory,
+  ReplayNodeRecord **ppRecord)
+{
+  unsigned long long int NodeId;
+  if (!ReadNumber (&NodeId))
+    return B_BAD_VALUE;
+  if (NodeId >= mNodes.size () || mNodes[NodeId].mpNode == NULL ||
+  mNodes[NodeId].mIsDirectory != WantDirectory)
+    return B_BAD_VALUE;
+  *ppRecord = &mNodes[NodeId];
+  return B_OK;
+}
+
+
+void OperationReplayer::WaitUntil (int64 Time)
+{
+  int64 WaitTime = Time - TraceNow ();
+  if (WaitTime <= 0)
+    return;
+#ifdef OBFUSCATOR_BEOS
+  snooze (WaitTime / 1000);
+#else
+  struct timespec Delay;
+  Delay.tv_sec = WaitTime / 1000000000;
+  Delay.tv_nsec = WaitTime % 1000000000;
+  nanosleep (&Delay, NULL);
+#endif
+}
+
+
+void OperationReplayer::MakeName (uint32 ParentId,
+  unsigned long long int NameLength, bool FromContains)
+{
+  if (NameLength >= B_FILE_NAME_LENGTH)
+    NameLength = B_FILE_NAME_LENGTH - 1;
+
+  // A create right after a Contains check of the same directory and length
+  // uses the name which was checked.
+
+  if (!FromContains && mNameFromContains && mNameParentId == ParentId &&
+  strlen (mName) == NameLength)
+  {
+    mNameFromContains = false;
+    return;
+  }
+
+  mNumberer.ObfuscateBuffer (mName, NameLength);
+  mName[NameLength] = 0;
+  mNameFromContains = FromContains;
+  mNameParentId = ParentId;
+}
+
+
+status_t OperationReplayer::ReplayCreate (eRecordedOperations Operation)
+{
+  ReplayNodeRecord *pParent;
+  unsigned long long int NameLength;
+  status_t ErrorNumber = ReadNodeId (true, &pParent);
+  if (ErrorNumber != B_OK || !ReadNumber (&NameLength))
+    return B_BAD_VALUE;
+  uint32 ParentId = pParent - &mNodes[0];
+  ObfuscateSinkDirectory *pParentDir =
+    static_cast<ObfuscateSinkDirectory *> (pParent->mpNode);
+
+  if (Operation == RECORD_OP_CONTAINS)
+  {
+    MakeName (ParentId, NameLength, true);
+    pParentDir->Contains (mName);
+    return B_OK;
+  }
+
+  MakeName (ParentId, NameLength, false);
+  ReplayNodeRecord NewRecord = {NULL, false, 0};
+  if (Operation == RECORD_OP_CREATE_FILE)
+  {
+    ObfuscateSinkFile *pNewFile = NULL;
+    ErrorNumber = pParentDir->CreateFile (mName, &pNewFile);
+    NewRecord.mpNode = pNewFile;
+  }
+  else
+  {
+    ObfuscateSinkDirectory *pNewDir = NULL;
+    ErrorNumber = pParentDir->CreateDirectory (mName, &pNewDir);
+    NewRecord.mpNode = pNewDir;
+    NewRecord.mIsDirectory = true;
+  }
+  if (ErrorNumber != B_OK)
+  {
+    DisplayErrorMessage (mName, ErrorNumber,
+      "ReplayOperations: Unable to create");
+    return ErrorNumber;
+  }
+  mNodes.push_back (NewRecord);
+  return B_OK;
+}
+
+
+status_t OperationReplayer::ReplayWriteAttr ()
+{
+  unsigned long long int NodeId, NameIndex, Type, Size;
+  if (!ReadNumber (&NodeId) || NodeId >= mNodes.size () ||
+  mNodes[NodeId].mpNode == NULL ||
+  !ReadNumber (&NameIndex) || NameIndex >= mAttrNames.size () ||
+  !ReadNumber (&Type) || !ReadNumber (&Size) ||
+  Size > MAX_OBFUSCATE_BUFFER_SIZE)
+    return B_BAD_VALUE;
+
+  const char *pAttributeName = mAttrNames[NameIndex].c_str ();
+  char *pData = new (std::nothrow) char [Size];
+  if (pData == NULL)
+  {
+    DisplayErrorMessage (pAttributeName, B_NO_MEMORY,
+      "ReplayOperations: Unable to allocate memory for attribute");
+    return B_NO_MEMORY;
+  }
+
+  // Same as the obfuscator, string attributes end with a NUL.
+
+  if (Size >= 1 && (Type == B_MIME_STRING_TYPE || Type == B_STRING_TYPE))
+  {
+    mNumberer.ObfuscateBuffer (pData, Size - 1);
+    pData[Size - 1] = 0;
+  }
+  else
+    mNumberer.ObfuscateBuffer (pData, Size);
+
+  ssize_t AmountWritten = mNodes[NodeId].mpNode->WriteAttr (pAttributeName,
+    Type, 0 /* offset */, pData, Size);
+  delete [] pData;
+  if (AmountWritten != (ssize_t) Size)
+  {
+    status_t ErrorNumber = AmountWritten < 0 ? AmountWritten : B_IO_ERROR;
+    DisplayErrorMessage (pAttributeName, ErrorNumber,
+      "ReplayOperations: Unable to write attribute");
+    return ErrorNumber;
+  }
+  return B_OK;
+}
+
+
+status_t OperationReplayer::ReplayWriteData (ReplayNodeRecord &Record,
+  off_t Offset, off_t DataSize)
+{
+  ObfuscateSinkFile *pFile = static_cast<ObfuscateSinkFile *> (Record.mpNode);
+
+  // If the target couldn't clone the filler, write it along with the tail,
+  // which comes out the same since the numbers are padded with '0's.
+
+  if (Offset != 0 && Record.mPendingZeroFill == Offset)
+  {
+    DataSize += Offset;
+    Offset = 0;
+  }
+  Record.mPendingZeroFill = 0;
+
+  if (DataSize > MAX_OBFUSCATE_BUFFER_SIZE)
+    return B_BAD_VALUE;
+
+  char *pData = pFile->AllocateDataBuffer (DataSize);
+  if (pData == NULL)
+  {
+    DisplayErrorMessage (pFile->GetPath (), B_NO_MEMORY,
+      "ReplayOperations: Unable to allocate memory for file contents");
+    return B_NO_MEMORY;
+  }
+  mNumberer.ObfuscateBuffer (pData, DataSize);
+  ssize_t AmountWritten;
+  if (Offset == 0)
+    AmountWritten = pFile->WriteData (pData, DataSize);
+  else
+    AmountWritten = pFile->WriteDataAt (Offset, pData, DataSize);
+  pFile->FreeDataBuffer (pData, DataSize);
+  if (AmountWritten != DataSize)
+  {
+    status_t ErrorNumber = AmountWritten < 0 ? AmountWritten : B_IO_ERROR;
+    DisplayErrorMessage (pFile->GetPath (), ErrorNumber,
+      "ReplayOperations: Unable to write file contents");
+    return ErrorNumber;
+  }
+  return B_OK;
+}
+
+
+status_t OperationReplayer::Replay (FILE *pFile)
+{
+  char Magic[8];
+  mpFile = pFile;
+  if (fread (Magic, 8, 1, mpFile) != 1 ||
+  memcmp (Magic, RECORD_FILE_MAGIC, 8) != 0)
+  {
+    DisplayErrorMessage ("Not an operation recording file", B_BAD_VALUE,
+      "ReplayOperations");
+    return B_BAD_VALUE;
+  }
+
+  mStartTime = TraceNow ();
+  int Operation;
+  while ((Operation = getc (mpFile)) != EOF)
+  {
+    status_t ErrorNumber = B_BAD_VALUE;
+    unsigned long long int Delta, Number, Size;
+    ReplayNodeRecord *pRecord;
+
+    if (!ReadNumber (&Delta))
+      break;
+    mRecordedTime += Delta * 1000;
+    if (mRealTime)
+      WaitUntil (mStartTime + mRecordedTime);
+
+    switch (Operation)
+    {
+      case RECORD_OP_CONTAINS:
+      case RECORD_OP_CREATE_FILE:
+      case RECORD_OP_CREATE_DIRECTORY:
+        ErrorNumber = ReplayCreate ((eRecordedOperations) Operation);
+        break;
+
+      case RECORD_OP_ATTR_NAME:
+        if (ReadNumber (&Number) && Number <= B_ATTR_NAME_LENGTH)
+        {
+          char AttributeName[B_ATTR_NAME_LENGTH+1];
+          if (fread (AttributeName, 1, Number, mpFile) == Number)
+          {
+            mAttrNames.push_back (string (AttributeName, Number));
+            ErrorNumber = B_OK;
+          }
+        }
+        break;
+
+      case RECORD_OP_WRITE_ATTR:
+        ErrorNumber = ReplayWriteAttr ();
+        break;
+
+      case RECORD_OP_WRITE_DATA:
+        if (ReadNodeId (false, &pRecord) == B_OK && ReadNumber (&Size))
+          ErrorNumber = ReplayWriteData (*pRecord, 0, Size);
+        break;
+
+      case RECORD_OP_CLONE_ZERO_FILL:
+        if (ReadNodeId (false, &pRecord) == B_OK && ReadNumber (&Size))
+        {
+          ErrorNumber = static_cast<ObfuscateSinkFile *>
+            (pRecord->mpNode)->CloneZeroFill (Size);
+          if (ErrorNumber == B_NOT_SUPPORTED)
+          {
+            pRecord->mPendingZeroFill = Size;
+            ErrorNumber = B_OK;
+          }
+          else if (ErrorNumber != B_OK)
+            DisplayErrorMessage (pRecord->mpNode->GetPath (), ErrorNumber,
+              "ReplayOperations: Unable to clone file contents");
+        }
+        break;
+
+      case RECORD_OP_WRITE_DATA_AT:
+        if (ReadNodeId (false, &pRecord) == B_OK && ReadNumber (&Number) &&
+        ReadNumber (&Size))
+          ErrorNumber = ReplayWriteData (*pRecord, Number, Size);
+        break;
+
+      case RECORD_OP_CLOSE:
+        if (ReadNumber (&Number) && Number < mNodes.size ())
+        {
+          if (Number != 0)
+          {
+            delete mNodes[Number].mpNode;
+            mNodes[Number].mpNode = NULL;
+          }
+          ErrorNumber = B_OK;
+        }
+        break;
+
+      case RECORD_OP_FINISH:
+        ErrorNumber = mRootDir.Finish ();
+        if (ErrorNumber != B_OK)
+          DisplayErrorMessage (mRootDir.GetPath (), ErrorNumber,
+            "ReplayOperations: Problems finishing up the destination");
+        break;
+    }
+
+    if (ErrorNumber == B_BAD_VALUE)
+    {
+      char ErrorMessage[100];
+      sprintf (ErrorMessage, "Bad or truncated operation %d in the recording, "
+        "after %lld operations", Operation, mOperationCount);
+      DisplayErrorMessage (ErrorMessage, ErrorNumber, "ReplayOperations");
+    }
+    if (ErrorNumber != B_OK)
+      return ErrorNumber;
+    mOperationCount++;
+  }
+
+  if (Operation != EOF)
+  {
+    DisplayErrorMessage ("Recording ends in the middle of an operation",
+      B_BAD_VALUE, "ReplayOperations");
+    return B_BAD_VALUE;
+  }
+  if (ferror (mpFile))
+  {
+    DisplayErrorMessage ("Unable to read the recording", B_IO_ERROR,
+      "ReplayOperations");
+    return B_IO_ERROR;
+  }
+  return B_OK;
+}
+
+
+status_t ReplayOperations (const char *pPath, ObfuscateSinkDirectory &RootDir,
+  bool RealTime, long long int *pOperationCount)
+{
+  *pOperationCount = 0;
+  FILE *pFile = fopen (pPath, "rb");
+  if (pFile == NULL)
+  {
+    status_t ErrorNumber = ERRNO_TO_STATUS (errno);
+    DisplayErrorMessage (pPath, ErrorNumber,
+      "ReplayOperations: Unable to open recording");
+    return ErrorNumber;
+  }
+  setvbuf (pFile, NULL, _IOFBF, 1024 * 1024);
+
+  OperationReplayer Replayer (RootDir, RealTime);
+  status_t ErrorNumber = Replayer.Replay (pFile);
+  *pOperationCount = Replayer.GetOperationCount ();
+  fclose (pFile);
+  return ErrorNumber;
+}
@@ -0,0 +1,130 @@
+/******************************************************************************
+ * ObfuscatorRecord.h
+ *
+ * Recording and replaying the stream of operations the obfuscator does on a
+ * sink, for reproducing file system bugs where the order of creates and
+ * attribute and data writes matters more than the files themselves.  A
+ * recording of a huge tree is a few megabytes, and replaying it is also a
+ * decent file system metadata benchmark.
+ *
+ * The recording only has sizes, not contents.  Names, attribute values and
+ * file contents are regenerated on replay as sequence numbers, the same way
+ * the obfuscator makes them, so replaying a recording of a normal run gives
+ * an identical tree.  Attribute names are kept, same as in the obfuscated
+ * tree.
+ *
+ * The file starts with the 8 byte RECORD_FILE_MAGIC, followed by operation
+ * records.  Each is an operation code byte, then the time since the previous
+ * operation started in microseconds, then the operation's fields.  All the
+ * numbers after the operation code are unsigned LEB128 variable length
+ * integers (7 bits per byte, low bits first, high bit set if more follow):
+ *
+ *   RECORD_OP_CONTAINS         parent id, name length
+ *   RECORD_OP_CREATE_FILE      parent id, name length
+ *   RECORD_OP_CREATE_DIRECTORY parent id, name length
+ *   RECORD_OP_ATTR_NAME        name length, then the name's bytes
+ *   RECORD_OP_WRITE_ATTR       node id, attribute name index, type, size
+ *   RECORD_OP_WRITE_DATA       node id, size
+ *   RECORD_OP_CLONE_ZERO_FILL  node id, size
+ *   RECORD_OP_WRITE_DATA_AT    node id, offset, size
+ *   RECORD_OP_CLOSE            node id
+ *   RECORD_OP_FINISH           (nothing)
+ *
+ * The top level directory is node id 0, created nodes get the following ids
+ * in order of creation.  Each attribute name is written once with
+ * RECORD_OP_ATTR_NAME, the first one gets index 0 and so on, and attribute
+ * writes refer to the index.  Only operations which succeeded are recorded
+ * (except for Contains), so the replay doesn't trip over errors that the
+ * original run already reported.
+ */
+
+#ifndef OBFUSCATOR_RECORD_H
+#define OBFUSCATOR_RECORD_H
+
+#include <stdio.h>
+
+#include <map>
+#include <string>
+
+#include "ObfuscatorInterfaces.h"
+
+#define RECORD_FILE_MAGIC "ObfRec01"
+
+enum eRecordedOperations
+{
+  RECORD_OP_CONTAINS = 1,
+  RECORD_OP_CREATE_FILE,
+  RECORD_OP_CREATE_DIRECTORY,
+  RECORD_OP_ATTR_NAME,
+  RECORD_OP_WRITE_ATTR,
+  RECORD_OP_WRITE_DATA,
+  RECORD_OP_CLONE_ZERO_FILL,
+  RECORD_OP_WRITE_DATA_AT,
+  RECORD_OP_CLOSE,
+  RECORD_OP_FINISH,
+  RECORD_OP_MAX
+};
+
+
+/******************************************************************************
+ * Writes the operations done on a wrapped sink to a recording file.
+ */
+
+class OperationRecorder
+{
+public:
+  OperationRecorder ();
+  ~OperationRecorder ();
+
+  status_t Open (const char *pPath);
+
+  // Flushes and closes the file.  Operations after this aren't recorded.
+  status_t Close ();
+
+  // Makes a sink directory which passes everything through to the given one
+  // (which it doesn't own), recording the operations done on it and on the
+  // files and directories created in it.  The new object is owned by the
+  // caller and has to be deleted before the recorder.
+  status_t WrapSinkDirectory (ObfuscateSinkDirectory &Directory,
+    ObfuscateSinkDirectory **ppDirectory);
+
+  long long int GetOperationCount () const { return mOperationCount; };
+
+  // For the wrapping sink objects.  Operations are passed the time they
+  // started, from TraceNow.
+  uint32 NewNodeId () { return mNextNodeId++; };
+  void RecordNameOperation (eRecordedOperations Operation, int64 StartTime,
+    uint32 ParentId, const char *pName);
+  void RecordAttrOperation (int64 StartTime, uint32 NodeId,
+    const char *pAttributeName, uint32 Type, off_t Size);
+  void RecordDataOperation (eRecordedOperations Operation, int64 StartTime,
+    uint32 NodeId, off_t Offset, off_t Size);
+  void RecordNodeOperation (eRecordedOperations Operation, int64 StartTime,
+    uint32 NodeId);
+
+private:
+  OperationRecorder (const OperationRecorder &); // Not copyable.
+  OperationRecorder & operator = (const OperationRecorder &);
+
+  void WriteHeader (eRecordedOperations Operation, int64 StartTime);
+  void WriteNumber (unsigned long long int Number);
+
+  FILE *mpFile;
+  int64 mPreviousTime;
+  uint32 mNextNodeId;
+  long long int mOperationCount;
+  std::map<std::string, uint32> mAttrNameIndices;
+};
+
+
+/******************************************************************************
+ * Replays a recording into the given top level sink directory.  If RealTime
+ * is true, waits between operations to match the original timing, otherwise
+ * goes as fast as it can.  The number of operations done is returned in
+ * *pOperationCount.  Errors are displayed and stop the replay.
+ */
+
+status_t ReplayOperations (const char *pPath, ObfuscateSinkDirectory &RootDir,
+  bool RealTime, long long int *pOperationCount);
+
+#endif /* OBFUSCATOR_RECORD_H */
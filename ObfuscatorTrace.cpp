@@ -0,0 +1,353 @@
+/******************************************************************************
+ * ObfuscatorTrace.cpp
+ *
+ * Per-thread span buffers and the Chrome trace event exporter, see
+ * ObfuscatorTrace.h.
+ */
+
+/* Standard C Library. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* This library's headers. */
+
+#include "ObfuscatorTrace.h"
+
+
+int64 TraceNow ()
+{
+  struct timespec Now;
+  clock_gettime (CLOCK_MONOTONIC, &Now);
+  return Now.tv_sec * (int64) 1000000000 + Now.tv_nsec;
+}
+
+
+#ifdef OBFUSCATOR_NO_TRACE
+
+void TraceStart ()
+{
+}
+
+
+void TraceRecord (const char * /* pName */, const char * /* pDetail */,
+  int64 /* StartTime */, int64 /* EndTime */)
+{
+}
+
+
+status_t TraceExportChromeJson (const char * /* pPath */)
+{
+  return B_NOT_SUPPORTED;
+}
+
+#else /* Tracing compiled in. */
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <vector>
+
+static const int TRACE_DETAIL_LENGTH = 40;
+static const int TRACE_EVENTS_PER_CHUNK = 16384;
+
+// Chunks are about a megabyte each.  Once this many have been made, further
+// events are counted but not kept, so a long -watch run doesn't use up all
+// the memory.  The export says how many were dropped.
+static const int TRACE_MAX_CHUNKS = 64;
+
+struct TraceEventRecord
+{
+  const char *mpName;
+  int64 mStartTime;
+  int64 mEndTime;
+  char mDetail[TRACE_DETAIL_LENGTH];
+};
+
+
+/******************************************************************************
+ * A thread's events are stored in a list of fixed size chunks, so recording
+ * never moves old events.  Only the owning thread appends, and it publishes
+ * the new count with a release store, so the exporter can read everything up
+ * to the count without locking.
+ */
+
+struct TraceEventChunk
+{
+  TraceEventRecord mEvents[TRACE_EVENTS_PER_CHUNK];
+  std::atomic<int> mCount;
+  std::atomic<TraceEventChunk *> mpNext;
+
+  TraceEventChunk () : mCount (0), mpNext (NULL) {};
+};
+
+
+struct TraceThreadBuffer
+{
+  int mThreadNumber;
+  TraceEventChunk *mpFirstChunk;
+  TraceEventChunk *mpLastChunk; // Only used by the owning thread.
+};
+
+
+// All the thread buffers ever made.  The lock is only taken when a thread
+// records its first event and when exporting.  Buffers are never freed, since
+// the thread_local pointers to them don't get cleaned up.
+
+static std::mutex gTraceBuffersLock;
+static std::vector<TraceThreadBuffer *> gTraceBuffers;
+static int64 gTraceStartTime = 0;
+
+static std::atomic<int> gTraceChunkCount (0);
+static std::atomic<long long int> gTraceDroppedCount (0);
+
+static thread_local TraceThreadBuffer *tpTraceBuffer = NULL;
+
+std::atomic<bool> gTraceEnabled (false);
+
+
+void TraceStart ()
+{
+  gTraceStartTime = TraceNow ();
+  gTraceEnabled.store (true, std::memory_order_relaxed);
+}
+
+
+// Returns NULL if out of memory or past the chunk limit.
+
+static TraceEventChunk * TraceMakeChunk ()
+{
+  if (gTraceChunkCount.fetch_add (1, std::memory_order_relaxed) >=
+  TRACE_MAX_CHUNKS)
+  {
+    gTraceChunkCount.fetch_sub (1, std::memory_order_relaxed);
+    return NULL;
+  }
+  TraceEventChunk *pChunk = new (std::nothrow) TraceEventChunk;
+  if (pChunk == NULL)
+    gTraceChunkCount.fetch_sub (1, std::memory_order_relaxed);
+  return pChunk;
+}
+
+
+static TraceThreadBuffer * TraceMakeThreadBuffer ()
+{
+  TraceThreadBuffer *pBuffer = new (std::nothrow) TraceThreadBuffer;
+  if (pBuffer == NULL)
+    return NULL;
+  pBuffer->mpFirstChunk = TraceMakeChunk ();
+  if (pBuffer->mpFirstChunk == NULL)
+  {
+    delete pBuffer;
+    return NULL;
+  }
+  pBuffer->mpLastChunk = pBuffer->mpFirstChunk;
+
+  std::lock_guard<std::mutex> Lock (gTraceBuffersLock);
+  pBuffer->mThreadNumber = gTraceBuffers.size () + 1;
+  gTraceBuffers.push_back (pBuffer);
+  return pBuffer;
+}
+
+
+void TraceRecord (const char *pName, const char *pDetail, int64 StartTime,
+  int64 EndTime)
+{
+  TraceThreadBuffer *pBuffer = tpTraceBuffer;
+  if (pBuffer == NULL)
+  {
+    pBuffer = tpTraceBuffer = TraceMakeThreadBuffer ();
+    if (pBuffer == NULL)
+    {
+      gTraceDroppedCount.fetch_add (1, std::memory_order_relaxed);
+      return;
+    }
+  }
+
+  TraceEventChunk *pChunk = pBuffer->mpLastChunk;
+  int Count = pChunk->mCount.load (std::memory_order_relaxed);
+  if (Count >= TRACE_EVENTS_PER_CHUNK)
+  {
+    TraceEventChunk *pNewChunk = TraceMakeChunk ();
+    if (pNewChunk == NULL)
+    {
+      gTraceDroppedCount.fetch_add (1, std::memory_order_relaxed);
+      return;
+    }
+    pChunk->mpNext.store (pNewChunk, std::memory_order_release);
+    pBuffer->mpLastChunk = pChunk = pNewChunk;
+    Count = 0;
+  }
+
+  TraceEventRecord &Event = pChunk->mEvents[Count];
+  Event.mpName = pName;
+  Event.mStartTime = StartTime;
+  Event.mEndTime = EndTime;
+  if (pDetail == NULL)
+    Event.mDetail[0] = 0;
+  else
+  {
+    // Keep the end of long details, for paths that's the interesting part.
+    // Start on a character boundary rather than in the middle of a UTF-8
+    // sequence, which is at most 3 continuation bytes.
+    size_t DetailLength = strlen (pDetail);
+    if (DetailLength >= (size_t) TRACE_DETAIL_LENGTH)
+    {
+      pDetail += DetailLength - (TRACE_DETAIL_LENGTH - 1);
+      for (int iSkip = 0; iSkip < 3 && (*pDetail & 0xC0) == 0x80; iSkip++)
+        pDetail++;
+    }
+    strcpy (Event.mDetail, pDetail);
+  }
+  pChunk->mCount.store (Count + 1, std::memory_order_release);
+}
+
+
+/******************************************************************************
+ * Length of the valid UTF-8 sequence starting at pString, or zero if it isn't
+ * one (stray continuation byte, overlong encoding, surrogate, beyond U+10FFFF
+ * or cut short).  Only called for bytes of 0x80 and above.
+ */
+
+static int TraceUtf8SequenceLength (const unsigned char *pString)
+{
+  unsigned char Lead = pString[0];
+  int Length;
+  unsigned char SecondMin = 0x80;
+  unsigned char SecondMax = 0xBF;
+
+  if (Lead >= 0xC2 && Lead <= 0xDF)
+    Length = 2;
+  else if (Lead >= 0xE0 && Lead <= 0xEF)
+  {
+    Length = 3;
+    if (Lead == 0xE0)
+      SecondMin = 0xA0; // Overlong.
+    else if (Lead == 0xED)
+      SecondMax = 0x9F; // Surrogates.
+  }
+  else if (Lead >= 0xF0 && Lead <= 0xF4)
+  {
+    Length = 4;
+    if (Lead == 0xF0)
+      SecondMin = 0x90; // Overlong.
+    else if (Lead == 0xF4)
+      SecondMax = 0x8F; // Beyond U+10FFFF.
+  }
+  else
+    return 0;
+
+  if (pString[1] < SecondMin || pString[1] > SecondMax)
+    return 0;
+  for (int iByte = 2; iByte < Length; iByte++)
+  {
+    if ((pString[iByte] & 0xC0) != 0x80)
+      return 0; // Also stops at the terminating NUL.
+  }
+  return Length;
+}
+
+
+/******************************************************************************
+ * Write a string as a JSON string literal, escaping quotes, backslashes and
+ * control characters.  File names needn't be UTF-8, so bytes which aren't
+ * part of a valid UTF-8 sequence are written as \u00XX, otherwise JSON
+ * readers reject the whole file.
+ */
+
+static void TraceWriteJsonString (FILE *pFile, const char *pString)
+{
+  const unsigned char *pLetter = (const unsigned char *) pString;
+
+  fputc ('"', pFile);
+  while (*pLetter != 0)
+  {
+    unsigned char Letter = *pLetter;
+    if (Letter == '"' || Letter == '\\')
+      fprintf (pFile, "\\%c", Letter);
+    else if (Letter < 32)
+      fprintf (pFile, "\\u%04x", Letter);
+    else if (Letter >= 0x80)
+    {
+      int SequenceLength = TraceUtf8SequenceLength (pLetter);
+      if (SequenceLength == 0)
+        fprintf (pFile, "\\u%04x", Letter);
+      else
+      {
+        fwrite (pLetter, 1, SequenceLength, pFile);
+        pLetter += SequenceLength;
+        continue;
+      }
+    }
+    else
+      fputc (Letter, pFile);
+    pLetter++;
+  }
+  fputc ('"', pFile);
+}
+
+
+status_t TraceExportChromeJson (const char *pPath)
+{
+  FILE *pFile = fopen (pPath, "w");
+  if (pFile == NULL)
+    return ERRNO_TO_STATUS (errno);
+
+  fprintf (pFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+  bool FirstEvent = true;
+  std::lock_guard<std::mutex> Lock (gTraceBuffersLock);
+  for (size_t iBuffer = 0; iBuffer < gTraceBuffers.size (); iBuffer++)
+  {
+    TraceThreadBuffer *pBuffer = gTraceBuffers[iBuffer];
+
+    fprintf (pFile, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+      "\"tid\":%d,\"args\":{\"name\":\"Thread %d\"}}",
+      FirstEvent ? "" : ",\n", pBuffer->mThreadNumber, pBuffer->mThreadNumber);
+    FirstEvent = false;
+
+    TraceEventChunk *pChunk = pBuffer->mpFirstChunk;
+    while (pChunk != NULL)
+    {
+      int Count = pChunk->mCount.load (std::memory_order_acquire);
+      for (int iEvent = 0; iEvent < Count; iEvent++)
+      {
+        TraceEventRecord &Event = pChunk->mEvents[iEvent];
+        int64 Start = Event.mStartTime - gTraceStartTime;
+        int64 Duration = Event.mEndTime - Event.mStartTime;
+
+        fprintf (pFile, ",\n{\"name\":");
+        TraceWriteJsonString (pFile, Event.mpName);
+        fprintf (pFile, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+          "\"ts\":%lld.%03d,\"dur\":%lld.%03d",
+          pBuffer->mThreadNumber,
+          (long long int) (Start / 1000), (int) (Start % 1000),
+          (long long int) (Duration / 1000), (int) (Duration % 1000));
+        if (Event.mDetail[0] != 0)
+        {
+          fprintf (pFile, ",\"args\":{\"detail\":");
+          TraceWriteJsonString (pFile, Event.mDetail);
+          fputc ('}', pFile);
+        }
+        fputc ('}', pFile);
+      }
+      pChunk = pChunk->mpNext.load (std::memory_order_acquire);
+    }
+  }
+
+  // Chrome and Perfetto show otherData as the trace's metadata.
+  long long int DroppedCount =
+    gTraceDroppedCount.load (std::memory_order_relaxed);
+  fprintf (pFile, "\n],\"otherData\":{\"droppedEvents\":%lld}}\n",
+    DroppedCount);
+  if (DroppedCount > 0)
+    fprintf (stderr, "Trace memory limit reached, the last %lld events were "
+      "dropped from \"%s\".\n", DroppedCount, pPath);
+  if (fclose (pFile) != 0)
+    return ERRNO_TO_STATUS (errno);
+  return B_OK;
+}
+
+#endif /* OBFUSCATOR_NO_TRACE */
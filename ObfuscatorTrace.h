@@ -0,0 +1,125 @@
+/******************************************************************************
+ * ObfuscatorTrace.h
+ *
+ * Optional timing spans, exported as Chrome trace event JSON (load it in
+ * chrome://tracing or Perfetto), for finding out why some directories take
+ * minutes.  Put TRACE_SPAN ("Name") at the top of a block and the time spent
+ * until the end of the block gets recorded, if tracing has been turned on.
+ * The name has to be a string constant, since only the pointer is kept.  An
+ * optional detail string (file or attribute name) is copied, keeping just the
+ * last few dozen characters.
+ *
+ * Each thread records into its own buffer, which only that thread writes to,
+ * so recording doesn't need locks.  Only about a million spans are kept, so
+ * a long -watch run can't use up all the memory; later ones are dropped and
+ * counted in the exported file.  When tracing is off, a span costs a test of
+ * a global flag, or nothing at all for TRACE_SPAN_IF with a false compile
+ * time flag.  Defining OBFUSCATOR_NO_TRACE compiles spans out completely,
+ * which happens automatically for pre-C++11 compilers since the per-thread
+ * buffers need thread_local and atomics.
+ */
+
+#ifndef OBFUSCATOR_TRACE_H
+#define OBFUSCATOR_TRACE_H
+
+#include "ObfuscatorPlatform.h"
+
+#if __cplusplus < 201103L && !defined(OBFUSCATOR_NO_TRACE)
+  #define OBFUSCATOR_NO_TRACE 1
+#endif
+
+#ifdef OBFUSCATOR_NO_TRACE
+inline bool TraceIsEnabled () { return false; }
+#else
+#include <atomic>
+
+// Set by TraceStart and tested by every span, in whatever thread.  Relaxed
+// loads are enough, a thread which sees it late only misses a few spans.
+extern std::atomic<bool> gTraceEnabled;
+
+inline bool TraceIsEnabled ()
+{
+  return gTraceEnabled.load (std::memory_order_relaxed);
+}
+#endif
+
+// Start recording spans, from all threads.
+void TraceStart ();
+
+// Write all the spans recorded so far to a JSON file.  Call it after the
+// other threads have stopped recording.
+status_t TraceExportChromeJson (const char *pPath);
+
+// Nanoseconds from a monotonic clock.
+int64 TraceNow ();
+
+void TraceRecord (const char *pName, const char *pDetail, int64 StartTime,
+  int64 EndTime);
+
+
+/******************************************************************************
+ * Records the time between its construction and destruction as a span.
+ */
+
+class TraceSpan
+{
+public:
+  TraceSpan (const char *pName, const char *pDetail = NULL)
+  {
+    if (TraceIsEnabled ())
+    {
+      mpName = pName;
+      mpDetail = pDetail;
+      mStartTime = TraceNow ();
+    }
+    else
+      mpName = NULL;
+  };
+
+  ~TraceSpan ()
+  {
+    if (mpName != NULL)
+      TraceRecord (mpName, mpDetail, mStartTime, TraceNow ());
+  };
+
+private:
+  const char *mpName;
+  const char *mpDetail;
+  int64 mStartTime;
+};
+
+
+/******************************************************************************
+ * A span which is only there if a compile time flag is true, for code which
+ * is compiled once with tracing and once without.
+ */
+
+template <bool Enabled>
+class TraceSpanIf : public TraceSpan
+{
+public:
+  TraceSpanIf (const char *pName, const char *pDetail = NULL)
+    : TraceSpan (pName, pDetail) {};
+};
+
+template <>
+class TraceSpanIf<false>
+{
+public:
+  TraceSpanIf (const char * /* pName */, const char * /* pDetail */ = NULL) {};
+};
+
+#ifdef OBFUSCATOR_NO_TRACE
+  #define TRACE_SPAN(...) do {} while (false)
+  #define TRACE_SPAN_IF(Enabled, ...) do {} while (false)
+#else
+  #define TRACE_SPAN_JOIN2(A, B) A##B
+  #define TRACE_SPAN_JOIN(A, B) TRACE_SPAN_JOIN2(A, B)
+  #define TRACE_SPAN(...) \
+    TraceSpan TRACE_SPAN_JOIN(TraceSpanOnLine, __LINE__) (__VA_ARGS__)
+  #define TRACE_SPAN_IF(Enabled, ...) \
+    TraceSpanIf<Enabled> TRACE_SPAN_JOIN(TraceSpanOnLine, __LINE__) \
+      (__VA_ARGS__)
+#endif
+
+#endif /* OBFUSCATOR_TRACE_H */
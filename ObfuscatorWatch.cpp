@@ -0,0 +1,1252 @@
+/******************************************************************************
+ * ObfuscatorWatch.cpp
+ *
+ * Live mirror mode, see ObfuscatorWatch.h.  The change notifications come
+ * from a per-platform ChangeNotifier, which turns them into ChangeEvents
+ * referring to watched directories by number.  The rest works on source and
+ * destination paths and is the same everywhere.
+ */
+
+/* Standard C Library. */
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef OBFUSCATOR_BEOS
+  #include <Autolock.h>
+  #include <Locker.h>
+  #include <Looper.h>
+  #include <Message.h>
+  #include <Messenger.h>
+  #include <NodeMonitor.h>
+  #include <OS.h>
+#elif defined (__linux__)
+  #include <poll.h>
+  #include <sys/inotify.h>
+#endif
+
+/* This library's headers. */
+
+#include "ObfuscatorWatch.h"
+#include "ObfuscatorTrace.h"
+#ifdef OBFUSCATOR_BEOS
+  #include "ObfuscatorBeOS.h"
+#else
+  #include "ObfuscatorPosix.h"
+#endif
+
+using namespace std;
+
+
+/******************************************************************************
+ * A change notification.  The watch number is for the directory the change
+ * happened in, with the entry's name, or for the changed entry itself if the
+ * name is empty.  Some notifications only identify the entry by its inode
+ * number within the directory, in which case the name is empty and the inode
+ * isn't zero.  The two halves of a rename have the same cookie.
+ */
+
+enum eChangeEventKinds
+{
+  CHANGE_ENTRY = 0, // Something about it changed, compare it again.
+  CHANGE_MOVED_FROM,
+  CHANGE_MOVED_TO,
+  CHANGE_WATCH_GONE, // The watched directory was deleted or moved.
+  CHANGE_RESCAN // Notifications were lost.
+};
+
+struct ChangeEvent
+{
+  ChangeEvent (eChangeEventKinds Kind, int WatchId)
+    : mKind (Kind), mWatchId (WatchId), mInode (0), mCookie (0) {};
+
+  eChangeEventKinds mKind;
+  int mWatchId;
+  string mName;
+  ino_t mInode;
+  uint32 mCookie;
+};
+
+
+#ifdef OBFUSCATOR_BEOS
+
+/******************************************************************************
+ * BeOS and Haiku version, using the node monitor.  It only reports changes to
+ * the nodes being watched, so files are watched individually to find out
+ * about their attributes and contents changing.  Notifications arrive as
+ * messages in a looper thread, which queues them up for WaitForEvents.
+ */
+
+class ChangeNotifier;
+
+class NodeMonitorLooper : public BLooper
+{
+public:
+  NodeMonitorLooper (ChangeNotifier &Notifier)
+    : BLooper ("ObfuscatorWatch"), mNotifier (Notifier) {};
+
+  virtual void MessageReceived (BMessage *pMessage);
+
+private:
+  ChangeNotifier &mNotifier;
+};
+
+
+class ChangeNotifier
+{
+public:
+  ChangeNotifier ()
+    : mpLooper (NULL), mEventSemaphore (-1), mNextWatchId (0),
+      mNextCookie (1) {};
+
+  ~ChangeNotifier ()
+  {
+    if (mpLooper != NULL)
+    {
+      stop_watching (BMessenger (mpLooper));
+      if (mpLooper->Lock ())
+        mpLooper->Quit ();
+    }
+    if (mEventSemaphore >= 0)
+      delete_sem (mEventSemaphore);
+  };
+
+  status_t Init ()
+  {
+    mEventSemaphore = create_sem (0, "ObfuscatorWatch events");
+    if (mEventSemaphore < 0)
+      return mEventSemaphore;
+    mpLooper = new (std::nothrow) NodeMonitorLooper (*this);
+    if (mpLooper == NULL)
+      return B_NO_MEMORY;
+    mpLooper->Run ();
+    return B_OK;
+  };
+
+  status_t AddWatch (const char *pPath, const struct stat &Stat,
+    bool IsDirectory, int *pWatchId)
+  {
+    TRACE_SPAN ("watch_node", pPath);
+    BAutolock AutoLock (mLock);
+    map<pair<dev_t, ino_t>, int>::iterator WatchIter =
+      mWatchIds.find (make_pair (Stat.st_dev, Stat.st_ino));
+    if (WatchIter != mWatchIds.end ())
+    {
+      *pWatchId = WatchIter->second; // Same node under a new path.
+      return B_OK;
+    }
+
+    node_ref NodeRef;
+    NodeRef.device = Stat.st_dev;
+    NodeRef.node = Stat.st_ino;
+    status_t ErrorNumber = watch_node (&NodeRef, B_WATCH_STAT | B_WATCH_ATTR |
+      (IsDirectory ? B_WATCH_DIRECTORY : 0), BMessenger (mpLooper));
+    if (ErrorNumber != B_OK)
+      return ErrorNumber;
+
+    *pWatchId = mNextWatchId++;
+    mWatchIds[make_pair (Stat.st_dev, Stat.st_ino)] = *pWatchId;
+    mWatchedNodes[*pWatchId] = make_pair (Stat.st_dev, Stat.st_ino);
+    return B_OK;
+  };
+
+  void RemoveWatch (int WatchId)
+  {
+    BAutolock AutoLock (mLock);
+    map<int, pair<dev_t, ino_t> >::iterator NodeIter =
+      mWatchedNodes.find (WatchId);
+    if (NodeIter == mWatchedNodes.end ())
+      return;
+    node_ref NodeRef;
+    NodeRef.device = NodeIter->second.first;
+    NodeRef.node = NodeIter->second.second;
+    watch_node (&NodeRef, B_STOP_WATCHING, BMessenger (mpLooper));
+    mWatchIds.erase (NodeIter->second);
+    mWatchedNodes.erase (NodeIter);
+  };
+
+  // Returns after the timeout, or sooner if there are notifications or a
+  // signal arrives.
+  status_t WaitForEvents (int TimeoutMilliseconds,
+    vector<ChangeEvent> &Events)
+  {
+    status_t ErrorNumber = acquire_sem_etc (mEventSemaphore, 1,
+      B_RELATIVE_TIMEOUT | B_CAN_INTERRUPT,
+      TimeoutMilliseconds * (bigtime_t) 1000);
+    if (ErrorNumber != B_OK && ErrorNumber != B_TIMED_OUT &&
+    ErrorNumber != B_INTERRUPTED)
+      return ErrorNumber;
+
+    BAutolock AutoLock (mLock);
+    Events.insert (Events.end (), mQueuedEvents.begin (),
+      mQueuedEvents.end ());
+    mQueuedEvents.clear ();
+    return B_OK;
+  };
+
+  // Called in the looper thread.
+  void NodeMonitorMessage (const BMessage &Message)
+  {
+    int32 Opcode;
+    dev_t Device;
+    ino_t DirectoryInode;
+    ino_t ToDirectoryInode;
+    ino_t Inode;
+    const char *pName;
+
+    if (Message.FindInt32 ("opcode", &Opcode) != B_OK ||
+    Message.FindInt32 ("device", &Device) != B_OK)
+      return;
+
+    BAutolock AutoLock (mLock);
+    size_t OldQueueSize = mQueuedEvents.size ();
+
+    switch (Opcode)
+    {
+      case B_ENTRY_CREATED:
+        if (Message.FindInt64 ("directory", &DirectoryInode) == B_OK &&
+        Message.FindString ("name", &pName) == B_OK)
+          QueueEvent (CHANGE_ENTRY, Device, DirectoryInode, pName, 0, 0);
+        break;
+
+      case B_ENTRY_REMOVED:
+        if (Message.FindInt64 ("directory", &DirectoryInode) == B_OK &&
+        Message.FindInt64 ("node", &Inode) == B_OK)
+          QueueEvent (CHANGE_ENTRY, Device, DirectoryInode, "", Inode, 0);
+        break;
+
+      case B_ENTRY_MOVED:
+        // Only the new name is given, the old one is found by inode.
+        if (Message.FindInt64 ("from directory", &DirectoryInode) == B_OK &&
+        Message.FindInt64 ("to directory", &ToDirectoryInode) == B_OK &&
+        Message.FindInt64 ("node", &Inode) == B_OK &&
+        Message.FindString ("name", &pName) == B_OK)
+        {
+          uint32 Cookie = mNextCookie++;
+          QueueEvent (CHANGE_MOVED_FROM, Device, DirectoryInode, "", Inode,
+            Cookie);
+          QueueEvent (CHANGE_MOVED_TO, Device, ToDirectoryInode, pName, 0,
+            Cookie);
+        }
+        break;
+
+      case B_STAT_CHANGED:
+      case B_ATTR_CHANGED:
+        if (Message.FindInt64 ("node", &Inode) == B_OK)
+          QueueEvent (CHANGE_ENTRY, Device, Inode, "", 0, 0);
+        break;
+    }
+
+    if (mQueuedEvents.size () != OldQueueSize)
+      release_sem (mEventSemaphore);
+  };
+
+private:
+  void QueueEvent (eChangeEventKinds Kind, dev_t Device, ino_t WatchedInode,
+    const char *pName, ino_t Inode, uint32 Cookie)
+  {
+    map<pair<dev_t, ino_t>, int>::iterator WatchIter =
+      mWatchIds.find (make_pair (Device, WatchedInode));
+    if (WatchIter == mWatchIds.end ())
+      return; // Moved to or from somewhere not being watched.
+    ChangeEvent Event (Kind, WatchIter->second);
+    Event.mName = pName;
+    Event.mInode = Inode;
+    Event.mCookie = Cookie;
+    mQueuedEvents.push_back (Event);
+  };
+
+  NodeMonitorLooper *mpLooper;
+  sem_id mEventSemaphore;
+  BLocker mLock; // For the rest, shared with the looper thread.
+  map<pair<dev_t, ino_t>, int> mWatchIds;
+  map<int, pair<dev_t, ino_t> > mWatchedNodes;
+  int mNextWatchId;
+  uint32 mNextCookie;
+  vector<ChangeEvent> mQueuedEvents;
+};
+
+
+void NodeMonitorLooper::MessageReceived (BMessage *pMessage)
+{
+  if (pMessage->what == B_NODE_MONITOR)
+    mNotifier.NodeMonitorMessage (*pMessage);
+  else
+    BLooper::MessageReceived (pMessage);
+}
+
+#elif defined (__linux__)
+
+/******************************************************************************
+ * Linux version, using inotify.  A watch on a directory reports changes to
+ * the things in it as well as to itself, so files don't need their own.
+ */
+
+static const uint32 WATCH_INOTIFY_MASK = IN_ATTRIB | IN_CLOSE_WRITE |
+  IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+  IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW;
+
+class ChangeNotifier
+{
+public:
+  ChangeNotifier () : mFileDescriptor (-1) {};
+
+  ~ChangeNotifier ()
+  {
+    if (mFileDescriptor >= 0)
+      close (mFileDescriptor);
+  };
+
+  status_t Init ()
+  {
+    mFileDescriptor = inotify_init1 (IN_CLOEXEC);
+    if (mFileDescriptor < 0)
+      return ERRNO_TO_STATUS (errno);
+    return B_OK;
+  };
+
+  status_t AddWatch (const char *pPath, const struct stat & /* Stat */,
+    bool IsDirectory, int *pWatchId)
+  {
+    TRACE_SPAN ("inotify_add_watch", pPath);
+    *pWatchId = -1;
+    if (!IsDirectory)
+      return B_OK;
+    int WatchId = inotify_add_watch (mFileDescriptor, pPath,
+      WATCH_INOTIFY_MASK);
+    if (WatchId < 0)
+      return ERRNO_TO_STATUS (errno);
+    *pWatchId = WatchId;
+    return B_OK;
+  };
+
+  void RemoveWatch (int WatchId)
+  {
+    // Fails harmlessly if the directory is gone, which removes the watch.
+    inotify_rm_watch (mFileDescriptor, WatchId);
+  };
+
+  // Returns after the timeout, or sooner if there are notifications or a
+  // signal arrives.
+  status_t WaitForEvents (int TimeoutMilliseconds,
+    vector<ChangeEvent> &Events)
+  {
+    struct pollfd PollRecord;
+    PollRecord.fd = mFileDescriptor;
+    PollRecord.events = POLLIN;
+    PollRecord.revents = 0;
+    int PollResult = poll (&PollRecord, 1, TimeoutMilliseconds);
+    if (PollResult < 0 && errno != EINTR)
+      return ERRNO_TO_STATUS (errno);
+    if (PollResult <= 0)
+      return B_OK;
+
+    char Buffer[64 * 1024]
+      __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    ssize_t AmountRead = read (mFileDescriptor, Buffer, sizeof (Buffer));
+    if (AmountRead < 0)
+      return (errno == EINTR) ? B_OK : ERRNO_TO_STATUS (errno);
+
+    char *pNext = Buffer;
+    while (pNext < Buffer + AmountRead)
+    {
+      const struct inotify_event *pEvent =
+        (const struct inotify_event *) pNext;
+      pNext += sizeof (struct inotify_event) + pEvent->len;
+
+      eChangeEventKinds Kind = CHANGE_ENTRY;
+      if (pEvent->mask & IN_Q_OVERFLOW)
+        Kind = CHANGE_RESCAN;
+      else if (pEvent->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+        Kind = CHANGE_WATCH_GONE;
+      else if (pEvent->mask & IN_MOVED_FROM)
+        Kind = CHANGE_MOVED_FROM;
+      else if (pEvent->mask & IN_MOVED_TO)
+        Kind = CHANGE_MOVED_TO;
+
+      ChangeEvent Event (Kind, pEvent->wd);
+      if (pEvent->len > 0)
+        Event.mName = pEvent->name; // NUL padded.
+      Event.mCookie = pEvent->cookie;
+      Events.push_back (Event);
+    }
+    return B_OK;
+  };
+
+private:
+  int mFileDescriptor;
+};
+
+#else
+
+/******************************************************************************
+ * Other platforms don't have change notifications we know about.
+ */
+
+class ChangeNotifier
+{
+public:
+  status_t Init () { return B_NOT_SUPPORTED; };
+
+  status_t AddWatch (const char * /* pPath */,
+    const struct stat & /* Stat */, bool /* IsDirectory */, int *pWatchId)
+  {
+    *pWatchId = -1;
+    return B_NOT_SUPPORTED;
+  };
+
+  void RemoveWatch (int /* WatchId */) {};
+
+  status_t WaitForEvents (int /* TimeoutMilliseconds */,
+    vector<ChangeEvent> & /* Events */)
+  {
+    return B_NOT_SUPPORTED;
+  };
+};
+
+#endif
+
+
+/******************************************************************************
+ * Path and stat utilities.
+ */
+
+static string ParentPath (const string &Path)
+{
+  string::size_type SlashIndex = Path.rfind ('/');
+  if (SlashIndex == string::npos)
+    return ".";
+  return Path.substr (0, SlashIndex);
+}
+
+
+static string LeafName (const string &Path)
+{
+  string::size_type SlashIndex = Path.rfind ('/');
+  if (SlashIndex == string::npos)
+    return Path;
+  return Path.substr (SlashIndex + 1);
+}
+
+
+// True if the path is the top one or something inside it.
+static bool IsInSubtree (const string &Path, const string &TopPath)
+{
+  return Path.compare (0, TopPath.size (), TopPath) == 0 &&
+    (Path.size () == TopPath.size () || Path[TopPath.size ()] == '/');
+}
+
+
+static int64 StatModifyTime (const struct stat &Stat)
+{
+#if defined (__linux__) || defined (__HAIKU__)
+  return Stat.st_mtim.tv_sec * (int64) 1000000000 + Stat.st_mtim.tv_nsec;
+#else
+  return Stat.st_mtime;
+#endif
+}
+
+
+static int64 StatChangeTime (const struct stat &Stat)
+{
+#if defined (__linux__) || defined (__HAIKU__)
+  return Stat.st_ctim.tv_sec * (int64) 1000000000 + Stat.st_ctim.tv_nsec;
+#else
+  return Stat.st_ctime;
+#endif
+}
+
+
+static status_t WatchOpenSourceDirectory (const string &Path,
+  const IOPolicyRecord &Policy, ObfuscateSourceDirectory **ppDirectory)
+{
+#ifdef OBFUSCATOR_BEOS
+  return BeOSOpenSourceDirectory (Path.c_str (), Policy, ppDirectory);
+#else
+  return PosixOpenSourceDirectory (Path.c_str (), Policy, ppDirectory);
+#endif
+}
+
+
+static status_t WatchOpenSinkDirectory (const string &Path,
+  const IOPolicyRecord &Policy, ObfuscateSinkDirectory **ppDirectory)
+{
+#ifdef OBFUSCATOR_BEOS
+  return BeOSOpenSinkDirectory (Path.c_str (), Policy,
+    false /* create */, ppDirectory);
+#else
+  return PosixOpenSinkDirectory (Path.c_str (), Policy,
+    false /* create */, ppDirectory);
+#endif
+}
+
+
+/******************************************************************************
+ * Deletes a destination file, or a directory and everything in it.
+ */
+
+static status_t RemoveDestTree (const string &Path)
+{
+  struct stat DestStat;
+  if (lstat (Path.c_str (), &DestStat) != 0)
+    return (errno == ENOENT) ? B_OK : ERRNO_TO_STATUS (errno);
+
+  if (!S_ISDIR (DestStat.st_mode))
+  {
+    if (unlink (Path.c_str ()) != 0)
+      return ERRNO_TO_STATUS (errno);
+    return B_OK;
+  }
+
+  DIR *pDirectory = opendir (Path.c_str ());
+  if (pDirectory == NULL)
+    return ERRNO_TO_STATUS (errno);
+  vector<string> Names;
+  struct dirent *pEntry;
+  while ((pEntry = readdir (pDirectory)) != NULL)
+  {
+    if (strcmp (pEntry->d_name, ".") != 0 && strcmp (pEntry->d_name, "..") != 0)
+      Names.push_back (pEntry->d_name);
+  }
+  closedir (pDirectory);
+
+  for (size_t i = 0; i < Names.size (); i++)
+  {
+    status_t ErrorNumber = RemoveDestTree (Path + "/" + Names[i]);
+    if (ErrorNumber != B_OK)
+      return ErrorNumber;
+  }
+  if (rmdir (Path.c_str ()) != 0)
+    return ERRNO_TO_STATUS (errno);
+  return B_OK;
+}
+
+
+/******************************************************************************
+ * WatchedMirror.
+ */
+
+WatchedMirror::WatchedMirror (Obfuscator &TheObfuscator,
+  const IOPolicyRecord &Policy)
+  : mObfuscator (TheObfuscator),
+    mPolicy (Policy),
+    mpNotifier (NULL),
+    mRescanNeeded (false),
+    mChangeCount (0)
+{
+}
+
+
+WatchedMirror::~WatchedMirror ()
+{
+  mObfuscator.SetEntryListener (NULL);
+  delete mpNotifier;
+}
+
+
+status_t WatchedMirror::Start (ObfuscateSourceDirectory &SourceDir,
+  ObfuscateSinkDirectory &DestDir)
+{
+  status_t ErrorNumber;
+
+  mpNotifier = new (std::nothrow) ChangeNotifier;
+  if (mpNotifier == NULL)
+    return B_NO_MEMORY;
+  ErrorNumber = mpNotifier->Init ();
+  if (ErrorNumber != B_OK)
+  {
+    DisplayErrorMessage ("Change notifications aren't available",
+      ErrorNumber, "WatchedMirror::Start");
+    return ErrorNumber;
+  }
+
+  // Watches go on before each directory is read, so nothing done to it during
+  // the initial pass gets missed.
+
+  struct stat RootStat;
+  mSourceRootPath = SourceDir.GetPath ();
+  if (stat (mSourceRootPath.c_str (), &RootStat) != 0)
+  {
+    ErrorNumber = ERRNO_TO_STATUS (errno);
+    DisplayErrorMessage (mSourceRootPath.c_str (), ErrorNumber,
+      "WatchedMirror::Start");
+    return ErrorNumber;
+  }
+  AddEntry (mSourceRootPath, DestDir.GetPath (), RootStat);
+
+  mObfuscator.SetEntryListener (this);
+  return mObfuscator.ObfuscateDirectory (SourceDir, DestDir);
+}
+
+
+void WatchedMirror::EntryObfuscated (ObfuscateSourceDirectory &SourceDir,
+  const char *pSourceName, const struct stat &SourceStat,
+  ObfuscateSinkDirectory &DestDir, const char *pDestName)
+{
+  AddEntry (string (SourceDir.GetPath ()) + "/" + pSourceName,
+    string (DestDir.GetPath ()) + "/" + pDestName, SourceStat);
+}
+
+
+/******************************************************************************
+ * Remember what a source entry was mirrored as, watching it if it is new.
+ */
+
+void WatchedMirror::AddEntry (const string &SourcePath,
+  const string &DestPath, const struct stat &SourceStat)
+{
+  WatchEntry &Entry = mEntries[SourcePath];
+  bool IsNew = Entry.mDestPath.empty ();
+
+  Entry.mDestPath = DestPath;
+  Entry.mIsDirectory = S_ISDIR (SourceStat.st_mode);
+  Entry.mInode = SourceStat.st_ino;
+  Entry.mSize = SourceStat.st_size;
+  Entry.mModifyTime = StatModifyTime (SourceStat);
+  Entry.mChangeTime = StatChangeTime (SourceStat);
+  if (!IsNew)
+    return;
+
+  Entry.mWatchId = -1;
+  status_t ErrorNumber = mpNotifier->AddWatch (SourcePath.c_str (),
+    SourceStat, Entry.mIsDirectory, &Entry.mWatchId);
+  if (ErrorNumber != B_OK)
+    DisplayErrorMessage (SourcePath.c_str (), ErrorNumber,
+      "WatchedMirror: Unable to watch for changes, they won't be mirrored");
+  else if (Entry.mWatchId >= 0)
+    mWatchPaths[Entry.mWatchId] = SourcePath;
+}
+
+
+/******************************************************************************
+ * Forget about an entry and everything in it, stopping their watches.
+ */
+
+void WatchedMirror::ForgetEntries (const string &SourcePath)
+{
+  map<string, WatchEntry>::iterator EntryIter =
+    mEntries.lower_bound (SourcePath);
+  while (EntryIter != mEntries.end () &&
+  EntryIter->first.compare (0, SourcePath.size (), SourcePath) == 0)
+  {
+    if (!IsInSubtree (EntryIter->first, SourcePath))
+    {
+      ++EntryIter; // A sibling with a longer name.
+      continue;
+    }
+    // A directory renamed into one which wasn't mirrored yet gets mirrored
+    // again before the old one is forgotten, and shares its watch.
+    map<int, string>::iterator WatchIter =
+      mWatchPaths.find (EntryIter->second.mWatchId);
+    if (WatchIter != mWatchPaths.end () &&
+    WatchIter->second == EntryIter->first)
+    {
+      mpNotifier->RemoveWatch (WatchIter->first);
+      mWatchPaths.erase (WatchIter);
+    }
+    mEntries.erase (EntryIter++);
+  }
+}
+
+
+/******************************************************************************
+ * Change the paths of an entry and everything in it after a rename, including
+ * changes waiting to be checked.
+ */
+
+void WatchedMirror::RenameEntries (const string &OldSourcePath,
+  const string &NewSourcePath, const string &OldDestPath,
+  const string &NewDestPath)
+{
+  vector<pair<string, WatchEntry> > MovedEntries;
+  map<string, WatchEntry>::iterator EntryIter =
+    mEntries.lower_bound (OldSourcePath);
+  while (EntryIter != mEntries.end () &&
+  EntryIter->first.compare (0, OldSourcePath.size (), OldSourcePath) == 0)
+  {
+    if (!IsInSubtree (EntryIter->first, OldSourcePath))
+    {
+      ++EntryIter;
+      continue;
+    }
+    MovedEntries.push_back (*EntryIter);
+    mEntries.erase (EntryIter++);
+  }
+
+  for (size_t i = 0; i < MovedEntries.size (); i++)
+  {
+    string SourcePath = NewSourcePath +
+      MovedEntries[i].first.substr (OldSourcePath.size ());
+    WatchEntry &Entry = mEntries[SourcePath];
+    Entry = MovedEntries[i].second;
+    Entry.mDestPath = NewDestPath +
+      Entry.mDestPath.substr (OldDestPath.size ());
+    if (Entry.mWatchId >= 0)
+      mWatchPaths[Entry.mWatchId] = SourcePath;
+  }
+
+  vector<string> MovedChecks;
+  set<string>::iterator CheckIter = mPendingChecks.begin ();
+  while (CheckIter != mPendingChecks.end ())
+  {
+    if (IsInSubtree (*CheckIter, OldSourcePath))
+    {
+      MovedChecks.push_back (NewSourcePath +
+        CheckIter->substr (OldSourcePath.size ()));
+      mPendingChecks.erase (CheckIter++);
+    }
+    else
+      ++CheckIter;
+  }
+  mPendingChecks.insert (MovedChecks.begin (), MovedChecks.end ());
+}
+
+
+string WatchedMirror::FindChildByInode (const string &DirectoryPath,
+  ino_t Inode)
+{
+  string Prefix = DirectoryPath + "/";
+  map<string, WatchEntry>::iterator EntryIter = mEntries.lower_bound (Prefix);
+  for (; EntryIter != mEntries.end () &&
+  EntryIter->first.compare (0, Prefix.size (), Prefix) == 0; ++EntryIter)
+  {
+    if (EntryIter->second.mInode == Inode &&
+    EntryIter->first.find ('/', Prefix.size ()) == string::npos)
+      return EntryIter->first;
+  }
+  return string ();
+}
+
+
+/******************************************************************************
+ * Turn a notification into a source path to check later.  Renames are done
+ * right away, so that later notifications from inside a renamed directory
+ * have the right paths.
+ */
+
+void WatchedMirror::NoteEvent (const ChangeEvent &Event)
+{
+  if (Event.mKind == CHANGE_RESCAN)
+  {
+    mRescanNeeded = true;
+    return;
+  }
+
+  map<int, string>::iterator WatchIter = mWatchPaths.find (Event.mWatchId);
+  if (WatchIter == mWatchPaths.end ())
+    return; // From a watch which has since been removed.
+
+  string SourcePath = WatchIter->second;
+  if (Event.mKind == CHANGE_WATCH_GONE)
+  {
+    mWatchPaths.erase (WatchIter);
+    map<string, WatchEntry>::iterator EntryIter = mEntries.find (SourcePath);
+    if (EntryIter != mEntries.end ())
+    {
+      // A directory renamed within the tree has already been moved by
+      // MirrorMove and is still there.  Watching it again gets back the same
+      // watch, or a new one if the old one really has gone.
+      WatchEntry &Entry = EntryIter->second;
+      struct stat SourceStat;
+      Entry.mWatchId = -1;
+      if (lstat (SourcePath.c_str (), &SourceStat) == 0 &&
+      S_ISDIR (SourceStat.st_mode) && SourceStat.st_ino == Entry.mInode &&
+      mpNotifier->AddWatch (SourcePath.c_str (), SourceStat, true,
+      &Entry.mWatchId) == B_OK && Entry.mWatchId >= 0)
+      {
+        mWatchPaths[Entry.mWatchId] = SourcePath;
+        return;
+      }
+    }
+    // Moved out of the tree or deleted.  Fails harmlessly if already gone.
+    mpNotifier->RemoveWatch (Event.mWatchId);
+    mPendingChecks.insert (SourcePath);
+    return;
+  }
+
+  if (!Event.mName.empty ())
+    SourcePath += "/" + Event.mName;
+  else if (Event.mInode != 0)
+  {
+    SourcePath = FindChildByInode (SourcePath, Event.mInode);
+    if (SourcePath.empty ())
+      return; // Something which wasn't mirrored.
+  }
+
+  if (Event.mKind == CHANGE_MOVED_FROM)
+    mPendingMoveSources[Event.mCookie] = SourcePath;
+  else if (Event.mKind == CHANGE_MOVED_TO)
+  {
+    map<uint32, string>::iterator MoveIter =
+      mPendingMoveSources.find (Event.mCookie);
+    if (MoveIter == mPendingMoveSources.end ())
+      mPendingChecks.insert (SourcePath); // Moved in from outside the tree.
+    else
+    {
+      string OldSourcePath = MoveIter->second;
+      mPendingMoveSources.erase (MoveIter);
+      MirrorMove (OldSourcePath, SourcePath);
+    }
+  }
+  else
+    mPendingChecks.insert (SourcePath);
+}
+
+
+bool WatchedMirror::HavePendingChanges () const
+{
+  return mRescanNeeded || !mPendingChecks.empty () ||
+    !mPendingMoveSources.empty ();
+}
+
+
+/******************************************************************************
+ * Compare all the changed entries with their mirrored versions and update
+ * them.  Parents sort before their contents, so a new directory gets done in
+ * one go and the checks of the things in it then find nothing to do.
+ */
+
+void WatchedMirror::ApplyPendingChanges ()
+{
+  TRACE_SPAN ("ApplyPendingChanges");
+  long long int OldChangeCount = mChangeCount;
+
+  // Renames whose other half never showed up were out of the watched tree.
+  map<uint32, string>::iterator MoveIter;
+  for (MoveIter = mPendingMoveSources.begin ();
+  MoveIter != mPendingMoveSources.end (); ++MoveIter)
+    mPendingChecks.insert (MoveIter->second);
+  mPendingMoveSources.clear ();
+
+  if (mRescanNeeded)
+  {
+    AddRescanChecks ();
+    mRescanNeeded = false;
+  }
+
+  set<string> Checks;
+  Checks.swap (mPendingChecks);
+  set<string>::iterator CheckIter;
+  for (CheckIter = Checks.begin (); CheckIter != Checks.end (); ++CheckIter)
+    MirrorEntry (*CheckIter);
+
+  if (mObfuscator.GetVerboseLevel () >= VERBOSE_DIR)
+    printf ("Mirrored %lld changes from %d notified entries.\n",
+      mChangeCount - OldChangeCount, (int) Checks.size ());
+}
+
+
+/******************************************************************************
+ * After lost notifications, check every mirrored entry and everything now in
+ * the mirrored directories.  Unchanged entries are skipped quickly since their
+ * stat information matches.
+ */
+
+void WatchedMirror::AddRescanChecks ()
+{
+  if (mObfuscator.GetVerboseLevel () > VERBOSE_NONE)
+    printf ("Too many changes at once, comparing all of \"%s\".\n",
+      mSourceRootPath.c_str ());
+
+  map<string, WatchEntry>::iterator EntryIter;
+  for (EntryIter = mEntries.begin (); EntryIter != mEntries.end (); ++EntryIter)
+  {
+    mPendingChecks.insert (EntryIter->first);
+    if (!EntryIter->second.mIsDirectory)
+      continue;
+
+    DIR *pDirectory = opendir (EntryIter->first.c_str ());
+    if (pDirectory == NULL)
+      continue;
+    struct dirent *pEntry;
+    while ((pEntry = readdir (pDirectory)) != NULL)
+    {
+      if (strcmp (pEntry->d_name, ".") != 0 &&
+      strcmp (pEntry->d_name, "..") != 0)
+        mPendingChecks.insert (EntryIter->first + "/" + pEntry->d_name);
+    }
+    closedir (pDirectory);
+  }
+}
+
+
+/******************************************************************************
+ * Rename the mirrored entry to go with a renamed source entry, keeping the
+ * obfuscated name unless something else already has it in the new directory.
+ */
+
+status_t WatchedMirror::MirrorMove (const string &OldSourcePath,
+  const string &NewSourcePath)
+{
+  TRACE_SPAN ("MirrorMove", NewSourcePath.c_str ());
+  char ErrorMessage [2 * PATH_MAX + 100];
+  status_t ErrorNumber;
+
+  map<string, WatchEntry>::iterator OldIter = mEntries.find (OldSourcePath);
+  map<string, WatchEntry>::iterator ParentIter =
+    mEntries.find (ParentPath (NewSourcePath));
+  struct stat SourceStat;
+  if (OldIter == mEntries.end () || ParentIter == mEntries.end () ||
+  lstat (NewSourcePath.c_str (), &SourceStat) != 0 ||
+  S_ISDIR (SourceStat.st_mode) != OldIter->second.mIsDirectory ||
+  (!S_ISDIR (SourceStat.st_mode) && !S_ISREG (SourceStat.st_mode)))
+  {
+    // Not mirrored or already gone or replaced again, sort it out by
+    // comparing.
+    mPendingChecks.insert (OldSourcePath);
+    mPendingChecks.insert (NewSourcePath);
+    return B_OK;
+  }
+
+  // Whatever the rename replaced goes away first.
+  if (mEntries.find (NewSourcePath) != mEntries.end ())
+    RemoveMirroredEntry (NewSourcePath);
+
+  string OldDestPath = OldIter->second.mDestPath;
+  string NewDestPath =
+    ParentIter->second.mDestPath + "/" + LeafName (OldDestPath);
+  struct stat DestStat;
+  if (NewDestPath != OldDestPath &&
+  lstat (NewDestPath.c_str (), &DestStat) == 0)
+  {
+    AutoDelete<ObfuscateSinkDirectory> DestDir;
+    ErrorNumber = WatchOpenSinkDirectory (ParentIter->second.mDestPath,
+      mPolicy, DestDir.Address ());
+    if (ErrorNumber != B_OK)
+    {
+      DisplayErrorMessage (ParentIter->second.mDestPath.c_str (), ErrorNumber,
+        "WatchedMirror: Unable to open destination directory");
+      return ErrorNumber;
+    }
+    char DestName[B_FILE_NAME_LENGTH];
+    mObfuscator.MakeDestName (LeafName (NewSourcePath).c_str (), *DestDir,
+      DestName);
+    NewDestPath = ParentIter->second.mDestPath + "/" + DestName;
+  }
+
+  if (rename (OldDestPath.c_str (), NewDestPath.c_str ()) != 0)
+  {
+    ErrorNumber = ERRNO_TO_STATUS (errno);
+    snprintf (ErrorMessage, sizeof (ErrorMessage),
+      "Unable to rename \"%s\" to \"%s\"", OldDestPath.c_str (),
+      NewDestPath.c_str ());
+    DisplayErrorMessage (ErrorMessage, ErrorNumber, "WatchedMirror");
+    mPendingChecks.insert (OldSourcePath);
+    mPendingChecks.insert (NewSourcePath);
+    return ErrorNumber;
+  }
+
+  RenameEntries (OldSourcePath, NewSourcePath, OldDestPath, NewDestPath);
+  AddEntry (NewSourcePath, NewDestPath, SourceStat); // Rename changes ctime.
+  mChangeCount++;
+
+  if (mObfuscator.GetVerboseLevel () >= VERBOSE_FILE)
+    printf ("Renamed \"%s\" to \"%s\", mirrored as \"%s\".\n",
+      OldSourcePath.c_str (), NewSourcePath.c_str (), NewDestPath.c_str ());
+  return B_OK;
+}
+
+
+/******************************************************************************
+ * Compare a source entry with what was last mirrored for it, and create,
+ * rewrite or delete the mirrored version to match.  Like ObfuscateDirectory,
+ * only files and directories get mirrored, symbolic links and other things
+ * are treated as if they weren't there, so a file replaced by a symbolic link
+ * disappears from the mirror just as it would from a fresh run.
+ */
+
+status_t WatchedMirror::MirrorEntry (const string &SourcePath)
+{
+  struct stat SourceStat;
+  bool Exists = (lstat (SourcePath.c_str (), &SourceStat) == 0);
+  if (Exists && !S_ISREG (SourceStat.st_mode) &&
+  !S_ISDIR (SourceStat.st_mode))
+  {
+    if (mObfuscator.GetVerboseLevel () >= VERBOSE_FILE)
+    {
+      if (S_ISLNK (SourceStat.st_mode))
+        printf ("Symbolic link \"%s\" will be ignored.\n",
+          SourcePath.c_str ());
+      else
+        printf ("Hard link or other unknown file system entity \"%s\" will "
+          "be ignored.\n", SourcePath.c_str ());
+    }
+    Exists = false;
+  }
+
+  map<string, WatchEntry>::iterator EntryIter = mEntries.find (SourcePath);
+  if (EntryIter != mEntries.end ())
+  {
+    WatchEntry &Entry = EntryIter->second;
+    if (SourcePath == mSourceRootPath)
+    {
+      // The top directory's contents are looked after separately, and the
+      // mirror is left alone if it goes away.
+      if (!Exists || !S_ISDIR (SourceStat.st_mode) ||
+      Entry.mChangeTime == StatChangeTime (SourceStat))
+        return B_OK;
+      return MirrorDirectoryAttributes (SourcePath, SourceStat);
+    }
+
+    if (Exists && Entry.mIsDirectory == S_ISDIR (SourceStat.st_mode))
+    {
+      if (Entry.mInode == SourceStat.st_ino &&
+      Entry.mSize == SourceStat.st_size &&
+      Entry.mModifyTime == StatModifyTime (SourceStat) &&
+      Entry.mChangeTime == StatChangeTime (SourceStat))
+        return B_OK; // Unchanged.
+
+      if (Entry.mIsDirectory)
+        return MirrorDirectoryAttributes (SourcePath, SourceStat);
+
+      // Files get rewritten under the same name, which also gets rid of
+      // attributes which have been removed.
+      string DestName = LeafName (Entry.mDestPath);
+      if (unlink (Entry.mDestPath.c_str ()) != 0 && errno != ENOENT)
+      {
+        status_t ErrorNumber = ERRNO_TO_STATUS (errno);
+        DisplayErrorMessage (Entry.mDestPath.c_str (), ErrorNumber,
+          "WatchedMirror: Unable to delete file for rewriting");
+        return ErrorNumber;
+      }
+      return MirrorNewEntry (SourcePath, SourceStat, DestName.c_str ());
+    }
+
+    status_t ErrorNumber = RemoveMirroredEntry (SourcePath);
+    if (ErrorNumber != B_OK || !Exists)
+      return ErrorNumber;
+  }
+
+  if (!Exists)
+    return B_OK; // Never was mirrored, or isn't a file or directory.
+  return MirrorNewEntry (SourcePath, SourceStat, NULL);
+}
+
+
+/******************************************************************************
+ * Obfuscate a file, or a directory and everything in it, into the mirrored
+ * version of its parent directory.  A new obfuscated name is made up if the
+ * destination name is NULL.
+ */
+
+status_t WatchedMirror::MirrorNewEntry (const string &SourcePath,
+  const struct stat &SourceStat, const char *pDestName)
+{
+  TRACE_SPAN ("MirrorNewEntry", SourcePath.c_str ());
+  status_t ErrorNumber;
+
+  map<string, WatchEntry>::iterator ParentIter =
+    mEntries.find (ParentPath (SourcePath));
+  if (ParentIter == mEntries.end ())
+    return B_OK; // Parent isn't mirrored, it will bring this along when it is.
+  string DestParentPath = ParentIter->second.mDestPath;
+
+  AutoDelete<ObfuscateSourceDirectory> SourceDir;
+  ErrorNumber = WatchOpenSourceDirectory (ParentIter->first, mPolicy,
+    SourceDir.Address ());
+  if (ErrorNumber != B_OK)
+  {
+    DisplayErrorMessage (ParentIter->first.c_str (), ErrorNumber,
+      "WatchedMirror: Unable to open source directory");
+    return ErrorNumber;
+  }
+
+  AutoDelete<ObfuscateSinkDirectory> DestDir;
+  ErrorNumber = WatchOpenSinkDirectory (DestParentPath, mPolicy,
+    DestDir.Address ());
+  if (ErrorNumber != B_OK)
+  {
+    DisplayErrorMessage (DestParentPath.c_str (), ErrorNumber,
+      "WatchedMirror: Unable to open destination directory");
+    return ErrorNumber;
+  }
+
+  string SourceName = LeafName (SourcePath);
+  char DestName[B_FILE_NAME_LENGTH];
+  if (pDestName != NULL)
+  {
+    strncpy (DestName, pDestName, sizeof (DestName) - 1);
+    DestName[sizeof (DestName) - 1] = 0;
+  }
+  else
+    mObfuscator.MakeDestName (SourceName.c_str (), *DestDir, DestName);
+
+  if (S_ISREG (SourceStat.st_mode))
+  {
+    AutoDelete<ObfuscateSourceFile> SourceFile;
+    ErrorNumber = SourceDir->OpenFile (SourceName.c_str (),
+      SourceFile.Address ());
+    if (ErrorNumber != B_OK)
+    {
+      DisplayErrorMessage (SourcePath.c_str (), ErrorNumber,
+        "WatchedMirror: Unable to open file for reading");
+      return ErrorNumber;
+    }
+    ErrorNumber = mObfuscator.ObfuscateFile (*SourceFile, SourceName.c_str (),
+      *DestDir, DestName);
+    if (ErrorNumber != B_OK)
+      return ErrorNumber;
+    AddEntry (SourcePath, DestParentPath + "/" + DestName, SourceStat);
+  }
+  else
+  {
+    AutoDelete<ObfuscateSinkDirectory> SubDestDir;
+    ErrorNumber = DestDir->CreateDirectory (DestName, SubDestDir.Address ());
+    if (ErrorNumber != B_OK)
+    {
+      DisplayErrorMessage (DestName, ErrorNumber,
+        "WatchedMirror: Failed to create destination directory");
+      return ErrorNumber;
+    }
+    AddEntry (SourcePath, DestParentPath + "/" + DestName, SourceStat);
+
+    AutoDelete<ObfuscateSourceDirectory> SubSourceDir;
+    ErrorNumber = SourceDir->OpenDirectory (SourceName.c_str (),
+      SubSourceDir.Address ());
+    if (ErrorNumber != B_OK)
+    {
+      DisplayErrorMessage (SourcePath.c_str (), ErrorNumber,
+        "WatchedMirror: Unable to open directory for reading");
+      return ErrorNumber;
+    }
+    ErrorNumber = mObfuscator.ObfuscateDirectory (*SubSourceDir, *SubDestDir);
+    if (ErrorNumber != B_OK)
+      return ErrorNumber;
+  }
+
+  mChangeCount++;
+  if (mObfuscator.GetVerboseLevel () >= VERBOSE_FILE)
+    printf ("%s \"%s\" as \"%s/%s\".\n",
+      (pDestName == NULL) ? "Created" : "Rewrote", SourcePath.c_str (),
+      DestParentPath.c_str (), DestName);
+  return B_OK;
+}
+
+
+status_t WatchedMirror::MirrorDirectoryAttributes (const string &SourcePath,
+  const struct stat &SourceStat)
+{
+  TRACE_SPAN ("MirrorDirectoryAttributes", SourcePath.c_str ());
+  status_t ErrorNumber;
+  string DestPath = mEntries[SourcePath].mDestPath;
+
+  AutoDelete<ObfuscateSourceDirectory> SourceDir;
+  ErrorNumber = WatchOpenSourceDirectory (SourcePath, mPolicy,
+    SourceDir.Address ());
+  if (ErrorNumber != B_OK)
+  {
+    DisplayErrorMessage (SourcePath.c_str (), ErrorNumber,
+      "WatchedMirror: Unable to open source directory");
+    return ErrorNumber;
+  }
+
+  AutoDelete<ObfuscateSinkDirectory> DestDir;
+  ErrorNumber = WatchOpenSinkDirectory (DestPath, mPolicy,
+    DestDir.Address ());
+  if (ErrorNumber != B_OK)
+  {
+    DisplayErrorMessage (DestPath.c_str (), ErrorNumber,
+      "WatchedMirror: Unable to open destination directory");
+    return ErrorNumber;
+  }
+
+  ErrorNumber = mObfuscator.ObfuscateAttributes (*SourceDir, *DestDir);
+  if (ErrorNumber != B_OK)
+    return ErrorNumber;
+  AddEntry (SourcePath, DestPath, SourceStat);
+
+  mChangeCount++;
+  if (mObfuscator.GetVerboseLevel () >= VERBOSE_FILE)
+    printf ("Updated attributes of directory \"%s\".\n", SourcePath.c_str ());
+  return B_OK;
+}
+
+
+status_t WatchedMirror::RemoveMirroredEntry (const string &SourcePath)
+{
+  TRACE_SPAN ("RemoveMirroredEntry", SourcePath.c_str ());
+  string DestPath = mEntries[SourcePath].mDestPath;
+
+  status_t ErrorNumber = RemoveDestTree (DestPath);
+  if (ErrorNumber != B_OK)
+  {
+    DisplayErrorMessage (DestPath.c_str (), ErrorNumber,
+      "WatchedMirror: Unable to delete mirrored entry");
+    return ErrorNumber;
+  }
+  ForgetEntries (SourcePath);
+
+  mChangeCount++;
+  if (mObfuscator.GetVerboseLevel () >= VERBOSE_FILE)
+    printf ("Deleted \"%s\", which was mirrored as \"%s\".\n",
+      SourcePath.c_str (), DestPath.c_str ());
+  return B_OK;
+}
+
+
+/******************************************************************************
+ * The main loop, collecting notifications and applying them once they settle
+ * down.
+ */
+
+status_t WatchedMirror::Watch (volatile sig_atomic_t *pStopRequested)
+{
+  const int64 QuietTime = WATCH_QUIET_MILLISECONDS * (int64) 1000000;
+  const int64 MaxDelayTime = WATCH_MAX_DELAY_MILLISECONDS * (int64) 1000000;
+  int64 FirstEventTime = 0;
+  int64 LastEventTime = 0;
+  vector<ChangeEvent> Events;
+
+  if (mpNotifier == NULL)
+    return B_BAD_VALUE; // Start wasn't done.
+
+  while (!*pStopRequested)
+  {
+    int TimeoutMilliseconds = 1000; // To notice being stopped.
+    if (HavePendingChanges ())
+    {
+      int64 Now = TraceNow ();
+      int64 Wait = LastEventTime + QuietTime - Now;
+      if (Wait > FirstEventTime + MaxDelayTime - Now)
+        Wait = FirstEventTime + MaxDelayTime - Now;
+      if (Wait < 0)
+        Wait = 0;
+      if (Wait / 1000000 < TimeoutMilliseconds)
+        TimeoutMilliseconds = Wait / 1000000 + 1;
+    }
+
+    Events.clear ();
+    status_t ErrorNumber = mpNotifier->WaitForEvents (TimeoutMilliseconds,
+      Events);
+    if (ErrorNumber != B_OK)
+    {
+      DisplayErrorMessage ("Problems getting change notifications",
+        ErrorNumber, "WatchedMirror::Watch");
+      return ErrorNumber;
+    }
+
+    int64 Now = TraceNow ();
+    if (!Events.empty ())
+    {
+      if (!HavePendingChanges ())
+        FirstEventTime = Now;
+      LastEventTime = Now;
+      for (size_t i = 0; i < Events.size (); i++)
+        NoteEvent (Events[i]);
+    }
+
+    if (HavePendingChanges () && (Now - LastEventTime >= QuietTime ||
+    Now - FirstEventTime >= MaxDelayTime))
+      ApplyPendingChanges ();
+  }
+
+  // Don't lose changes which came in just before stopping.
+  if (HavePendingChanges ())
+    ApplyPendingChanges ();
+  return B_OK;
+}
@@ -0,0 +1,122 @@
+/******************************************************************************
+ * ObfuscatorWatch.h
+ *
+ * Live mirror mode, which keeps an obfuscated copy of a directory tree up to
+ * date.  After the usual full pass, it listens for change notifications
+ * (inotify on Linux, the node monitor on BeOS and Haiku) and redoes just the
+ * entries which changed.  Notifications are collected until things have been
+ * quiet for a couple of seconds, or for at most half a minute if they keep on
+ * coming, so a burst of writes to one file gets done once.
+ *
+ * Then each changed source entry is compared with what was mirrored.  New
+ * entries get new obfuscated names, changed files are rewritten under their
+ * old obfuscated name, changed directories get their attributes redone,
+ * renamed entries are moved keeping their obfuscated name (unless it collides
+ * in the new directory) and deleted ones are deleted.  Since files are
+ * rewritten completely, attributes removed from a source file go away, but
+ * ones removed from a source directory stay on the mirrored directory.
+ *
+ * The mirror has to be a real directory, since deletes and renames are done
+ * on it by path, and the obfuscator has to be the one which did the initial
+ * pass so that new names keep on using its sequence numbers.
+ */
+
+#ifndef OBFUSCATOR_WATCH_H
+#define OBFUSCATOR_WATCH_H
+
+#include <signal.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ObfuscatorCore.h"
+#include "ObfuscatorIOPolicy.h"
+
+// Changes are applied once there have been no notifications for this long,
+// or this long after the first one if they don't stop.
+static const int WATCH_QUIET_MILLISECONDS = 2000;
+static const int WATCH_MAX_DELAY_MILLISECONDS = 30000;
+
+class ChangeNotifier;
+struct ChangeEvent;
+
+// What was mirrored for one source entry, keyed by source path.
+struct WatchEntry
+{
+  std::string mDestPath;
+  bool mIsDirectory;
+  int mWatchId; // -1 if the entry isn't watched itself.
+  ino_t mInode;
+  off_t mSize;
+  int64 mModifyTime; // Nanoseconds, or seconds where that's all there is.
+  int64 mChangeTime;
+};
+
+
+class WatchedMirror : public ObfuscateEntryListener
+{
+public:
+  // The obfuscator and policy have to outlive the mirror.
+  WatchedMirror (Obfuscator &TheObfuscator, const IOPolicyRecord &Policy);
+  virtual ~WatchedMirror ();
+
+  // Starts watching the source and does the full obfuscation of it into the
+  // destination, a directory opened with the platform's file system sink.
+  status_t Start (ObfuscateSourceDirectory &SourceDir,
+    ObfuscateSinkDirectory &DestDir);
+
+  // Keeps the mirror up to date until *pStopRequested becomes non-zero, from
+  // a signal handler say.  Problems with individual entries are displayed and
+  // then skipped, only a failure of the notifications stops it early.
+  status_t Watch (volatile sig_atomic_t *pStopRequested);
+
+  // Number of entries created, rewritten, moved or deleted after Start.
+  long long int GetChangeCount () const { return mChangeCount; };
+
+  virtual void EntryObfuscated (ObfuscateSourceDirectory &SourceDir,
+    const char *pSourceName, const struct stat &SourceStat,
+    ObfuscateSinkDirectory &DestDir, const char *pDestName);
+
+private:
+  WatchedMirror (const WatchedMirror &); // Not copyable.
+  WatchedMirror & operator = (const WatchedMirror &);
+
+  void AddEntry (const std::string &SourcePath, const std::string &DestPath,
+    const struct stat &SourceStat);
+  void ForgetEntries (const std::string &SourcePath);
+  void RenameEntries (const std::string &OldSourcePath,
+    const std::string &NewSourcePath, const std::string &OldDestPath,
+    const std::string &NewDestPath);
+  std::string FindChildByInode (const std::string &DirectoryPath,
+    ino_t Inode);
+
+  void NoteEvent (const ChangeEvent &Event);
+  bool HavePendingChanges () const;
+  void ApplyPendingChanges ();
+  void AddRescanChecks ();
+
+  status_t MirrorMove (const std::string &OldSourcePath,
+    const std::string &NewSourcePath);
+  status_t MirrorEntry (const std::string &SourcePath);
+  status_t MirrorNewEntry (const std::string &SourcePath,
+    const struct stat &SourceStat, const char *pDestName);
+  status_t MirrorDirectoryAttributes (const std::string &SourcePath,
+    const struct stat &SourceStat);
+  status_t RemoveMirroredEntry (const std::string &SourcePath);
+
+  Obfuscator &mObfuscator;
+  const IOPolicyRecord &mPolicy;
+  ChangeNotifier *mpNotifier;
+  std::string mSourceRootPath;
+  std::map<std::string, WatchEntry> mEntries;
+  std::map<int, std::string> mWatchPaths; // Source path for each watch.
+  std::set<std::string> mPendingChecks; // Source paths to compare.
+  std::map<uint32, std::string> mPendingMoveSources; // By move cookie.
+  bool mRescanNeeded; // Notifications were lost, compare everything.
+  long long int mChangeCount;
+};
+
+#endif /* OBFUSCATOR_WATCH_H */